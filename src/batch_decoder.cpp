@@ -0,0 +1,245 @@
+#include "batch_decoder.h"
+#include "cpu.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SIM_BATCH_DECODER_X86 1
+#endif
+
+namespace Sim {
+
+namespace {
+
+// decodeTable with the instruction format of each entry in bits 15:8, so that
+// one gather gives the SIMD paths both. Formats are those the immediate is
+// unpacked for, R (no immediate) for UNKNOWN.
+struct BatchTable final {
+public:
+    u32_t entries[1 << DECODE_INDEX_BITS] = {};
+
+    constexpr BatchTable()
+    {
+        for (u32_t i = 0; i < std::size(entries); ++i) {
+            u8_t const entry = decodeTable.entries[i];
+            u32_t const iType = (u32_t)isaDescription[entry & ((1 << DECODE_CHECK_SHIFT) - 1)].execParams.iType;
+            entries[i] = entry | (iType << 8);
+        }
+    }
+};
+
+constexpr BatchTable batchTable = {};
+
+static_assert((u32_t)InstructionType::R == 0, "Rejected words clear their format to R");
+
+// Raw output arrays: byte stores may alias the vectors' own pointers, which
+// would otherwise be reloaded after every store.
+struct Outputs final {
+    u8_t *isaEntry = nullptr;
+    u8_t *iType = nullptr;
+    u8_t *rd = nullptr;
+    u8_t *rs1 = nullptr;
+    u8_t *rs2 = nullptr;
+    u32_t *immExt = nullptr;
+};
+
+void DecodeScalar(Outputs out, Instruction const *words, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i) {
+        Instruction const inst = words[i];
+        ISAEntry const isaEntry = DecodeISAEntry(inst);
+        InstructionType const iType = isaDescription[(u32_t)isaEntry].execParams.iType;
+        out.isaEntry[i] = (u8_t)isaEntry;
+        out.iType[i] = (u8_t)iType;
+        out.rd[i] = inst.rType.rd;
+        out.rs1[i] = inst.rType.rs1;
+        out.rs2[i] = inst.rType.rs2;
+        out.immExt[i] = DecodeStage::UnpackImmediate(inst, iType);
+    }
+}
+
+#ifdef SIM_BATCH_DECODER_X86
+
+// Both paths compute the same thing lane-wise: the decode index, the table
+// entry, the reserved-bit check that turns a word into UNKNOWN, and all five
+// immediate layouts, of which the word's format selects one.
+
+__attribute__((target("sse4.1"))) inline void StoreBytes(u8_t *dst, __m128i v)
+{
+    __m128i const pick = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    u32_t const bytes = (u32_t)_mm_cvtsi128_si32(_mm_shuffle_epi8(v, pick));
+    std::memcpy(dst, &bytes, sizeof(bytes));
+}
+
+__attribute__((target("sse4.1"))) size_t DecodeSSE4(Outputs out, Instruction const *words, size_t count)
+{
+    __m128i const zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i const raw = _mm_loadu_si128((__m128i const *)(words + i));
+        __m128i const index = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(raw, _mm_set1_epi32(0x7f)),
+                _mm_and_si128(_mm_srli_epi32(raw, 5), _mm_set1_epi32(0x380))),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(raw, 20), _mm_set1_epi32(0x400)),
+                _mm_and_si128(_mm_srli_epi32(raw, 9), _mm_set1_epi32(0x800))));
+        __m128i const entry = _mm_setr_epi32(
+            batchTable.entries[_mm_extract_epi32(index, 0)], batchTable.entries[_mm_extract_epi32(index, 1)],
+            batchTable.entries[_mm_extract_epi32(index, 2)], batchTable.entries[_mm_extract_epi32(index, 3)]);
+
+        __m128i const check = _mm_srli_epi32(entry, DECODE_CHECK_SHIFT);
+        __m128i const checkMask = _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(check, _mm_set1_epi32(3)), _mm_set1_epi32(CHECK_FUNCT7)),
+                _mm_set1_epi32(decodeCheckMask[CHECK_FUNCT7])),
+            _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(check, _mm_set1_epi32(3)), _mm_set1_epi32(CHECK_IMM)),
+                _mm_set1_epi32(decodeCheckMask[CHECK_IMM])));
+        __m128i const ok = _mm_cmpeq_epi32(_mm_and_si128(raw, checkMask), zero);
+        __m128i const isaEntry = _mm_blendv_epi8(_mm_set1_epi32((u32_t)ISAEntry::UNKNOWN),
+            _mm_and_si128(entry, _mm_set1_epi32((1 << DECODE_CHECK_SHIFT) - 1)), ok);
+        __m128i const iType = _mm_and_si128(_mm_and_si128(_mm_srli_epi32(entry, 8), _mm_set1_epi32(0xff)), ok);
+
+        __m128i const sign12 = _mm_slli_epi32(_mm_srai_epi32(raw, 31), 12);
+        __m128i const sign20 = _mm_slli_epi32(_mm_srai_epi32(raw, 31), 20);
+        __m128i const immI = _mm_srai_epi32(raw, 20);
+        __m128i const immS = _mm_or_si128(_mm_slli_epi32(_mm_srai_epi32(raw, 25), 5),
+            _mm_and_si128(_mm_srli_epi32(raw, 7), _mm_set1_epi32(0x1f)));
+        __m128i const immB = _mm_or_si128(
+            _mm_or_si128(sign12, _mm_and_si128(_mm_slli_epi32(raw, 4), _mm_set1_epi32(0x800))),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(raw, 20), _mm_set1_epi32(0x7e0)),
+                _mm_and_si128(_mm_srli_epi32(raw, 7), _mm_set1_epi32(0x1e))));
+        __m128i const immU = _mm_and_si128(raw, _mm_set1_epi32(0xfffff000));
+        __m128i const immJ = _mm_or_si128(
+            _mm_or_si128(sign20, _mm_and_si128(raw, _mm_set1_epi32(0xff000))),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(raw, 9), _mm_set1_epi32(0x800)),
+                _mm_and_si128(_mm_srli_epi32(raw, 20), _mm_set1_epi32(0x7fe))));
+        __m128i const imm = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(iType, _mm_set1_epi32((u32_t)InstructionType::I)), immI),
+                _mm_and_si128(_mm_cmpeq_epi32(iType, _mm_set1_epi32((u32_t)InstructionType::S)), immS)),
+            _mm_or_si128(
+                _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(iType, _mm_set1_epi32((u32_t)InstructionType::B)), immB),
+                    _mm_and_si128(_mm_cmpeq_epi32(iType, _mm_set1_epi32((u32_t)InstructionType::U)), immU)),
+                _mm_and_si128(_mm_cmpeq_epi32(iType, _mm_set1_epi32((u32_t)InstructionType::J)), immJ)));
+
+        __m128i const regMask = _mm_set1_epi32(0x1f);
+        StoreBytes(out.isaEntry + i, isaEntry);
+        StoreBytes(out.iType + i, iType);
+        StoreBytes(out.rd + i, _mm_and_si128(_mm_srli_epi32(raw, 7), regMask));
+        StoreBytes(out.rs1 + i, _mm_and_si128(_mm_srli_epi32(raw, 15), regMask));
+        StoreBytes(out.rs2 + i, _mm_and_si128(_mm_srli_epi32(raw, 20), regMask));
+        _mm_storeu_si128((__m128i *)(out.immExt + i), imm);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) inline void StoreBytes(u8_t *dst, __m256i v)
+{
+    __m256i const pick = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pick), _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+    _mm_storel_epi64((__m128i *)dst, _mm256_castsi256_si128(v));
+}
+
+__attribute__((target("avx2"))) size_t DecodeAVX2(Outputs out, Instruction const *words, size_t count)
+{
+    __m256i const zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i const raw = _mm256_loadu_si256((__m256i const *)(words + i));
+        __m256i const index = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(raw, _mm256_set1_epi32(0x7f)),
+                _mm256_and_si256(_mm256_srli_epi32(raw, 5), _mm256_set1_epi32(0x380))),
+            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(raw, 20), _mm256_set1_epi32(0x400)),
+                _mm256_and_si256(_mm256_srli_epi32(raw, 9), _mm256_set1_epi32(0x800))));
+        __m256i const entry = _mm256_i32gather_epi32((int const *)batchTable.entries, index, sizeof(u32_t));
+
+        __m256i const check = _mm256_and_si256(_mm256_srli_epi32(entry, DECODE_CHECK_SHIFT), _mm256_set1_epi32(3));
+        __m256i const checkMask = _mm256_permutevar8x32_epi32(
+            _mm256_setr_epi32(decodeCheckMask[CHECK_NONE], decodeCheckMask[CHECK_FUNCT7], decodeCheckMask[CHECK_IMM],
+                0, 0, 0, 0, 0), check);
+        __m256i const ok = _mm256_cmpeq_epi32(_mm256_and_si256(raw, checkMask), zero);
+        __m256i const isaEntry = _mm256_blendv_epi8(_mm256_set1_epi32((u32_t)ISAEntry::UNKNOWN),
+            _mm256_and_si256(entry, _mm256_set1_epi32((1 << DECODE_CHECK_SHIFT) - 1)), ok);
+        __m256i const iType = _mm256_and_si256(_mm256_and_si256(_mm256_srli_epi32(entry, 8), _mm256_set1_epi32(0xff)), ok);
+
+        __m256i const sign12 = _mm256_slli_epi32(_mm256_srai_epi32(raw, 31), 12);
+        __m256i const sign20 = _mm256_slli_epi32(_mm256_srai_epi32(raw, 31), 20);
+        __m256i const immI = _mm256_srai_epi32(raw, 20);
+        __m256i const immS = _mm256_or_si256(_mm256_slli_epi32(_mm256_srai_epi32(raw, 25), 5),
+            _mm256_and_si256(_mm256_srli_epi32(raw, 7), _mm256_set1_epi32(0x1f)));
+        __m256i const immB = _mm256_or_si256(
+            _mm256_or_si256(sign12, _mm256_and_si256(_mm256_slli_epi32(raw, 4), _mm256_set1_epi32(0x800))),
+            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(raw, 20), _mm256_set1_epi32(0x7e0)),
+                _mm256_and_si256(_mm256_srli_epi32(raw, 7), _mm256_set1_epi32(0x1e))));
+        __m256i const immU = _mm256_and_si256(raw, _mm256_set1_epi32(0xfffff000));
+        __m256i const immJ = _mm256_or_si256(
+            _mm256_or_si256(sign20, _mm256_and_si256(raw, _mm256_set1_epi32(0xff000))),
+            _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(raw, 9), _mm256_set1_epi32(0x800)),
+                _mm256_and_si256(_mm256_srli_epi32(raw, 20), _mm256_set1_epi32(0x7fe))));
+        __m256i const imm = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi32(iType, _mm256_set1_epi32((u32_t)InstructionType::I)), immI),
+                _mm256_and_si256(_mm256_cmpeq_epi32(iType, _mm256_set1_epi32((u32_t)InstructionType::S)), immS)),
+            _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_and_si256(_mm256_cmpeq_epi32(iType, _mm256_set1_epi32((u32_t)InstructionType::B)), immB),
+                    _mm256_and_si256(_mm256_cmpeq_epi32(iType, _mm256_set1_epi32((u32_t)InstructionType::U)), immU)),
+                _mm256_and_si256(_mm256_cmpeq_epi32(iType, _mm256_set1_epi32((u32_t)InstructionType::J)), immJ)));
+
+        __m256i const regMask = _mm256_set1_epi32(0x1f);
+        StoreBytes(out.isaEntry + i, isaEntry);
+        StoreBytes(out.iType + i, iType);
+        StoreBytes(out.rd + i, _mm256_and_si256(_mm256_srli_epi32(raw, 7), regMask));
+        StoreBytes(out.rs1 + i, _mm256_and_si256(_mm256_srli_epi32(raw, 15), regMask));
+        StoreBytes(out.rs2 + i, _mm256_and_si256(_mm256_srli_epi32(raw, 20), regMask));
+        _mm256_storeu_si256((__m256i *)(out.immExt + i), imm);
+    }
+    return i;
+}
+
+#endif // SIM_BATCH_DECODER_X86
+
+} // namespace
+
+BatchDecoder::Path BatchDecoder::Best()
+{
+#ifdef SIM_BATCH_DECODER_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return Path::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return Path::SSE4;
+    }
+#endif
+    return Path::SCALAR;
+}
+
+void BatchDecoder::Decode(std::span<Instruction const> words)
+{
+    size_t const count = words.size();
+    isaEntry.resize(count);
+    iType.resize(count);
+    rd.resize(count);
+    rs1.resize(count);
+    rs2.resize(count);
+    immExt.resize(count);
+
+    Outputs const out = {
+        .isaEntry = (u8_t *)isaEntry.data(),
+        .iType = (u8_t *)iType.data(),
+        .rd = rd.data(),
+        .rs1 = rs1.data(),
+        .rs2 = rs2.data(),
+        .immExt = immExt.data(),
+    };
+    size_t done = 0;
+#ifdef SIM_BATCH_DECODER_X86
+    if (path == Path::AVX2) {
+        done = DecodeAVX2(out, words.data(), count);
+    } else if (path == Path::SSE4) {
+        done = DecodeSSE4(out, words.data(), count);
+    }
+#endif
+    DecodeScalar(out, words.data(), done, count);
+}
+
+} // namespace Sim
@@ -0,0 +1,41 @@
+#ifndef SIM_BATCH_DECODER_H
+#define SIM_BATCH_DECODER_H
+
+#include <types.h>
+#include <isa.h>
+#include <span>
+#include <vector>
+
+namespace Sim {
+
+// Decodes a run of instruction words at once into one array per field, the
+// same fields DecodeStage::Predecode fills in for a single word. The x86 paths
+// decode 4 (SSE4.1) or 8 (AVX2) words per step and are picked at run time;
+// words that do not fill a step, and other hosts, take the scalar path.
+struct BatchDecoder final {
+public:
+    enum class Path : u8_t {
+        SCALAR, SSE4, AVX2,
+    };
+
+    // The widest path the host supports.
+    static Path Best();
+
+    // May be lowered to compare paths, never raised above Best().
+    Path path = Best();
+
+    // Sized to the words of the last Decode(). iType is the instruction
+    // format the immediate was unpacked for, R for words that do not decode.
+    std::vector<ISAEntry> isaEntry = {};
+    std::vector<InstructionType> iType = {};
+    std::vector<u8_t> rd = {};
+    std::vector<u8_t> rs1 = {};
+    std::vector<u8_t> rs2 = {};
+    std::vector<u32_t> immExt = {};
+
+    void Decode(std::span<Instruction const> words);
+};
+
+} // namespace Sim
+
+#endif // SIM_BATCH_DECODER_H
@@ -0,0 +1,106 @@
+#include "batch_runner.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace Sim {
+
+BatchRunner::BatchRunner(u32_t threads, ExecMode mode) : mode(mode)
+{
+    if (!threads) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (u32_t i = 0; i < threads; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+}
+
+void BatchRunner::Run(BatchJob const *jobs, BatchResult *results, u32_t count)
+{
+    u32_t n = std::size(workers);
+    for (u32_t w = 0; w < n; ++w) {
+        workers[w]->begin = (u64_t)count * w / n;
+        workers[w]->end = (u64_t)count * (w + 1) / n;
+    }
+
+    std::vector<std::thread> threads = {};
+    for (u32_t w = 1; w < n; ++w) {
+        threads.emplace_back(&BatchRunner::Work, this, w, jobs, results);
+    }
+    Work(0, jobs, results);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void BatchRunner::Work(u32_t w, BatchJob const *jobs, BatchResult *results)
+{
+    auto &env = workers[w]->env;
+    u32_t job = 0;
+
+    while (Pop(w, &job) || Steal(w, &job)) {
+        if (!env) {
+            env.emplace(jobs[job].image, jobs[job].imageSize);
+        } else {
+            env->Reset(jobs[job].image, jobs[job].imageSize);
+        }
+        RunJob(*env, jobs[job], results[job]);
+    }
+}
+
+bool BatchRunner::Pop(u32_t w, u32_t *job)
+{
+    Worker &worker = *workers[w];
+    std::lock_guard<std::mutex> guard(worker.lock);
+    if (worker.begin == worker.end) {
+        return false;
+    }
+    *job = worker.begin++;
+    return true;
+}
+
+bool BatchRunner::Steal(u32_t w, u32_t *job)
+{
+    u32_t n = std::size(workers);
+    for (u32_t i = 1; i < n; ++i) {
+        Worker &victim = *workers[(w + i) % n];
+        u32_t begin = 0;
+        u32_t end = 0;
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.begin == victim.end) {
+                continue;
+            }
+            begin = victim.begin + (victim.end - victim.begin) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+
+        Worker &worker = *workers[w];
+        std::lock_guard<std::mutex> guard(worker.lock);
+        worker.begin = begin + 1;
+        worker.end = end;
+        *job = begin;
+        return true;
+    }
+    return false;
+}
+
+void BatchRunner::RunJob(CPUEnv &env, BatchJob const &job, BatchResult &result)
+{
+    CPU &cpu = env.cpu;
+
+    env.mode = mode;
+    cpu.fetchStage.state.read.pc = job.pc;
+    while (cpu.cycles < job.maxCycles && env.Resume(job.maxCycles - cpu.cycles) == StopReason::EXCEPTION) {
+    }
+
+    std::copy(std::begin(cpu.decodeStage.regfile.gpr), std::end(cpu.decodeStage.regfile.gpr),
+        std::begin(result.gpr));
+    result.exceptionPC = cpu.huModule.exceptionPC;
+    result.exceptionType = cpu.huModule.exceptionType;
+    result.cycles = cpu.cycles;
+    result.finished = cpu.shutdown;
+}
+
+} // namespace Sim
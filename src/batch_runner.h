@@ -0,0 +1,65 @@
+#ifndef SIM_BATCH_RUNNER_H
+#define SIM_BATCH_RUNNER_H
+
+#include <types.h>
+#include <cpu_env.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace Sim {
+
+struct BatchJob final {
+public:
+    void const *image = nullptr;
+    u32_t imageSize = 0;
+    u32_t pc = 0;
+    u64_t maxCycles = 0;
+};
+
+struct BatchResult final {
+public:
+    u32_t gpr[32] = {};
+    u32_t exceptionPC = 0;
+    HUExceptionType exceptionType = HUExceptionType::NONE;
+    u64_t cycles = 0;
+    bool finished = false;
+};
+
+// Runs independent jobs on a pool of worker threads. Each worker owns one
+// CPUEnv that is reset between jobs and writes only its jobs' result slots.
+// Jobs are split evenly up front; a worker that runs dry steals the upper half
+// of another worker's remaining range.
+// Budgets and cycle counts follow CPU::cycles for the selected mode.
+struct BatchRunner final {
+public:
+    explicit BatchRunner(u32_t threads = 0, ExecMode mode = ExecMode::PIPELINE);
+
+    void Run(BatchJob const *jobs, BatchResult *results, u32_t count);
+
+    u32_t Threads() const
+    {
+        return std::size(workers);
+    }
+
+private:
+    struct Worker final {
+        std::mutex lock = {};
+        u32_t begin = 0;
+        u32_t end = 0;
+        std::optional<CPUEnv> env = {};
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers = {};
+    ExecMode mode = ExecMode::PIPELINE;
+
+    void Work(u32_t w, BatchJob const *jobs, BatchResult *results);
+    bool Pop(u32_t w, u32_t *job);
+    bool Steal(u32_t w, u32_t *job);
+    void RunJob(CPUEnv &env, BatchJob const &job, BatchResult &result);
+};
+
+} // namespace Sim
+
+#endif // SIM_BATCH_RUNNER_H
@@ -0,0 +1,870 @@
+#include "cpu_env.h"
+#include "trace.h"
+#include "batch_decoder.h"
+#include "lane_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include <vector>
+
+// Simulator throughput on a set of RV32I kernels, in every execution mode.
+// Results go to stdout as JSON:
+//   huawei-riscv-rv32i-bench [--scale F] [--kernel NAME] [--mode NAME] [--trace FILE] [--trace-level full|flow]
+// Every kernel runs CODE_BASE.. with its outer iteration count at address
+// ITERATIONS and leaves a checksum in a0, which is checked against a host
+// model of the kernel.
+// --trace writes every timed run's execution trace to FILE (each run
+// overwrites the last) to measure tracing overhead, at the --trace-level
+// given (full by default). "decode" times the
+// instruction decoder alone on words sampled across all 2^32 encodings.
+// Each run's peak_rss_kib is the resident set high-water mark from the start
+// of the run, where Linux lets it be reset (otherwise null); the top-level one
+// covers the whole process.
+
+namespace {
+
+constexpr u32_t MEMORY_SIZE = 64 << 10;
+constexpr u32_t CODE_BASE = 1024;
+constexpr u32_t ITERATIONS = 32;
+constexpr u32_t DATA = 0x4000;
+
+enum Reg : u32_t {
+    ZERO = 0, RA, SP, GP, TP, T0, T1, T2, S0, S1, A0, A1, A2, A3, A4, A5, A6, A7,
+    S2, S3, S4, S5, S6, S7, S8, S9, S10, S11, T3, T4, T5, T6,
+};
+
+// Just enough of an assembler for the kernels below: labels are resolved by
+// Finish(), unconditional jumps are emitted as beq zero, zero.
+struct Asm final {
+public:
+    std::vector<u32_t> code = {};
+
+    u32_t Label()
+    {
+        labels.push_back(~0u);
+        return std::size(labels) - 1;
+    }
+    void Bind(u32_t label)
+    {
+        labels[label] = std::size(code);
+    }
+
+    void R(u32_t funct7, u32_t funct3, u32_t rd, u32_t rs1, u32_t rs2)
+    {
+        code.push_back((funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | 0b0110011);
+    }
+    void I(u32_t opcode, u32_t funct3, u32_t rd, u32_t rs1, i32_t imm)
+    {
+        code.push_back(((u32_t)imm << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode);
+    }
+    void B(u32_t funct3, u32_t rs1, u32_t rs2, u32_t label)
+    {
+        fixups.push_back({ (u32_t)std::size(code), label });
+        code.push_back((rs2 << 20) | (rs1 << 15) | (funct3 << 12) | 0b1100011);
+    }
+
+    void Add(u32_t rd, u32_t rs1, u32_t rs2) { R(0, 0b000, rd, rs1, rs2); }
+    void Sub(u32_t rd, u32_t rs1, u32_t rs2) { R(0x20, 0b000, rd, rs1, rs2); }
+    void Xor(u32_t rd, u32_t rs1, u32_t rs2) { R(0, 0b100, rd, rs1, rs2); }
+    void Or(u32_t rd, u32_t rs1, u32_t rs2) { R(0, 0b110, rd, rs1, rs2); }
+    void And(u32_t rd, u32_t rs1, u32_t rs2) { R(0, 0b111, rd, rs1, rs2); }
+    void Addi(u32_t rd, u32_t rs1, i32_t imm) { I(0b0010011, 0b000, rd, rs1, imm); }
+    void Xori(u32_t rd, u32_t rs1, i32_t imm) { I(0b0010011, 0b100, rd, rs1, imm); }
+    void Ori(u32_t rd, u32_t rs1, i32_t imm) { I(0b0010011, 0b110, rd, rs1, imm); }
+    void Andi(u32_t rd, u32_t rs1, i32_t imm) { I(0b0010011, 0b111, rd, rs1, imm); }
+    void Slli(u32_t rd, u32_t rs1, u32_t sh) { I(0b0010011, 0b001, rd, rs1, sh); }
+    void Srli(u32_t rd, u32_t rs1, u32_t sh) { I(0b0010011, 0b101, rd, rs1, sh); }
+    void Lw(u32_t rd, i32_t off, u32_t rs1) { I(0b0000011, 0b010, rd, rs1, off); }
+    void Sw(u32_t rs2, i32_t off, u32_t rs1)
+    {
+        u32_t imm = off;
+        code.push_back(((imm >> 5) << 25) | (rs2 << 20) | (rs1 << 15) | (0b010 << 12) | ((imm & 0x1f) << 7) |
+            0b0100011);
+    }
+    void Beq(u32_t rs1, u32_t rs2, u32_t label) { B(0b000, rs1, rs2, label); }
+    void Bne(u32_t rs1, u32_t rs2, u32_t label) { B(0b001, rs1, rs2, label); }
+    void Blt(u32_t rs1, u32_t rs2, u32_t label) { B(0b100, rs1, rs2, label); }
+    void Bltu(u32_t rs1, u32_t rs2, u32_t label) { B(0b110, rs1, rs2, label); }
+    void Bgeu(u32_t rs1, u32_t rs2, u32_t label) { B(0b111, rs1, rs2, label); }
+    void J(u32_t label) { Beq(ZERO, ZERO, label); }
+    void Ebreak() { code.push_back(0x00100073U); }
+
+    void Lui(u32_t rd, u32_t imm20) { code.push_back((imm20 << 12) | (rd << 7) | 0b0110111); }
+
+    // lui of the upper bits rounded so that the sign-extended low 12 bits of
+    // the addi that follows add up to value.
+    void Li(u32_t rd, u32_t value)
+    {
+        if (value < 2048) {
+            Addi(rd, ZERO, value);
+            return;
+        }
+        Lui(rd, (value + 0x800) >> 12);
+        if (value & 0xfff) {
+            Addi(rd, rd, (i32_t)(value << 20) >> 20);
+        }
+    }
+
+    // Outer loop counting s11 up to the iteration count in a6.
+    void Begin(u32_t outer)
+    {
+        Lw(A6, ITERATIONS, ZERO);
+        Addi(S11, ZERO, 0);
+        Bind(outer);
+    }
+    void End(u32_t outer)
+    {
+        Addi(S11, S11, 1);
+        Blt(S11, A6, outer);
+        Ebreak();
+    }
+
+    std::vector<u32_t> Finish()
+    {
+        for (auto [at, label] : fixups) {
+            u32_t imm = (labels[label] - at) * sizeof(u32_t);
+            code[at] |= (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3f) << 25) | (((imm >> 1) & 0xf) << 8) |
+                (((imm >> 11) & 1) << 7);
+        }
+        return code;
+    }
+
+private:
+    std::vector<u32_t> labels = {};
+    std::vector<std::pair<u32_t, u32_t>> fixups = {};
+};
+
+u32_t XorShift(u32_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+struct Kernel final {
+    char const *name = nullptr;
+    u32_t iterations = 0;
+    std::vector<u32_t> (*code)() = nullptr;
+    void (*data)(u32_t *memory) = nullptr;
+    u32_t (*expected)(u32_t const *memory, u32_t iterations) = nullptr;
+};
+
+// Test4's counting loop, with the bound taken from memory.
+std::vector<u32_t> CountLoop()
+{
+    return {
+        0x20000413U, // li s0, 512
+        0xfe042623U, // sw zero, -20(s0)
+        0xfe042423U, // sw zero, -24(s0)
+        0x02002803U, // lw a6, 32(zero)
+        0x01c0006fU, // j L3
+        0xfec42783U, // lw a5, -20(s0) (L4)
+        0x00278793U, // addi a5, a5, 2
+        0xfef42623U, // sw a5, -20(s0)
+        0xfe842783U, // lw a5, -24(s0)
+        0x00178793U, // addi a5, a5, 1
+        0xfef42423U, // sw a5, -24(s0)
+        0xfe842703U, // lw a4, -24(s0) (L3)
+        0xff0742e3U, // blt a4, a6, L4
+        0xfec42503U, // lw a0, -20(s0)
+        0x00100073U  // ebreak
+    };
+}
+
+u32_t CountLoopExpected(u32_t const *, u32_t iterations)
+{
+    return 2 * iterations;
+}
+
+// xorshift with data-dependent branches.
+std::vector<u32_t> Branchy()
+{
+    return {
+        0x02002803U, // lw a6, 32(zero)
+        0x00100513U, // li a0, 1
+        0x00000593U, // li a1, 0
+        0x00000613U, // li a2, 0
+        0x00000293U, // li t0, 0
+        0x00d51313U, // slli t1, a0, 13 (loop)
+        0x00654533U, // xor a0, a0, t1
+        0x01155313U, // srli t1, a0, 17
+        0x00654533U, // xor a0, a0, t1
+        0x00551313U, // slli t1, a0, 5
+        0x00654533U, // xor a0, a0, t1
+        0x00157393U, // andi t2, a0, 1
+        0x00038c63U, // beqz t2, even
+        0x00360613U, // addi a2, a2, 3
+        0x00257e13U, // andi t3, a0, 2
+        0x000e0e63U, // beqz t3, next
+        0x05564613U, // xori a2, a2, 85
+        0x0140006fU, // j next
+        0x00158593U, // addi a1, a1, 1 (even)
+        0x00457e13U, // andi t3, a0, 4
+        0x000e1463U, // bnez t3, next
+        0x40b60633U, // sub a2, a2, a1
+        0x00128293U, // addi t0, t0, 1 (next)
+        0xfb02cce3U, // blt t0, a6, loop
+        0x00100073U  // ebreak
+    };
+}
+
+u32_t BranchyExpected(u32_t const *, u32_t iterations)
+{
+    u32_t a0 = 1;
+    for (u32_t i = 0; i < iterations; ++i) {
+        a0 = XorShift(a0);
+    }
+    return a0;
+}
+
+constexpr u32_t MEMCPY_WORDS = 1024;
+
+std::vector<u32_t> Memcpy()
+{
+    Asm a = {};
+    u32_t outer = a.Label();
+    u32_t copy = a.Label();
+
+    a.Begin(outer);
+    a.Li(T0, DATA);
+    a.Li(T1, DATA + 2 * MEMCPY_WORDS * sizeof(u32_t));
+    a.Li(T2, DATA + MEMCPY_WORDS * sizeof(u32_t));
+    a.Bind(copy);
+    for (u32_t i = 0; i < 4; ++i) {
+        a.Lw(A0 + i, 4 * i, T0);
+    }
+    for (u32_t i = 0; i < 4; ++i) {
+        a.Sw(A0 + i, 4 * i, T1);
+    }
+    a.Addi(T0, T0, 16);
+    a.Addi(T1, T1, 16);
+    a.Bltu(T0, T2, copy);
+    a.Xor(A0, A0, A3);
+    a.End(outer);
+    return a.Finish();
+}
+
+void MemcpyData(u32_t *memory)
+{
+    for (u32_t i = 0; i < MEMCPY_WORDS; ++i) {
+        memory[DATA / sizeof(u32_t) + i] = i * 2654435761U;
+    }
+}
+
+u32_t MemcpyExpected(u32_t const *memory, u32_t)
+{
+    u32_t const *src = memory + DATA / sizeof(u32_t);
+    u32_t const *dst = src + 2 * MEMCPY_WORDS;
+    if (!std::equal(src, src + MEMCPY_WORDS, dst)) {
+        return ~dst[0];
+    }
+    return src[MEMCPY_WORDS - 4] ^ src[MEMCPY_WORDS - 1];
+}
+
+constexpr u32_t CRC_WORDS = 256;
+constexpr u32_t CRC_POLY = 0xedb88320;
+
+// Bitwise reflected CRC32, carried across iterations.
+std::vector<u32_t> Crc32()
+{
+    Asm a = {};
+    u32_t outer = a.Label();
+    u32_t word = a.Label();
+    u32_t bit = a.Label();
+
+    a.Li(S0, CRC_POLY);
+    a.Addi(A0, ZERO, -1);
+    a.Begin(outer);
+    a.Li(T0, DATA);
+    a.Li(T2, DATA + CRC_WORDS * sizeof(u32_t));
+    a.Bind(word);
+    a.Lw(T1, 0, T0);
+    a.Xor(A0, A0, T1);
+    a.Addi(T3, ZERO, 32);
+    a.Bind(bit);
+    a.Andi(T4, A0, 1);
+    a.Sub(T4, ZERO, T4);
+    a.And(T4, T4, S0);
+    a.Srli(A0, A0, 1);
+    a.Xor(A0, A0, T4);
+    a.Addi(T3, T3, -1);
+    a.Bne(T3, ZERO, bit);
+    a.Addi(T0, T0, 4);
+    a.Bltu(T0, T2, word);
+    a.End(outer);
+    return a.Finish();
+}
+
+void Crc32Data(u32_t *memory)
+{
+    u32_t x = 0x12345678;
+    for (u32_t i = 0; i < CRC_WORDS; ++i) {
+        memory[DATA / sizeof(u32_t) + i] = x = XorShift(x);
+    }
+}
+
+u32_t Crc32Expected(u32_t const *memory, u32_t iterations)
+{
+    u32_t crc = ~0u;
+    for (u32_t n = 0; n < iterations; ++n) {
+        for (u32_t i = 0; i < CRC_WORDS; ++i) {
+            crc ^= memory[DATA / sizeof(u32_t) + i];
+            for (u32_t b = 0; b < 32; ++b) {
+                crc = (crc >> 1) ^ (CRC_POLY & -(crc & 1));
+            }
+        }
+    }
+    return crc;
+}
+
+constexpr u32_t MATRIX_N = 16;
+constexpr u32_t MATRIX_A = DATA;
+constexpr u32_t MATRIX_B = DATA + MATRIX_N * MATRIX_N * sizeof(u32_t);
+constexpr u32_t MATRIX_C = DATA + 2 * MATRIX_N * MATRIX_N * sizeof(u32_t);
+
+// C = A * B with shift-and-add multiplication; a0 sums C over all iterations.
+std::vector<u32_t> Matmul()
+{
+    Asm a = {};
+    u32_t outer = a.Label();
+    u32_t iloop = a.Label();
+    u32_t jloop = a.Label();
+    u32_t kloop = a.Label();
+    u32_t mul = a.Label();
+    u32_t skip = a.Label();
+    u32_t done = a.Label();
+
+    a.Li(S5, MATRIX_A);
+    a.Li(S6, MATRIX_B);
+    a.Li(S7, MATRIX_C);
+    a.Addi(T3, ZERO, MATRIX_N);
+    a.Begin(outer);
+    a.Addi(S1, ZERO, 0);
+    a.Bind(iloop);
+    a.Addi(S2, ZERO, 0);
+    a.Bind(jloop);
+    a.Addi(S3, ZERO, 0);
+    a.Addi(S4, ZERO, 0);
+    a.Bind(kloop);
+    a.Slli(T0, S1, 6);
+    a.Slli(T1, S3, 2);
+    a.Add(T0, T0, T1);
+    a.Add(T0, T0, S5);
+    a.Lw(A1, 0, T0);
+    a.Slli(T0, S3, 6);
+    a.Slli(T1, S2, 2);
+    a.Add(T0, T0, T1);
+    a.Add(T0, T0, S6);
+    a.Lw(A2, 0, T0);
+    a.Bind(mul);
+    a.Beq(A2, ZERO, done);
+    a.Andi(T2, A2, 1);
+    a.Beq(T2, ZERO, skip);
+    a.Add(S4, S4, A1);
+    a.Bind(skip);
+    a.Slli(A1, A1, 1);
+    a.Srli(A2, A2, 1);
+    a.J(mul);
+    a.Bind(done);
+    a.Addi(S3, S3, 1);
+    a.Blt(S3, T3, kloop);
+    a.Slli(T0, S1, 6);
+    a.Slli(T1, S2, 2);
+    a.Add(T0, T0, T1);
+    a.Add(T0, T0, S7);
+    a.Sw(S4, 0, T0);
+    a.Add(A0, A0, S4);
+    a.Addi(S2, S2, 1);
+    a.Blt(S2, T3, jloop);
+    a.Addi(S1, S1, 1);
+    a.Blt(S1, T3, iloop);
+    a.End(outer);
+    return a.Finish();
+}
+
+void MatmulData(u32_t *memory)
+{
+    u32_t x = 0x9e3779b9;
+    for (u32_t i = 0; i < 2 * MATRIX_N * MATRIX_N; ++i) {
+        x = XorShift(x);
+        memory[MATRIX_A / sizeof(u32_t) + i] = x & 0xff;
+    }
+}
+
+u32_t MatmulExpected(u32_t const *memory, u32_t iterations)
+{
+    u32_t const *m = memory + MATRIX_A / sizeof(u32_t);
+    u32_t sum = 0;
+    for (u32_t i = 0; i < MATRIX_N; ++i) {
+        for (u32_t j = 0; j < MATRIX_N; ++j) {
+            for (u32_t k = 0; k < MATRIX_N; ++k) {
+                sum += m[i * MATRIX_N + k] * m[MATRIX_N * MATRIX_N + k * MATRIX_N + j];
+            }
+        }
+    }
+    return sum * iterations;
+}
+
+constexpr u32_t SORT_WORDS = 256;
+constexpr u32_t SORT_SEED = 2463534242U;
+
+// Refill with xorshift values and insertion sort (unsigned) each iteration.
+std::vector<u32_t> Sort()
+{
+    Asm a = {};
+    u32_t outer = a.Label();
+    u32_t fill = a.Label();
+    u32_t iloop = a.Label();
+    u32_t jloop = a.Label();
+    u32_t insert = a.Label();
+
+    a.Li(S0, SORT_SEED);
+    a.Li(S3, DATA);
+    a.Li(T2, DATA + SORT_WORDS * sizeof(u32_t));
+    a.Begin(outer);
+    a.Addi(T0, S3, 0);
+    a.Bind(fill);
+    a.Slli(T1, S0, 13);
+    a.Xor(S0, S0, T1);
+    a.Srli(T1, S0, 17);
+    a.Xor(S0, S0, T1);
+    a.Slli(T1, S0, 5);
+    a.Xor(S0, S0, T1);
+    a.Sw(S0, 0, T0);
+    a.Addi(T0, T0, 4);
+    a.Bltu(T0, T2, fill);
+    a.Addi(S1, S3, 4);
+    a.Bind(iloop);
+    a.Lw(A1, 0, S1);
+    a.Addi(S2, S1, -4);
+    a.Bind(jloop);
+    a.Bltu(S2, S3, insert);
+    a.Lw(A2, 0, S2);
+    a.Bgeu(A1, A2, insert);
+    a.Sw(A2, 4, S2);
+    a.Addi(S2, S2, -4);
+    a.J(jloop);
+    a.Bind(insert);
+    a.Sw(A1, 4, S2);
+    a.Addi(S1, S1, 4);
+    a.Bltu(S1, T2, iloop);
+    a.Lw(T0, 0, S3);
+    a.Lw(T1, (SORT_WORDS - 1) * sizeof(u32_t), S3);
+    a.Xor(T0, T0, T1);
+    a.Add(A0, A0, T0);
+    a.End(outer);
+    return a.Finish();
+}
+
+u32_t SortExpected(u32_t const *memory, u32_t iterations)
+{
+    u32_t x = SORT_SEED;
+    u32_t sum = 0;
+    std::vector<u32_t> values(SORT_WORDS);
+    for (u32_t n = 0; n < iterations; ++n) {
+        for (auto &v : values) {
+            v = x = XorShift(x);
+        }
+        std::sort(values.begin(), values.end());
+        sum += values.front() ^ values.back();
+    }
+    u32_t const *sorted = memory + DATA / sizeof(u32_t);
+    return std::equal(values.begin(), values.end(), sorted) ? sum : ~sum;
+}
+
+enum Bytecode : u32_t {
+    OP_ADD, OP_XOR, OP_ROL, OP_LOOP, OP_HALT,
+};
+
+constexpr u32_t BYTECODE_LOOPS = 100;
+constexpr u32_t bytecode[][2] = {
+    { OP_ADD, 7 }, { OP_XOR, 0x55 }, { OP_ROL, 0 }, { OP_ADD, 3 }, { OP_LOOP, 0 }, { OP_HALT, 0 },
+};
+
+// Accumulator machine dispatching on a chain of compares.
+std::vector<u32_t> Interp()
+{
+    Asm a = {};
+    u32_t outer = a.Label();
+    u32_t dispatch = a.Label();
+    u32_t opAdd = a.Label();
+    u32_t opXor = a.Label();
+    u32_t opRol = a.Label();
+    u32_t opLoop = a.Label();
+    u32_t halt = a.Label();
+
+    a.Li(S3, DATA);
+    a.Begin(outer);
+    a.Addi(S2, ZERO, BYTECODE_LOOPS);
+    a.Addi(S1, S3, 0);
+    a.Bind(dispatch);
+    a.Lw(T0, 0, S1);
+    a.Lw(T1, 4, S1);
+    a.Addi(S1, S1, 8);
+    a.Beq(T0, ZERO, opAdd);
+    a.Addi(T2, ZERO, OP_XOR);
+    a.Beq(T0, T2, opXor);
+    a.Addi(T2, ZERO, OP_ROL);
+    a.Beq(T0, T2, opRol);
+    a.Addi(T2, ZERO, OP_LOOP);
+    a.Beq(T0, T2, opLoop);
+    a.J(halt);
+    a.Bind(opAdd);
+    a.Add(A0, A0, T1);
+    a.J(dispatch);
+    a.Bind(opXor);
+    a.Xor(A0, A0, T1);
+    a.J(dispatch);
+    a.Bind(opRol);
+    a.Slli(T2, A0, 1);
+    a.Srli(T3, A0, 31);
+    a.Or(A0, T2, T3);
+    a.J(dispatch);
+    a.Bind(opLoop);
+    a.Addi(S2, S2, -1);
+    a.Beq(S2, ZERO, dispatch);
+    a.Slli(T2, T1, 3);
+    a.Add(S1, S3, T2);
+    a.J(dispatch);
+    a.Bind(halt);
+    a.End(outer);
+    return a.Finish();
+}
+
+void InterpData(u32_t *memory)
+{
+    std::memcpy(memory + DATA / sizeof(u32_t), bytecode, sizeof(bytecode));
+}
+
+u32_t InterpExpected(u32_t const *, u32_t iterations)
+{
+    u32_t acc = 0;
+    for (u32_t n = 0; n < iterations; ++n) {
+        u32_t count = BYTECODE_LOOPS;
+        for (u32_t pc = 0; bytecode[pc][0] != OP_HALT;) {
+            auto [op, arg] = bytecode[pc++];
+            switch (op) {
+                case OP_ADD: acc += arg; break;
+                case OP_XOR: acc ^= arg; break;
+                case OP_ROL: acc = (acc << 1) | (acc >> 31); break;
+                case OP_LOOP: pc = --count ? arg : pc; break;
+            }
+        }
+    }
+    return acc;
+}
+
+Kernel const kernels[] = {
+    { "count-loop", 1000000, &CountLoop, nullptr, &CountLoopExpected },
+    { "branchy", 1000000, &Branchy, nullptr, &BranchyExpected },
+    { "memcpy", 1500, &Memcpy, &MemcpyData, &MemcpyExpected },
+    { "crc32", 60, &Crc32, &Crc32Data, &Crc32Expected },
+    { "matmul", 12, &Matmul, &MatmulData, &MatmulExpected },
+    { "sort", 40, &Sort, nullptr, &SortExpected },
+    { "interp", 800, &Interp, &InterpData, &InterpExpected },
+};
+
+struct Mode final {
+    char const *name = nullptr;
+    Sim::ExecMode mode = Sim::ExecMode::PIPELINE;
+    bool threaded = true;
+};
+
+Mode const modes[] = {
+    { "pipeline", Sim::ExecMode::PIPELINE },
+    { "functional", Sim::ExecMode::FUNCTIONAL },
+    { "block-switch", Sim::ExecMode::BLOCK, false },
+    { "block-threaded", Sim::ExecMode::BLOCK, true },
+    { "jit", Sim::ExecMode::JIT },
+};
+
+struct Run final {
+    u64_t cycles = 0;
+    double seconds = 0;
+    u32_t a0 = 0;
+    u32_t expected = 0;
+    // 0 if it could not be measured for this run alone.
+    u64_t peakRssKiB = 0;
+};
+
+// VmHWM, the process's peak resident set since it started or was last reset.
+u64_t PeakRssKiB()
+{
+    u64_t kib = 0;
+    if (std::FILE *f = std::fopen("/proc/self/status", "r")) {
+        char line[256] = {};
+        while (std::fgets(line, sizeof(line), f)) {
+            if (!std::strncmp(line, "VmHWM:", 6)) {
+                kib = std::strtoull(line + 6, nullptr, 10);
+            }
+        }
+        std::fclose(f);
+    }
+    if (!kib) {
+        rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        kib = usage.ru_maxrss;
+    }
+    return kib;
+}
+
+// Lowers the peak to the current resident set; false where clear_refs is
+// unavailable.
+bool ResetPeakRss()
+{
+    std::FILE *f = std::fopen("/proc/self/clear_refs", "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = std::fputs("5", f) >= 0;
+    return std::fclose(f) == 0 && ok;
+}
+
+std::vector<u32_t> KernelImage(Kernel const &kernel, u32_t iterations)
+{
+    auto memory = std::vector<u32_t>(MEMORY_SIZE / sizeof(u32_t), 0);
+    auto code = kernel.code();
+    std::copy(code.begin(), code.end(), memory.begin() + CODE_BASE / sizeof(u32_t));
+    memory[ITERATIONS / sizeof(u32_t)] = iterations;
+    if (kernel.data) {
+        kernel.data(memory.data());
+    }
+    return memory;
+}
+
+Run RunKernel(Kernel const &kernel, Mode const &mode, u32_t iterations, char const *tracePath = nullptr,
+    Sim::TraceLevel traceLevel = Sim::TraceLevel::FULL)
+{
+    bool const rssReset = ResetPeakRss();
+    auto env = Sim::CPUEnv(KernelImage(kernel, iterations));
+    env.mode = mode.mode;
+    env.cpu.blockCache.threaded = mode.threaded;
+
+    Sim::TraceWriter trace = {};
+    if (tracePath) {
+        if (trace.Open(tracePath, traceLevel) != Sim::TraceStatus::OK) {
+            std::fprintf(stderr, "cannot write %s\n", tracePath);
+            std::exit(2);
+        }
+        trace.Attach(env.cpu);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    env.Execute(CODE_BASE);
+    if (tracePath && trace.Close() != Sim::TraceStatus::OK) {
+        std::fprintf(stderr, "cannot write %s\n", tracePath);
+        std::exit(2);
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Run run = {};
+    run.cycles = env.cpu.cycles;
+    run.seconds = seconds;
+    run.a0 = env.cpu.decodeStage.regfile.gpr[A0];
+    run.expected = kernel.expected(env.cpu.mmu.memory.data(), iterations);
+    run.peakRssKiB = rssReset ? PeakRssKiB() : 0;
+    return run;
+}
+
+struct LanesRun final {
+    double seconds = 0;
+    double separateSeconds = 0;
+    bool ok = true;
+};
+
+// The kernel on `lanes` copies of its image, in the lane engine and in as many
+// functional CPUs one after the other.
+LanesRun RunLanes(Kernel const &kernel, u32_t iterations, u32_t lanes)
+{
+    auto const image = KernelImage(kernel, iterations);
+    LanesRun run = {};
+
+    std::vector<Sim::CPUEnv> envs = {};
+    for (u32_t l = 0; l < lanes; ++l) {
+        envs.emplace_back(image.data(), MEMORY_SIZE);
+        envs.back().mode = Sim::ExecMode::FUNCTIONAL;
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (auto &env : envs) {
+        env.Execute(CODE_BASE);
+    }
+    run.separateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Sim::LaneEngine engine(image.data(), MEMORY_SIZE, lanes);
+    start = std::chrono::steady_clock::now();
+    engine.Run(CODE_BASE);
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (u32_t l = 0; l < lanes; ++l) {
+        Sim::CPU const &cpu = engine.Lane(l).cpu;
+        Sim::CPU const &ref = envs[l].cpu;
+        run.ok &= cpu.decodeStage.regfile.gpr[A0] == kernel.expected(cpu.mmu.memory.data(), iterations) &&
+            cpu.decodeStage.regfile.gpr[A0] == ref.decodeStage.regfile.gpr[A0] && cpu.cycles == ref.cycles &&
+            cpu.mmu.memory == ref.mmu.memory;
+    }
+    return run;
+}
+
+struct DecodeRun final {
+    u64_t words = 0;
+    double seconds = 0;
+};
+
+DecodeRun RunDecode(u64_t words)
+{
+    // An odd multiplier steps through every 32-bit word before repeating, so
+    // the samples spread evenly over the encoding space.
+    u32_t constexpr STRIDE = 0x9e3779b1;
+    u32_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (u64_t i = 0; i < words; ++i) {
+        auto const &desc = Sim::UnpackISAEntryDescription({ .raw = (u32_t)i * STRIDE });
+        sink += (u32_t)desc.isaEntry + desc.execParams.regWrite;
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    asm volatile("" :: "r"(sink));
+    return { words, seconds };
+}
+
+// Page-sized batches of the same words RunDecode samples, with the per-word
+// copies DecodeCache makes from the SoA outputs left out.
+DecodeRun RunBatchDecode(u64_t words, Sim::BatchDecoder::Path path)
+{
+    u32_t constexpr STRIDE = 0x9e3779b1;
+    u32_t constexpr PAGE_WORDS = 1024;
+    Sim::BatchDecoder batch = {};
+    batch.path = path;
+    std::vector<Sim::Instruction> page(PAGE_WORDS);
+    u32_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    u64_t i = 0;
+    for (; i < words; i += PAGE_WORDS) {
+        for (u32_t j = 0; j < PAGE_WORDS; ++j) {
+            page[j].raw = (u32_t)(i + j) * STRIDE;
+        }
+        batch.Decode(page);
+        sink += (u32_t)batch.isaEntry[i % PAGE_WORDS] + batch.immExt[PAGE_WORDS - 1];
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    asm volatile("" :: "r"(sink));
+    return { i, seconds };
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    double scale = 1;
+    char const *kernelFilter = nullptr;
+    char const *modeFilter = nullptr;
+    char const *tracePath = nullptr;
+    auto traceLevel = Sim::TraceLevel::FULL;
+    for (int i = 1; i < argc; i += 2) {
+        // Every option takes a value; one missing is a usage error.
+        char const *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value && !std::strcmp(argv[i], "--scale")) {
+            scale = std::atof(value);
+        } else if (value && !std::strcmp(argv[i], "--kernel")) {
+            kernelFilter = value;
+        } else if (value && !std::strcmp(argv[i], "--mode")) {
+            modeFilter = value;
+        } else if (value && !std::strcmp(argv[i], "--trace")) {
+            tracePath = value;
+        } else if (value && !std::strcmp(argv[i], "--trace-level") && !std::strcmp(value, "full")) {
+            traceLevel = Sim::TraceLevel::FULL;
+        } else if (value && !std::strcmp(argv[i], "--trace-level") && !std::strcmp(value, "flow")) {
+            traceLevel = Sim::TraceLevel::FLOW;
+        } else {
+            std::fprintf(stderr, "usage: %s [--scale F] [--kernel NAME] [--mode NAME] [--trace FILE] [--trace-level full|flow]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    bool ok = true;
+    bool first = true;
+    u64_t peakRssKiB = 0;
+    std::printf("{\n  \"results\": [");
+
+    for (auto const &kernel : kernels) {
+        if (kernelFilter && std::strcmp(kernelFilter, kernel.name)) {
+            continue;
+        }
+        u32_t iterations = std::max(1.0, kernel.iterations * scale);
+
+        // The functional engine counts one cycle per instruction; the final
+        // ebreak and the trap stub's shutdown store are not part of the kernel.
+        u64_t instructions = RunKernel(kernel, modes[1], iterations).cycles - 2;
+
+        for (auto const &mode : modes) {
+            if (modeFilter && std::strcmp(modeFilter, mode.name)) {
+                continue;
+            }
+
+            Run run = RunKernel(kernel, mode, iterations, tracePath, traceLevel);
+            ok &= run.a0 == run.expected;
+            peakRssKiB = std::max(peakRssKiB, run.peakRssKiB);
+            char rss[24] = "null";
+            if (run.peakRssKiB) {
+                std::snprintf(rss, sizeof(rss), "%llu", (unsigned long long)run.peakRssKiB);
+            }
+
+            std::printf("%s\n    { \"kernel\": \"%s\", \"mode\": \"%s\", \"iterations\": %u, "
+                "\"instructions\": %llu, \"cycles\": %llu, \"seconds\": %.6f, \"mips\": %.2f, "
+                "\"cycles_per_second\": %.0f, \"ns_per_instruction\": %.3f, \"peak_rss_kib\": %s, "
+                "\"ok\": %s }",
+                first ? "" : ",", kernel.name, mode.name, iterations, (unsigned long long)instructions,
+                (unsigned long long)run.cycles, run.seconds, instructions / run.seconds / 1e6,
+                run.cycles / run.seconds, run.seconds * 1e9 / instructions, rss,
+                run.a0 == run.expected ? "true" : "false");
+            std::fflush(stdout);
+            first = false;
+        }
+    }
+
+    std::printf("\n  ],\n  \"lanes\": [");
+    first = true;
+    char const *const lanePaths[] = { "scalar", "avx2", "avx512" };
+    for (auto const &kernel : kernels) {
+        if (kernelFilter && std::strcmp(kernelFilter, kernel.name)) {
+            continue;
+        }
+        u32_t iterations = std::max(1.0, kernel.iterations * scale / 16);
+        for (u32_t lanes : { 8, 64 }) {
+            LanesRun run = RunLanes(kernel, iterations, lanes);
+            ok &= run.ok;
+            std::printf("%s\n    { \"kernel\": \"%s\", \"lanes\": %u, \"path\": \"%s\", \"iterations\": %u, "
+                "\"seconds\": %.6f, \"separate_seconds\": %.6f, \"speedup\": %.2f, \"ok\": %s }",
+                first ? "" : ",", kernel.name, lanes, lanePaths[(u32_t)Sim::LaneEngine::Best()], iterations,
+                run.seconds, run.separateSeconds, run.separateSeconds / run.seconds, run.ok ? "true" : "false");
+            std::fflush(stdout);
+            first = false;
+        }
+    }
+
+    DecodeRun decode = RunDecode(std::max(1.0, (1 << 26) * scale));
+    std::printf("\n  ],\n  \"decode\": { \"words\": %llu, \"seconds\": %.6f, \"mwords_per_second\": %.2f, "
+        "\"ns_per_word\": %.3f },\n", (unsigned long long)decode.words, decode.seconds,
+        decode.words / decode.seconds / 1e6, decode.seconds * 1e9 / decode.words);
+    std::printf("  \"batch_decode\": [");
+    char const *const pathNames[] = { "scalar", "sse4", "avx2" };
+    for (u32_t path = 0; path <= (u32_t)Sim::BatchDecoder::Best(); ++path) {
+        DecodeRun run = RunBatchDecode(std::max(1.0, (1 << 26) * scale), (Sim::BatchDecoder::Path)path);
+        std::printf("%s\n    { \"path\": \"%s\", \"words\": %llu, \"seconds\": %.6f, \"ns_per_word\": %.3f }",
+            path ? "," : "", pathNames[path], (unsigned long long)run.words, run.seconds, run.seconds * 1e9 / run.words);
+    }
+    std::printf("\n  ],\n");
+    // Past resets only lower VmHWM, so the peak of the runs covers them.
+    peakRssKiB = std::max(peakRssKiB, PeakRssKiB());
+    std::printf("  \"peak_rss_kib\": %llu,\n", (unsigned long long)peakRssKiB);
+    std::printf("  \"ok\": %s\n}\n", ok ? "true" : "false");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,333 @@
+#include "block_cache.h"
+#include "cpu.h"
+#include "interpreter.h"
+
+#include <algorithm>
+
+namespace Sim {
+
+void BlockCache::Execute(CPU &cpu, bool jit)
+{
+    while (Execute(cpu, jit, ~(u64_t)0) != StopReason::SHUTDOWN) {
+    }
+}
+
+StopReason BlockCache::Execute(CPU &cpu, bool jit, u64_t maxCycles)
+{
+    u64_t const traps = cpu.huModule.trapCount;
+    u64_t const end = maxCycles > ~cpu.cycles ? ~(u64_t)0 : cpu.cycles + maxCycles;
+    BasicBlock *block = nullptr;
+
+    while (!cpu.shutdown && cpu.huModule.trapCount == traps && cpu.cycles < end) {
+        retired.clear();
+
+        u32_t pc = cpu.fetchStage.state.read.pc;
+        block = block ? Follow(cpu, *block, pc) : Lookup(cpu, pc);
+        if (!block || std::size(block->ops) > end - cpu.cycles) {
+            Interpreter{}.Step(cpu);
+            block = nullptr;
+            continue;
+        }
+
+        u64_t gen = generation;
+        Run(cpu, *block, jit);
+        if (gen != generation) {
+            block = nullptr;
+        }
+    }
+    retired.clear();
+    return cpu.StopReasonSince(traps);
+}
+
+void BlockCache::Run(CPU &cpu, BasicBlock &block, bool jit)
+{
+    if (jit && !block.native && ++block.execCount == cpu.jit.hotThreshold) {
+        cpu.jit.Compile(cpu, block);
+    }
+
+    // Native code does not report individual instructions to the tracer or
+    // the lockstep checker.
+    if (block.native && !cpu.tracer && !cpu.checker) {
+        u64_t const entry = cpu.cycles;
+        u64_t gen = generation;
+        u64_t next = block.native(cpu.decodeStage.regfile.gpr, &cpu);
+        bool const trapped = next & Jit::TRAPPED;
+        if (!trapped) {
+            cpu.fetchStage.state.read.pc = (u32_t)next;
+        }
+        // Native code exits early to interpret an instruction, which counts
+        // itself, after an access that trapped, or after a store that shut
+        // down or invalidated code; otherwise it ran to the end of the block.
+        bool early = (next >> 32) || cpu.shutdown || gen != generation;
+        u32_t retired = early ? ((u32_t)next - block.pc) / sizeof(u32_t) : std::size(block.ops);
+        u32_t count = retired + trapped;
+        // Native code only brings cycles up to date before memory accesses.
+        cpu.cycles = entry + count;
+        cpu.perf.Cycle(count);
+        if (cpu.flowTracer) {
+            cpu.flowTracer->Flow(block.pc, retired);
+        }
+        if (PERF_COUNTERS || cpu.profiler) {
+            for (u32_t i = 0; i < retired; ++i) {
+                cpu.perf.Retire(block.ops[i].isaEntry);
+                if (cpu.profiler) {
+                    cpu.profiler->Retire(block.pc + i * sizeof(u32_t), block.ops[i].raw, entry + i + 1);
+                }
+            }
+        }
+        if (next & Jit::INTERPRET) {
+            Interpreter{}.Step(cpu);
+        }
+        return;
+    }
+
+    u64_t const entry = cpu.cycles;
+    u64_t const traps = cpu.huModule.trapCount;
+    if (threaded) {
+        RunThreaded(cpu, block);
+    } else {
+        u64_t gen = generation;
+        u32_t pc = block.pc;
+
+        for (auto const &op : block.ops) {
+            ++cpu.cycles;
+            cpu.perf.Cycle();
+            if (!Interpreter{}.ExecuteInstruction(cpu, op, pc) || cpu.shutdown || gen != generation) {
+                break;
+            }
+            pc += sizeof(u32_t);
+        }
+    }
+    if (cpu.flowTracer) {
+        // Every instruction started counted a cycle; one that trapped did not
+        // retire.
+        cpu.flowTracer->Flow(block.pc, cpu.cycles - entry - (cpu.huModule.trapCount != traps));
+    }
+}
+
+template<ISAEntry entry>
+[[gnu::always_inline]] static inline bool ThreadedStep(CPU &cpu, DecodedInstruction const &op, u32_t pc, u64_t gen,
+    TraceWriter::Slot **slot = nullptr)
+{
+    static constexpr CUExecParams params = isaDescription[(u32_t)entry].execParams;
+
+    ++cpu.cycles;
+    cpu.perf.Cycle();
+    if (!Interpreter::ExecuteInstruction(cpu, op, pc, params, slot)) {
+        return false;
+    }
+    if constexpr (params.isBranch || params.isJump) {
+        return false;
+    }
+    if constexpr (params.memWrite) {
+        return !cpu.shutdown && gen == cpu.blockCache.Generation();
+    }
+    return true;
+}
+
+#if defined(__GNUC__)
+
+void BlockCache::RunThreaded(CPU &cpu, BasicBlock &block)
+{
+#define SIM_THREADED_LABEL(name) &&op_##name,
+    static void *const labels[] = { SIM_ISA_ENTRIES(SIM_THREADED_LABEL) &&op_UNKNOWN };
+#undef SIM_THREADED_LABEL
+
+    if (block.targets.empty()) {
+        for (auto const &op : block.ops) {
+            block.targets.push_back({ .label = labels[(u32_t)op.isaEntry] });
+        }
+        block.targets.push_back({ .label = &&op_EXIT });
+    }
+
+    u64_t const gen = generation;
+    DecodedInstruction const *op = block.ops.data();
+    ThreadedTarget const *target = block.targets.data();
+    u32_t pc = block.pc;
+    // Traced blocks write their records straight into the chunk; the cursor
+    // stays in a register.
+    TraceWriter::Slot *slot = cpu.tracer ? cpu.tracer->Reserve(std::size(block.ops)) : nullptr;
+
+    goto *target->label;
+
+#define SIM_THREADED_HANDLER(name) \
+op_##name: \
+    if (!ThreadedStep<ISAEntry::name>(cpu, *op, pc, gen, &slot)) { \
+        goto op_EXIT; \
+    } \
+    ++op; \
+    ++target; \
+    pc += sizeof(u32_t); \
+    goto *target->label;
+
+    SIM_ISA_ENTRIES(SIM_THREADED_HANDLER)
+    SIM_THREADED_HANDLER(UNKNOWN)
+#undef SIM_THREADED_HANDLER
+
+op_EXIT:
+    if (slot) {
+        cpu.tracer->Commit(slot);
+    }
+}
+
+#else
+
+template<ISAEntry entry>
+static void ThreadedHandler(CPU &cpu, BasicBlock const &block, DecodedInstruction const *op,
+    ThreadedTarget const *next, u32_t pc)
+{
+    if (!ThreadedStep<entry>(cpu, *op, pc, cpu.blockCache.Generation())) {
+        return;
+    }
+    return next->fn(cpu, block, op + 1, next + 1, pc + sizeof(u32_t));
+}
+
+static void ThreadedExit(CPU &cpu, BasicBlock const &block, DecodedInstruction const *op,
+    ThreadedTarget const *next, u32_t pc)
+{}
+
+void BlockCache::RunThreaded(CPU &cpu, BasicBlock &block)
+{
+#define SIM_THREADED_HANDLER(name) &ThreadedHandler<ISAEntry::name>,
+    static decltype(ThreadedTarget::fn) const handlers[] = {
+        SIM_ISA_ENTRIES(SIM_THREADED_HANDLER) &ThreadedHandler<ISAEntry::UNKNOWN>
+    };
+#undef SIM_THREADED_HANDLER
+
+    if (block.targets.empty()) {
+        for (auto const &op : block.ops) {
+            block.targets.push_back({ .fn = handlers[(u32_t)op.isaEntry] });
+        }
+        block.targets.push_back({ .fn = &ThreadedExit });
+    }
+
+    block.targets[0].fn(cpu, block, block.ops.data(), block.targets.data() + 1, block.pc);
+}
+
+#endif
+
+BasicBlock *BlockCache::Lookup(CPU &cpu, u32_t pc)
+{
+    if (auto it = blocks.find(pc); it != blocks.end()) {
+        return it->second.get();
+    }
+    return Translate(cpu, pc);
+}
+
+BasicBlock *BlockCache::Follow(CPU &cpu, BasicBlock &from, u32_t pc)
+{
+    for (auto &link : from.links) {
+        if (link.block && link.pc == pc) {
+            ++chainHits;
+            return link.block;
+        }
+    }
+
+    BasicBlock *next = Lookup(cpu, pc);
+    if (next) {
+        auto &link = from.links[0].block ? from.links[1] : from.links[0];
+        link.pc = pc;
+        link.block = next;
+    }
+    return next;
+}
+
+BasicBlock *BlockCache::Translate(CPU &cpu, u32_t pc)
+{
+    auto block = std::make_unique<BasicBlock>();
+    block->pc = pc;
+
+    u32_t a = pc;
+    while (std::size(block->ops) < MAX_BLOCK_SIZE) {
+        DecodedInstruction const *decoded = nullptr;
+        if (cpu.decodeCache.Fetch(cpu, a, &decoded) != HUExceptionType::NONE) {
+            break;
+        }
+
+        block->ops.push_back(*decoded);
+        a += sizeof(u32_t);
+
+        CUExecParams const &params = decoded->execParams;
+        if (params.isBranch || params.isJump || params.intpt || !params.isOpcodeOk) {
+            break;
+        }
+    }
+    if (block->ops.empty()) {
+        return nullptr;
+    }
+    block->endPc = a;
+
+    ++translations;
+    codeBegin = std::min(codeBegin, block->pc);
+    codeEnd = std::max(codeEnd, block->endPc);
+    for (u32_t page = block->pc >> PAGE_SHIFT; page <= ((block->endPc - 1) >> PAGE_SHIFT); ++page) {
+        pageBlocks[page].push_back(block.get());
+    }
+
+    return (blocks[pc] = std::move(block)).get();
+}
+
+void BlockCache::Invalidate(u32_t a)
+{
+    if (a < codeBegin || a >= codeEnd) {
+        return;
+    }
+
+    auto it = pageBlocks.find(a >> PAGE_SHIFT);
+    if (it == pageBlocks.end()) {
+        return;
+    }
+
+    std::vector<BasicBlock *> stale = {};
+    for (BasicBlock *block : it->second) {
+        if (a >= block->pc && a < block->endPc) {
+            stale.push_back(block);
+        }
+    }
+    for (BasicBlock *block : stale) {
+        Remove(block);
+    }
+}
+
+void BlockCache::Remove(BasicBlock *block)
+{
+    for (u32_t page = block->pc >> PAGE_SHIFT; page <= ((block->endPc - 1) >> PAGE_SHIFT); ++page) {
+        auto &list = pageBlocks[page];
+        list.erase(std::remove(list.begin(), list.end(), block), list.end());
+    }
+
+    for (auto &[pc, other] : blocks) {
+        for (auto &link : other->links) {
+            if (link.block == block) {
+                link = {};
+            }
+        }
+    }
+
+    auto it = blocks.find(block->pc);
+    retired.push_back(std::move(it->second));
+    blocks.erase(it);
+    ++generation;
+}
+
+void BlockCache::DropNativeCode()
+{
+    for (auto &[pc, block] : blocks) {
+        block->native = nullptr;
+        block->execCount = 0;
+    }
+}
+
+void BlockCache::Flush()
+{
+    for (auto &[pc, block] : blocks) {
+        retired.push_back(std::move(block));
+    }
+    blocks.clear();
+    pageBlocks.clear();
+    codeBegin = ~(u32_t)0;
+    codeEnd = 0;
+    ++generation;
+}
+
+} // namespace Sim
@@ -0,0 +1,89 @@
+#ifndef SIM_BLOCK_CACHE_H
+#define SIM_BLOCK_CACHE_H
+
+#include <types.h>
+#include <decode_cache.h>
+#include <jit.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace Sim {
+
+enum class StopReason : u8_t;
+
+struct BasicBlock;
+
+// Dispatch target of a micro-op: a label address where the compiler supports
+// computed goto, otherwise a handler that tail-calls its successor.
+union ThreadedTarget {
+    void *label;
+    void (*fn)(CPU &cpu, BasicBlock const &block, DecodedInstruction const *op, ThreadedTarget const *next,
+        u32_t pc);
+};
+
+struct BasicBlock final {
+    struct Link final {
+        u32_t pc = 0;
+        BasicBlock *block = nullptr;
+    };
+
+    u32_t pc = 0;
+    u32_t endPc = 0;
+    std::vector<DecodedInstruction> ops = {};
+    std::vector<ThreadedTarget> targets = {};
+    Link links[2] = {};
+
+    u32_t execCount = 0;
+    JitCode native = nullptr;
+};
+
+// Straight-line runs of decoded instructions ending at a control transfer or
+// a system instruction, cached by start PC. Each block remembers up to two
+// successors so that hot paths are dispatched without a map lookup.
+// MMU::Store drops every block covering the stored word. With the JIT tier
+// enabled, blocks executed Jit::hotThreshold times are compiled to host code.
+struct BlockCache final {
+public:
+    static constexpr u32_t MAX_BLOCK_SIZE = 64;
+    static constexpr u32_t PAGE_SHIFT = 12;
+
+    u64_t translations = 0;
+    u64_t chainHits = 0;
+    bool threaded = true;
+
+    void Execute(CPU &cpu, bool jit = false);
+    // Budgeted run that returns on shutdown or after a trap. A block is only
+    // entered if it fits in the remaining budget, and counts the instructions
+    // it ran, as the interpreter would; the rest is single-stepped.
+    StopReason Execute(CPU &cpu, bool jit, u64_t maxCycles);
+    void Invalidate(u32_t a);
+    void Flush();
+    void DropNativeCode();
+
+    u64_t Generation() const
+    {
+        return generation;
+    }
+
+private:
+    std::unordered_map<u32_t, std::unique_ptr<BasicBlock>> blocks = {};
+    std::unordered_map<u32_t, std::vector<BasicBlock *>> pageBlocks = {};
+    std::vector<std::unique_ptr<BasicBlock>> retired = {};
+    u32_t codeBegin = ~(u32_t)0;
+    u32_t codeEnd = 0;
+    u64_t generation = 0;
+
+    BasicBlock *Lookup(CPU &cpu, u32_t pc);
+    BasicBlock *Follow(CPU &cpu, BasicBlock &from, u32_t pc);
+    BasicBlock *Translate(CPU &cpu, u32_t pc);
+    // Runs the block, counting a cycle as each instruction starts, as the
+    // interpreter does, so that devices read the cycle they are accessed in.
+    void Run(CPU &cpu, BasicBlock &block, bool jit);
+    void RunThreaded(CPU &cpu, BasicBlock &block);
+    void Remove(BasicBlock *block);
+};
+
+} // namespace Sim
+
+#endif // SIM_BLOCK_CACHE_H
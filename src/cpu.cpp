@@ -1,16 +1,17 @@
 #include "cpu.h"
+#include "profiler.h"
+#include "trace.h"
+#include "lockstep.h"
 #include <cassert>
+#include <utility>
 
 namespace Sim {
 
 void CPU::Tick()
 {
-    writebackStage.Tick(*this);
-    memoryStage.Tick(*this);
-    executeStage.Tick(*this);
-    decodeStage.Tick(*this);
-    fetchStage.Tick(*this);
-    huModule.Tick(*this);
+    CPUPipeline::Tick(*this);
+    ++cycles;
+    perf.Cycle();
 }
 
 void CPU::Execute()
@@ -20,6 +21,46 @@ void CPU::Execute()
     }
 }
 
+StopReason CPU::Execute(u64_t maxCycles)
+{
+    u64_t traps = huModule.trapCount;
+    for (u64_t i = 0; i < maxCycles && !shutdown && huModule.trapCount == traps; ++i) {
+        Tick();
+    }
+    return StopReasonSince(traps);
+}
+
+StopReason CPU::Step(u64_t n)
+{
+    return Execute(n);
+}
+
+void CPU::Reset()
+{
+    huModule = {};
+    fetchStage = {};
+    decodeStage = {};
+    executeStage = {};
+    memoryStage = {};
+    writebackStage = {};
+    mmu.tlb.Flush();
+    decodeCache.Flush();
+    blockCache.Flush();
+    shutdown = true;
+    cycles = 0;
+}
+
+void CPU::ReturnFromTrap(u32_t pc)
+{
+    auto &wbState = writebackStage.state.read;
+    if (wbState.regWrite) {
+        decodeStage.regfile.gpr[wbState.regAddr] = wbState.regWdata;
+        decodeStage.regfile.gpr[0] = 0;
+        wbState.regWrite = false;
+    }
+    fetchStage.state.read.pc = pc;
+}
+
 void HUModule::Raise(HUExcecutionStage stage, HUExceptionType type, u32_t pc)
 {
     if ((u8_t)stage < (u8_t)exceptionExecStage) {
@@ -31,6 +72,16 @@ void HUModule::Raise(HUExcecutionStage stage, HUExceptionType type, u32_t pc)
     exceptionType = type;
 }
 
+void HUModule::TakeTrap(CPU &cpu, HUExceptionType type, u32_t pc)
+{
+    exceptionExecStage = HUExcecutionStage::NONE;
+    exceptionPC = pc;
+    exceptionType = type;
+    ++trapCount;
+    cpu.perf.Exception(type);
+    cpu.fetchStage.state.read.pc = cpu.tvec;
+}
+
 void HUModule::Tick(CPU &cpu)
 {
     auto &feState = cpu.fetchStage.state;
@@ -44,6 +95,12 @@ void HUModule::Tick(CPU &cpu)
         (exState.read.rda == deState.read.inst.rType.rs2));
 
     bool pcFlush = cpu.executeStage.pcR;
+    if (loadHazard) {
+        cpu.perf.LoadUseStall();
+    }
+    if (pcFlush) {
+        cpu.perf.Flush();
+    }
 
     if ((pcFlush || loadHazard) && (u8_t)exceptionType <= (u8_t)HUExcecutionStage::DECODE) {
         exceptionExecStage = HUExcecutionStage::NONE;
@@ -58,6 +115,9 @@ void HUModule::Tick(CPU &cpu)
         memState.write.execParams.regWrite = false;
         memState.write.execParams.memWrite = false;
         memState.write.execParams.resSrc = CUResSrc::ALU;
+        memState.write.execParams.isECall = false;
+        memState.write.execParams.isFence = false;
+        memState.write.v = true;
     }
     memState.Tick();
 
@@ -68,6 +128,9 @@ void HUModule::Tick(CPU &cpu)
         exState.write.execParams.isBranch = false;
         exState.write.execParams.isJump = false;
         exState.write.execParams.intpt = false;
+        exState.write.execParams.isECall = false;
+        exState.write.execParams.isFence = false;
+        exState.write.v = true;
     }
     exState.Tick();
 
@@ -79,6 +142,8 @@ void HUModule::Tick(CPU &cpu)
     }
 
     if ((u8_t)exceptionExecStage > (u8_t)HUExcecutionStage::NONE) {
+        ++trapCount;
+        cpu.perf.Exception(exceptionType);
         feState.write.pc = cpu.tvec;
         feState.Tick();
     } else if (!loadHazard) {
@@ -90,46 +155,226 @@ void HUModule::Tick(CPU &cpu)
 
 HURS HUModule::GetRS(CPU& cpu, u8_t rsa)
 {
-    if (cpu.memoryStage.state.read.execParams.regWrite && (rsa == cpu.memoryStage.state.read.regAddr)) {
-        return HURS::BP_MEM;
+    HURS rs = HURS::REG;
+
+    // x0 is never forwarded: it reads as zero whatever an older instruction
+    // wrote to it.
+    if (rsa && cpu.memoryStage.state.read.execParams.regWrite && (rsa == cpu.memoryStage.state.read.regAddr)) {
+        rs = HURS::BP_MEM;
+    } else if (rsa && cpu.writebackStage.state.read.regWrite && (rsa == cpu.writebackStage.state.read.regAddr)) {
+        rs = HURS::BP_WB;
     }
 
-    if (cpu.writebackStage.state.read.regWrite && (rsa == cpu.writebackStage.state.read.regAddr)) {
-        return HURS::BP_WB;
-    }
-
-    return HURS::REG;
+    cpu.perf.Forward(rs);
+    return rs;
 }
 
-HUExceptionType MMU::Load(CPU &cpu, u32_t a, u32_t *dst, CUMemOp memOp)
+HUExceptionType MMU::LoadSlow(CPU &cpu, u32_t a, u32_t *dst)
 {
     if (a % 4) {
         return HUExceptionType::UNALIGNED_ADDR;
     }
-    if (a >= std::size(memory) * sizeof(u32_t)) {
+    if (auto const *device = devices.Find(a); device && device->read) {
+        *dst = device->read(cpu, a - device->base);
+        return HUExceptionType::NONE;
+    }
+    if (a >= Size()) {
         return HUExceptionType::MMU_MISS;
     }
 
-    *dst = memory[a / 4];
+    u32_t *host = MapPage(a, TLB::READ);
+    *dst = host ? LoadWord(host) : Peek(a);
     return HUExceptionType::NONE;
 }
 
-HUExceptionType MMU::Store(CPU &cpu, u32_t a, u32_t data, CUMemOp memOp)
+HUExceptionType MMU::StoreSlow(CPU &cpu, u32_t a, u32_t data, CUMemOp memOp)
 {
-    if (a % 4) {
+    if (!IsAligned(a, memOp)) {
         return HUExceptionType::UNALIGNED_ADDR;
     }
-    if (a >= std::size(memory) * sizeof(u32_t)) {
-        return HUExceptionType::MMU_MISS;
+    u32_t const word = a & ~(u32_t)3;
+    if (auto const *device = devices.Find(word); device && device->write) {
+        device->write(cpu, word - device->base, data << (a % 4 * 8));
+        return HUExceptionType::NONE;
     }
-    if (a == 0) {
-        cpu.shutdown = true;
+    if (word >= Size()) {
+        return HUExceptionType::MMU_MISS;
     }
 
-    memory[a / 4] = data;
+    MarkDirty(word);
+    u32_t *host = MapPage(word, TLB::WRITE);
+    if (!host && backend == MMUBackend::FLAT) {
+        host = FlatData() + word / sizeof(u32_t);
+    }
+    if (host) {
+        StoreWord(host, a, data, memOp);
+    } else {
+        u32_t merged = Peek(word);
+        StoreWord(&merged, a, data, memOp);
+        Poke(word, merged);
+    }
+    cpu.decodeCache.Invalidate(word);
+    cpu.blockCache.Invalidate(word);
     return HUExceptionType::NONE;
 }
 
+// Only whole pages are mapped; the tail of a flat memory whose size is not a
+// multiple of the page size is always accessed through the slow path. Paged
+// memory is mapped read-only until written, since the page may be shared, and
+// so is flat memory that is not yet dirty while dirty pages are tracked.
+// Pages with device registers are not mapped for reads if a device handles
+// loads, and carry the I/O window that stores must not bypass.
+u32_t *MMU::MapPage(u32_t a, u8_t perm)
+{
+    static_assert(TLB::PAGE_SIZE == PagedMemory::PAGE_SIZE);
+
+    u32_t base = a & ~(TLB::PAGE_SIZE - 1);
+    u32_t *host = nullptr;
+    auto const window = devices.PageWindow(base, TLB::PAGE_SIZE);
+    if (window.reads) {
+        return nullptr;
+    }
+
+    if (backend == MMUBackend::FLAT) {
+        if (base + (u64_t)TLB::PAGE_SIZE > Size()) {
+            return nullptr;
+        }
+        host = FlatData() + base / sizeof(u32_t);
+        perm = (trackDirty && !IsDirty(a)) ? TLB::READ : TLB::READ | TLB::WRITE;
+    } else if (perm & TLB::WRITE) {
+        host = paged.WritablePage(a).words;
+        perm = TLB::READ | TLB::WRITE;
+    } else {
+        host = paged.PageAt(a)->words;
+        perm = TLB::READ;
+    }
+
+    tlb.Fill(a, host, perm, window.base, window.size);
+    return host + (a % TLB::PAGE_SIZE) / sizeof(u32_t);
+}
+
+u32_t MMU::Peek(u32_t a) const
+{
+    if (backend == MMUBackend::FLAT) {
+        return borrowed ? borrowed[a / 4] : memory[a / 4];
+    }
+    return paged.Read(a);
+}
+
+void MMU::Poke(u32_t a, u32_t data)
+{
+    MarkDirty(a);
+    if (backend == MMUBackend::FLAT) {
+        FlatData()[a / 4] = data;
+    } else {
+        paged.Write(a, data);
+        tlb.Invalidate(a);
+    }
+}
+
+void MMU::TrackDirty(u64_t base)
+{
+    for (u32_t page : dirtyPages) {
+        dirtyMap[page / 64] = 0;
+    }
+    dirtyPages.clear();
+    dirtyMap.resize((Size() / TLB::PAGE_SIZE + 63) / 64);
+    dirtyBase = base;
+    trackDirty = true;
+    tlb.Flush();
+}
+
+bool MMU::IsDirty(u32_t a) const
+{
+    u32_t page = a / TLB::PAGE_SIZE;
+    return (dirtyMap[page / 64] >> (page % 64)) & 1;
+}
+
+void MMU::MarkDirty(u32_t a)
+{
+    if (!trackDirty || IsDirty(a)) {
+        return;
+    }
+    u32_t page = a / TLB::PAGE_SIZE;
+    dirtyMap[page / 64] |= (u64_t)1 << (page % 64);
+    dirtyPages.push_back(page);
+}
+
+bool MMU::CopyPage(u32_t a, u32_t *words)
+{
+    if (a >= Size()) {
+        return false;
+    }
+    u32_t *host = MapPage(a, TLB::READ);
+    if (!host) {
+        return false;
+    }
+    host -= (a % TLB::PAGE_SIZE) / sizeof(u32_t);
+    for (u32_t i = 0; i < TLB::PAGE_SIZE / sizeof(u32_t); ++i) {
+        words[i] = LoadWord(host + i);
+    }
+    return true;
+}
+
+u32_t *MMU::HostWord(CPU &cpu, u32_t a)
+{
+    if (a % 4 || devices.Find(a) || a >= Size()) {
+        return nullptr;
+    }
+
+    MarkDirty(a);
+    u32_t *host = MapPage(a, TLB::WRITE);
+    if (!host && backend == MMUBackend::FLAT) {
+        host = FlatData() + a / sizeof(u32_t);
+    } else if (!host) {
+        host = paged.WritablePage(a).words + (a % TLB::PAGE_SIZE) / sizeof(u32_t);
+        tlb.Invalidate(a);
+    }
+    cpu.decodeCache.Invalidate(a);
+    cpu.blockCache.Invalidate(a);
+    return host;
+}
+
+u64_t MMU::Size() const
+{
+    if (backend == MMUBackend::FLAT) {
+        return (u64_t)(borrowed ? borrowedWords : std::size(memory)) * sizeof(u32_t);
+    }
+    return pagedSize;
+}
+
+void MMU::Adopt(std::vector<u32_t> &&words)
+{
+    backend = MMUBackend::FLAT;
+    memory = std::move(words);
+    borrowed = nullptr;
+    borrowedWords = 0;
+    trackDirty = false;
+    tlb.Flush();
+}
+
+void MMU::Borrow(u32_t *words, u32_t count)
+{
+    backend = MMUBackend::FLAT;
+    memory = {};
+    borrowed = words;
+    borrowedWords = count;
+    trackDirty = false;
+    tlb.Flush();
+}
+
+void MMU::MapDevice(u32_t base, u32_t size, DeviceRead read, DeviceWrite write)
+{
+    devices.Map(base, size, std::move(read), std::move(write));
+    tlb.Flush();
+}
+
+void MMU::UnmapDevice(u32_t base, u32_t size)
+{
+    devices.Unmap(base, size);
+    tlb.Flush();
+}
+
 void FetchStage::Tick(CPU &cpu)
 {
     if (auto excType = cpu.mmu.Load(cpu, state.read.pc, &cpu.decodeStage.state.write.inst.raw);
@@ -170,9 +415,11 @@ void DecodeStage::Regfile::Tick(CPU &cpu)
 
 void DecodeStage::Tick(CPU &cpu)
 {
-    auto inst = state.read.inst;
+    static DecodedInstruction const bubble = {};
 
-    CUExecParams params = DecodeInstruction(inst);
+    auto const &decoded = state.read.v ? bubble :
+        cpu.decodeCache.Decode(cpu, state.read.pc, state.read.inst);
+    CUExecParams const &params = decoded.execParams;
     CUExecParams &outParams = cpu.executeStage.state.write.execParams;
 
     outParams = params;
@@ -182,17 +429,21 @@ void DecodeStage::Tick(CPU &cpu)
     outParams.isJump = params.isJump && !state.read.v;
     outParams.isBranch = params.isBranch && !state.read.v;
     outParams.intpt = params.intpt && !state.read.v;
+    outParams.isECall = params.isECall && !state.read.v;
 
     if (!params.isOpcodeOk && !state.read.v) {
         cpu.huModule.Raise(HUExcecutionStage::DECODE, HUExceptionType::BAD_OPCODE, state.read.pc);
     }
 
-    cpu.executeStage.state.write.immExt = UnpackImmediate(inst, params.iType);
+    cpu.executeStage.state.write.immExt = decoded.immExt;
+    cpu.executeStage.state.write.inst = state.read.inst.raw;
     cpu.executeStage.state.write.pc = state.read.pc;
     cpu.executeStage.state.write.pcNext = state.read.pcNext;
-    cpu.executeStage.state.write.rs1a = inst.rType.rs1;
-    cpu.executeStage.state.write.rs2a = inst.rType.rs2;
-    cpu.executeStage.state.write.rda = inst.rType.rd;
+    cpu.executeStage.state.write.rs1a = decoded.rs1a;
+    cpu.executeStage.state.write.rs2a = decoded.rs2a;
+    cpu.executeStage.state.write.rda = decoded.rda;
+    cpu.executeStage.state.write.v = state.read.v;
+    cpu.executeStage.state.write.tag = Perf::Tag(decoded.isaEntry);
 
     regfile.Tick(cpu);
 }
@@ -231,7 +482,7 @@ u32_t DecodeStage::UnpackImmediate(Instruction inst, InstructionType iType)
             break;
         }
         case InstructionType::U: {
-            imm.uType.inst19_12 = inst.uType.imm31_12;
+            imm.raw = inst.uType.imm31_12 << 12;
             break;
         }
         case InstructionType::J: {
@@ -255,12 +506,29 @@ CUExecParams DecodeStage::DecodeInstruction(Instruction inst)
     return desc.execParams;
 }
 
+DecodedInstruction DecodeStage::Predecode(Instruction inst)
+{
+    auto const &desc = UnpackISAEntryDescription(inst);
+
+    DecodedInstruction decoded = {};
+    decoded.execParams = desc.execParams;
+    decoded.isaEntry = desc.isaEntry;
+    decoded.immExt = UnpackImmediate(inst, decoded.execParams.iType);
+    decoded.rs1a = inst.rType.rs1;
+    decoded.rs2a = inst.rType.rs2;
+    decoded.rda = inst.rType.rd;
+    decoded.raw = inst.raw;
+    return decoded;
+}
+
 void ExecuteStage::Tick(CPU &cpu)
 {
     cpu.memoryStage.state.write.execParams.regWrite = state.read.execParams.regWrite;
     cpu.memoryStage.state.write.execParams.memWrite = state.read.execParams.memWrite;
     cpu.memoryStage.state.write.execParams.memOp = state.read.execParams.memOp;
     cpu.memoryStage.state.write.execParams.memSignExt = state.read.execParams.memSignExt;
+    cpu.memoryStage.state.write.execParams.isECall = state.read.execParams.isECall;
+    cpu.memoryStage.state.write.execParams.isFence = state.read.execParams.isFence;
 
     cpu.memoryStage.state.write.execParams.resSrc = state.read.execParams.resSrc;
     cpu.memoryStage.state.write.regAddr = state.read.rda;
@@ -298,93 +566,34 @@ void ExecuteStage::Tick(CPU &cpu)
     pcR = state.read.execParams.isJump ||
         (state.read.execParams.isBranch && cmpRes);
 
+    cpu.memoryStage.state.write.inst = state.read.inst;
     cpu.memoryStage.state.write.pcNext = state.read.pcNext;
     cpu.memoryStage.state.write.pc = state.read.pc;
+    cpu.memoryStage.state.write.v = state.read.v;
+    cpu.memoryStage.state.write.tag = state.read.tag;
 
-    if (state.read.execParams.intpt) {
+    // Serviced ECALLs continue to the memory stage instead of trapping.
+    if (state.read.execParams.intpt && !(state.read.execParams.isECall && cpu.hostCalls.Active())) {
         cpu.huModule.Raise(HUExcecutionStage::EXECUTE, HUExceptionType::INT, state.read.pc);
     }
 }
 
-u32_t ExecuteStage::ALUOperator(CUALUOp op, u32_t rs1v, u32_t rs2v)
-{
-    switch (op) {
-        case CUALUOp::ADD:
-            return rs1v + rs2v;
-        case CUALUOp::SUB:
-            return rs1v - rs2v;
-        case CUALUOp::SLL:
-            return rs1v << (rs2v & 31);
-        case CUALUOp::SLT:
-            return !!((i32_t)rs1v < (i32_t)rs2v);
-        case CUALUOp::SLTU:
-            return !!(rs1v < rs2v);
-        case CUALUOp::XOR:
-            return rs1v ^ rs2v;
-        case CUALUOp::SRL:
-            return rs1v >> (rs2v & 31);
-        case CUALUOp::SRA:
-            return (i32_t)rs1v >> (rs2v & 31);
-        case CUALUOp::OR:
-            return rs1v | rs2v;
-        case CUALUOp::AND:
-            return rs1v & rs2v;
-        case CUALUOp::PASS_SRC2:
-            return rs2v;
-        default: assert(!"Unexpected ALU operation");
-    };
-}
-
-bool ExecuteStage::CMPOperator(CUCmpOp op, u32_t rs1v, u32_t rs2v)
-{
-    switch (op) {
-        case CUCmpOp::EQ:
-            return rs1v == rs2v;
-        case CUCmpOp::NE:
-            return rs1v != rs2v;
-        case CUCmpOp::LT:
-            return (i32_t)rs1v < (i32_t)rs2v;
-        case CUCmpOp::GE:
-            return (i32_t)rs1v >= (i32_t)rs2v;
-        case CUCmpOp::LTU:
-            return rs1v < rs2v;
-        case CUCmpOp::GEU:
-            return rs1v >= rs2v;
-        default: assert(!"Unexpected CMP operation");
-    };
-}
-
 void MemoryStage::Tick(CPU &cpu)
 {
     u32_t mmuRD = 0;
 
+    if (state.read.execParams.isECall) {
+        HostCall(cpu);
+    }
+    if (state.read.execParams.isFence && !state.read.v) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
     if (state.read.execParams.resSrc == CUResSrc::MEM) {
-        if (auto ex = cpu.mmu.Load(cpu, state.read.aluRes & (~(u32_t)3), &mmuRD); ex != HUExceptionType::NONE) {
+        if (auto ex = LoadOperator(cpu, state.read.execParams, state.read.aluRes, &mmuRD);
+            ex != HUExceptionType::NONE) {
             cpu.huModule.Raise(HUExcecutionStage::MEMORY, ex, state.read.pc);
         }
-
-        u8_t sh = state.read.aluRes & ((u32_t)3);
-        u8_t align = 4;
-        mmuRD >>= sh;
-
-        switch (state.read.execParams.memOp) {
-            case CUMemOp::BYTE:
-                mmuRD = state.read.execParams.memSignExt ? (i32_t)(i8_t)mmuRD : (u8_t)mmuRD;
-                align = 1;
-                break;
-            case CUMemOp::HALF:
-                mmuRD = state.read.execParams.memSignExt ? (i32_t)(i16_t)mmuRD : (u16_t)mmuRD;
-                align = 2;
-                break;
-            case CUMemOp::WORD:
-                align = 4;
-                break;
-            default: assert(!"Unexpected memory operation");
-        }
-        if (sh % align) {
-            cpu.huModule.Raise(HUExcecutionStage::MEMORY, HUExceptionType::UNALIGNED_ADDR,
-                state.read.pc);
-        }
     }
 
     if (state.read.execParams.memWrite) {
@@ -409,6 +618,103 @@ void MemoryStage::Tick(CPU &cpu)
 
     cpu.writebackStage.state.write.regWrite = state.read.execParams.regWrite;
     cpu.writebackStage.state.write.regAddr = state.read.regAddr;
+
+    if (!state.read.v && cpu.huModule.exceptionExecStage != HUExcecutionStage::MEMORY) {
+        cpu.perf.Retire(state.read.tag);
+        if (cpu.profiler) {
+            cpu.profiler->Retire(state.read.pc, state.read.inst, cpu.cycles);
+        }
+        if (cpu.flowTracer) {
+            cpu.flowTracer->Flow(state.read.pc, 1);
+        }
+        if (cpu.tracer || cpu.checker) {
+            TraceRecord const record = Retired(cpu, mmuRD);
+            if (cpu.tracer) {
+                cpu.tracer->Record(record);
+            }
+            if (cpu.checker) {
+                cpu.checker->Retire(cpu, record);
+            }
+        }
+    }
+}
+
+TraceRecord MemoryStage::Retired(CPU &cpu, u32_t mmuRD) const
+{
+    auto const &params = state.read.execParams;
+    TraceRecord record = {};
+    record.pc = state.read.pc;
+    record.inst = state.read.inst;
+    if (params.regWrite && state.read.regAddr) {
+        record.rd = state.read.regAddr;
+        record.rdValue = cpu.writebackStage.state.write.regWdata;
+    }
+    if (params.resSrc == CUResSrc::MEM) {
+        record.access = TraceAccess::LOAD;
+        record.data = mmuRD;
+    } else if (params.memWrite) {
+        record.access = TraceAccess::STORE;
+        record.data = state.read.memWdata;
+    }
+    record.addr = record.access != TraceAccess::NONE ? state.read.aluRes : 0;
+    return record;
+}
+
+// Everything older than the ECALL has retired except the instruction in
+// writeback, whose result is forwarded. The result is turned into a write of
+// a0 so that younger instructions pick it up through the bypass network.
+void MemoryStage::HostCall(CPU &cpu)
+{
+    u32_t const *gpr = cpu.decodeStage.regfile.gpr;
+    auto const &wb = cpu.writebackStage.state.read;
+    auto reg = [gpr, &wb](u8_t a) {
+        return wb.regWrite && wb.regAddr == a ? wb.regWdata : gpr[a];
+    };
+
+    HostCallArgs call = {};
+    call.number = reg(17);
+    for (u8_t i = 0; i < 6; ++i) {
+        call.args[i] = reg(10 + i);
+    }
+
+    u32_t result = 0;
+    if (!cpu.hostCalls.Dispatch(cpu, call, &result)) {
+        cpu.huModule.Raise(HUExcecutionStage::MEMORY, HUExceptionType::INT, state.read.pc);
+        return;
+    }
+
+    state.read.aluRes = result;
+    state.read.regAddr = 10;
+    state.read.execParams.regWrite = true;
+}
+
+HUExceptionType MemoryStage::LoadOperator(CPU &cpu, CUExecParams const &params, u32_t a, u32_t *dst)
+{
+    // Checked first: a faulting load must not reach a device, whose reads
+    // can have side effects.
+    if (!MMU::IsAligned(a, params.memOp)) {
+        *dst = 0;
+        return HUExceptionType::UNALIGNED_ADDR;
+    }
+
+    u32_t mmuRD = 0;
+    HUExceptionType ex = cpu.mmu.Load(cpu, a & (~(u32_t)3), &mmuRD);
+    mmuRD >>= (a & 3) * 8;
+
+    switch (params.memOp) {
+        case CUMemOp::BYTE:
+            mmuRD = params.memSignExt ? (i32_t)(i8_t)mmuRD : (u8_t)mmuRD;
+            break;
+        case CUMemOp::HALF:
+            mmuRD = params.memSignExt ? (i32_t)(i16_t)mmuRD : (u16_t)mmuRD;
+            break;
+        case CUMemOp::WORD:
+            break;
+        default: assert(!"Unexpected memory operation");
+    }
+
+    *dst = mmuRD;
+    return ex;
 }
 
 void WritebackStage::Tick(CPU &cpu)
@@ -3,10 +3,25 @@
 
 #include <types.h>
 #include <isa.h>
+#include <decode_cache.h>
+#include <block_cache.h>
+#include <jit.h>
+#include <paged_memory.h>
+#include <tlb.h>
+#include <device_bus.h>
+#include <perf_counters.h>
+#include <host_calls.h>
+#include <atomic>
+#include <cassert>
 #include <vector>
 
 namespace Sim {
 
+struct Profiler;
+struct TraceWriter;
+struct LockstepChecker;
+struct TraceRecord;
+
 enum class HURS : u8_t {
     REG, BP_MEM, BP_WB
 };
@@ -16,6 +31,11 @@ enum class HUExceptionType : u8_t {
     BAD_OPCODE, UNALIGNED_ADDR, MMU_MISS, INT,
 };
 
+// Why a cycle-budgeted run returned. Runs can be resumed from any of them.
+enum class StopReason : u8_t {
+    BUDGET, SHUTDOWN, EXCEPTION,
+};
+
 enum class HUExcecutionStage : u8_t {
     NONE,
     FETCH, DECODE, EXECUTE, MEMORY, WRITEBACK,
@@ -26,19 +46,123 @@ public:
     u32_t exceptionPC = 0;
     HUExcecutionStage exceptionExecStage = HUExcecutionStage::NONE;
     HUExceptionType exceptionType = HUExceptionType::NONE;
+    u64_t trapCount = 0;
 
-    void Tick(CPU &cpu) override;
+    void Tick(CPU &cpu);
     void Raise(HUExcecutionStage stage, HUExceptionType type, u32_t pc);
+    void TakeTrap(CPU &cpu, HUExceptionType type, u32_t pc);
 
     HURS GetRS(CPU& cpu, u8_t rsa);
 };
 
+enum class MMUBackend : u8_t {
+    FLAT, PAGED
+};
+
+// Load/Store take an inline TLB fast path and fall back to LoadSlow/StoreSlow,
+// which perform the checks and refill the TLB. Guest words are accessed as
+// relaxed atomics, so harts sharing a memory (see Smp) never see torn words;
+// on the usual hosts these are plain moves. Byte and halfword stores merge
+// into their word with a compare-and-swap, so they never undo a concurrent
+// store to the rest of the word.
 struct MMU final {
 public:
-    HUExceptionType Load(CPU &cpu, u32_t a, u32_t *dst, CUMemOp memOp = CUMemOp::WORD);
-    HUExceptionType Store(CPU &cpu, u32_t a, u32_t data, CUMemOp memOp = CUMemOp::WORD);
+    inline HUExceptionType Load(CPU &cpu, u32_t a, u32_t *dst, CUMemOp memOp = CUMemOp::WORD);
+    inline HUExceptionType Store(CPU &cpu, u32_t a, u32_t data, CUMemOp memOp = CUMemOp::WORD);
+
+    // Host access for setup and inspection: no exceptions, no devices and no
+    // decode/block cache invalidation.
+    u32_t Peek(u32_t a) const;
+    void Poke(u32_t a, u32_t data);
+
+    u64_t Size() const;
+
+    // Copy the words of the whole page holding a into `words`, one relaxed
+    // atomic load each since other harts may store to the page meanwhile.
+    // Returns false if the page is not all plain memory: past the end, or
+    // with device loads.
+    bool CopyPage(u32_t a, u32_t *words);
 
+    // Host word backing plain memory at a, prepared as for a store so that it
+    // can be updated in place, or nullptr if a is unaligned, a device register
+    // or past the end.
+    u32_t *HostWord(CPU &cpu, u32_t a);
+
+    // FLAT memory is owned by `memory` unless Borrow() points the MMU at a
+    // caller-owned buffer. A borrowed buffer is never freed or resized and must
+    // outlive the MMU and any copy of it; copies share it.
+    void Adopt(std::vector<u32_t> &&words);
+    void Borrow(u32_t *words, u32_t count);
+
+    // Route aligned word accesses in [base, base + size) to a device; see
+    // DeviceBus. Device addresses need not be backed by memory.
+    void MapDevice(u32_t base, u32_t size, DeviceRead read, DeviceWrite write);
+    void UnmapDevice(u32_t base, u32_t size);
+
+    MMUBackend backend = MMUBackend::FLAT;
     std::vector<u32_t> memory = {};
+    u32_t *borrowed = nullptr;
+    u32_t borrowedWords = 0;
+    PagedMemory paged = {};
+    u64_t pagedSize = (u64_t)1 << 32;
+    TLB tlb = {};
+    DeviceBus devices = {};
+
+    // Record the pages stored to from now on, relative to the memory image
+    // identified by `base`, so that restoring that image only reverts them.
+    // While tracking, write access reaches the TLB only after the page has
+    // been recorded.
+    void TrackDirty(u64_t base);
+    bool IsDirty(u32_t a) const;
+
+    bool trackDirty = false;
+    u64_t dirtyBase = 0;
+    std::vector<u32_t> dirtyPages = {};
+
+    static bool IsAligned(u32_t a, CUMemOp memOp)
+    {
+        return !(a & (memOp == CUMemOp::BYTE ? 0 : memOp == CUMemOp::HALF ? 1 : 3));
+    }
+
+private:
+    std::vector<u64_t> dirtyMap = {};
+
+    HUExceptionType LoadSlow(CPU &cpu, u32_t a, u32_t *dst);
+    HUExceptionType StoreSlow(CPU &cpu, u32_t a, u32_t data, CUMemOp memOp);
+    u32_t *MapPage(u32_t a, u8_t perm);
+    void MarkDirty(u32_t a);
+
+    u32_t *FlatData()
+    {
+        return borrowed ? borrowed : memory.data();
+    }
+
+    static u32_t LoadWord(u32_t *host)
+    {
+        return std::atomic_ref<u32_t>(*host).load(std::memory_order_relaxed);
+    }
+
+    static void StoreWord(u32_t *host, u32_t data)
+    {
+        std::atomic_ref<u32_t>(*host).store(data, std::memory_order_relaxed);
+    }
+
+    // Stores data to the word at host as memOp does to a.
+    static void StoreWord(u32_t *host, u32_t a, u32_t data, CUMemOp memOp)
+    {
+        if (memOp == CUMemOp::WORD) {
+            StoreWord(host, data);
+            return;
+        }
+        u32_t const shift = a % sizeof(u32_t) * 8;
+        u32_t const mask = (memOp == CUMemOp::BYTE ? 0xffu : 0xffffu) << shift;
+        std::atomic_ref<u32_t> word(*host);
+        u32_t old = word.load(std::memory_order_relaxed);
+        while (!word.compare_exchange_weak(old, (old & ~mask) | ((data << shift) & mask),
+            std::memory_order_relaxed)) {
+        }
+    }
+
 };
 
 struct FetchStage final : public TickModule {
@@ -48,7 +172,7 @@ public:
     };
     TickState<State> state = {};
 
-    void Tick(CPU &cpu) override;
+    void Tick(CPU &cpu);
 };
 
 struct DecodeStage final : public TickModule {
@@ -63,19 +187,21 @@ public:
 
     struct Regfile final : TickModule {
         u32_t gpr[32] = {};
-        void Tick(CPU &cpu) override;
+        void Tick(CPU &cpu);
     } regfile;
 
-    void Tick(CPU &cpu) override;
+    void Tick(CPU &cpu);
 
     CUExecParams DecodeInstruction(Instruction inst);
-    u32_t UnpackImmediate(Instruction inst, InstructionType iType);
+    DecodedInstruction Predecode(Instruction inst);
+    static u32_t UnpackImmediate(Instruction inst, InstructionType iType);
 };
 
 struct ExecuteStage final : public TickModule {
 public:
     struct State final {
         CUExecParams execParams = {};
+        u32_t inst = 0;
         u32_t pc = 0;
         u32_t pcNext = 0;
         u32_t rs1v = 0;
@@ -84,16 +210,63 @@ public:
         u8_t rs1a = 0;
         u8_t rs2a = 0;
         u8_t rda = 0;
+        bool v = true;
+        [[no_unique_address]] Perf::Tag tag = {};
     };
     TickState<State> state = {};
 
     u32_t jumpBase = 0;
     bool pcR = false;
 
-    void Tick(CPU &cpu) override;
+    void Tick(CPU &cpu);
 
-    u32_t ALUOperator(CUALUOp op, u32_t rs1v, u32_t rs2v);
-    bool CMPOperator(CUCmpOp op, u32_t rs1v, u32_t rs2v);
+    static constexpr u32_t ALUOperator(CUALUOp op, u32_t rs1v, u32_t rs2v)
+    {
+        switch (op) {
+            case CUALUOp::ADD:
+                return rs1v + rs2v;
+            case CUALUOp::SUB:
+                return rs1v - rs2v;
+            case CUALUOp::SLL:
+                return rs1v << (rs2v & 31);
+            case CUALUOp::SLT:
+                return !!((i32_t)rs1v < (i32_t)rs2v);
+            case CUALUOp::SLTU:
+                return !!(rs1v < rs2v);
+            case CUALUOp::XOR:
+                return rs1v ^ rs2v;
+            case CUALUOp::SRL:
+                return rs1v >> (rs2v & 31);
+            case CUALUOp::SRA:
+                return (i32_t)rs1v >> (rs2v & 31);
+            case CUALUOp::OR:
+                return rs1v | rs2v;
+            case CUALUOp::AND:
+                return rs1v & rs2v;
+            case CUALUOp::PASS_SRC2:
+                return rs2v;
+            default: assert(!"Unexpected ALU operation");
+        };
+    }
+
+    static constexpr bool CMPOperator(CUCmpOp op, u32_t rs1v, u32_t rs2v)
+    {
+        switch (op) {
+            case CUCmpOp::EQ:
+                return rs1v == rs2v;
+            case CUCmpOp::NE:
+                return rs1v != rs2v;
+            case CUCmpOp::LT:
+                return (i32_t)rs1v < (i32_t)rs2v;
+            case CUCmpOp::GE:
+                return (i32_t)rs1v >= (i32_t)rs2v;
+            case CUCmpOp::LTU:
+                return rs1v < rs2v;
+            case CUCmpOp::GEU:
+                return rs1v >= rs2v;
+            default: assert(!"Unexpected CMP operation");
+        };
+    }
 };
 
 struct MemoryStage final : public TickModule {
@@ -101,10 +274,13 @@ public:
     struct State {
         CUExecParams execParams = {};
         u8_t regAddr = 0;
+        u32_t inst = 0;
         u32_t pcNext = 0;
         u32_t pc = 0;
         u32_t memWdata = 0;
         u32_t aluRes = 0;
+        bool v = true;
+        [[no_unique_address]] Perf::Tag tag = {};
     };
     TickState<State> state = {};
 
@@ -114,7 +290,11 @@ public:
         bool active = false;
     } delayedWrite;
 
-    void Tick(CPU &cpu) override;
+    void Tick(CPU &cpu);
+
+    HUExceptionType LoadOperator(CPU &cpu, CUExecParams const &params, u32_t a, u32_t *dst);
+    void HostCall(CPU &cpu);
+    TraceRecord Retired(CPU &cpu, u32_t mmuRD) const;
 };
 
 struct WritebackStage final : public TickModule {
@@ -126,13 +306,23 @@ public:
     };
     TickState<State> state = {};
 
-    void Tick(CPU &cpu) override;
+    void Tick(CPU &cpu);
 };
 
 struct CPU final {
 public:
     MMU mmu = {};
     HUModule huModule = {};
+    DecodeCache decodeCache = {};
+    BlockCache blockCache = {};
+    Jit jit = {};
+    HostCallTable hostCalls = {};
+    [[no_unique_address]] Perf perf = {};
+    Profiler *profiler = nullptr;
+    TraceWriter *tracer = nullptr;
+    // A TraceWriter at TraceLevel::FLOW.
+    TraceWriter *flowTracer = nullptr;
+    LockstepChecker *checker = nullptr;
 
     FetchStage fetchStage = {};
     DecodeStage decodeStage = {};
@@ -142,11 +332,71 @@ public:
 
     bool shutdown = true;
     u32_t tvec = 0;
+    // Pipeline ticks, or instructions for the functional engines.
+    u64_t cycles = 0;
 
     void Tick();
     void Execute();
+    // Run the pipeline for at most maxCycles ticks, returning early on
+    // shutdown or when a trap is taken. Step is the same, as the pipeline
+    // always advances one cycle at a time.
+    StopReason Execute(u64_t maxCycles);
+    StopReason Step(u64_t n = 1);
+    // Return to the power-on state, keeping memory and allocated buffers.
+    void Reset();
+    // Continue at pc instead of the trap handler right after a budgeted run
+    // stopped on a trap: retires the older instruction left in writeback so
+    // that the register file is up to date, then redirects fetch.
+    void ReturnFromTrap(u32_t pc);
+
+    StopReason StopReasonSince(u64_t traps) const
+    {
+        if (shutdown) {
+            return StopReason::SHUTDOWN;
+        }
+        return huModule.trapCount != traps ? StopReason::EXCEPTION : StopReason::BUDGET;
+    }
 };
 
+// The cycle: the stages fill the write side of their latches from the read
+// side, and HUModule, last, resolves hazards and traps and advances them all.
+// A different implementation of a stage is swapped in by changing the type of
+// its CPU member; it must keep the state latch and the calls the neighbouring
+// stages and HUModule make on it.
+using CPUPipeline = Pipeline<
+    &CPU::writebackStage,
+    &CPU::memoryStage,
+    &CPU::executeStage,
+    &CPU::decodeStage,
+    &CPU::fetchStage,
+    &CPU::huModule
+>;
+
+HUExceptionType MMU::Load(CPU &cpu, u32_t a, u32_t *dst, CUMemOp memOp)
+{
+    if (!(a % 4)) {
+        if (u32_t *host = tlb.Lookup(a, TLB::READ); host) {
+            *dst = LoadWord(host);
+            return HUExceptionType::NONE;
+        }
+    }
+    return LoadSlow(cpu, a, dst);
+}
+
+HUExceptionType MMU::Store(CPU &cpu, u32_t a, u32_t data, CUMemOp memOp)
+{
+    if (IsAligned(a, memOp)) {
+        u32_t const word = a & ~(u32_t)3;
+        if (u32_t *host = tlb.Lookup(word, TLB::WRITE); host) {
+            StoreWord(host, a, data, memOp);
+            cpu.decodeCache.Invalidate(word);
+            cpu.blockCache.Invalidate(word);
+            return HUExceptionType::NONE;
+        }
+    }
+    return StoreSlow(cpu, a, data, memOp);
+}
+
 } // namespace Sim
 
 #endif // SIM_CPU_H
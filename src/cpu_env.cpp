@@ -1,29 +1,138 @@
 #include "cpu_env.h"
 
+#include <cassert>
+#include <cstring>
+
 namespace Sim {
 
-CPUEnv::CPUEnv(void *mem, u32_t memSize, u32_t tvec)
+CPUEnv::CPUEnv(void const *mem, u32_t memSize, u32_t tvec, MMUBackend backend)
 {
     assert(mem && (memSize % sizeof(u32_t) == 0) && "Invalid memory");
 
-    cpu.mmu.memory.resize(memSize / sizeof(u32_t));
-    for (u32_t i = 0; i < memSize / sizeof(u32_t); ++i) {
-        cpu.mmu.memory[i] = *(u32_t *)((u8_t *)mem + i * sizeof(u32_t));
+    cpu.mmu.backend = backend;
+    if (backend == MMUBackend::FLAT) {
+        cpu.mmu.memory.resize(memSize / sizeof(u32_t));
+        std::memcpy(cpu.mmu.memory.data(), mem, memSize);
+    } else {
+        for (u32_t i = 0; i < memSize / sizeof(u32_t); ++i) {
+            u32_t word = 0;
+            std::memcpy(&word, (u8_t const *)mem + i * sizeof(u32_t), sizeof(word));
+            if (word) {
+                cpu.mmu.Poke(i * sizeof(u32_t), word);
+            }
+        }
     }
 
+    InstallTrapHandler();
+}
+
+CPUEnv::CPUEnv(std::vector<u32_t> &&mem)
+{
+    assert(!mem.empty() && "Invalid memory");
+
+    cpu.mmu.Adopt(std::move(mem));
+    InstallTrapHandler();
+}
+
+CPUEnv::CPUEnv(MemorySpan mem)
+{
+    assert(mem.words && mem.count && "Invalid memory");
+
+    cpu.mmu.Borrow(mem.words, mem.count);
+    InstallTrapHandler();
+}
+
+CPUEnv::CPUEnv(ElfImage const &elf)
+{
+    cpu.mmu.backend = MMUBackend::PAGED;
+    elf.Map(cpu.mmu.paged);
+    entry = elf.entry;
+    cpu.hostCalls.brkStart = elf.end;
+    cpu.hostCalls.brk = elf.end;
+    InstallTrapHandler();
+}
+
+void CPUEnv::Reset(void const *mem, u32_t memSize)
+{
+    assert(mem && (memSize % sizeof(u32_t) == 0) && "Invalid memory");
+    assert(cpu.mmu.backend == MMUBackend::FLAT && !cpu.mmu.borrowed && "Memory is not owned");
+
+    cpu.Reset();
+    cpu.mmu.trackDirty = false;
+    cpu.mmu.memory.resize(memSize / sizeof(u32_t));
+    std::memcpy(cpu.mmu.memory.data(), mem, memSize);
+    InstallTrapHandler();
+}
+
+void CPUEnv::InstallTrapHandler()
+{
     u32_t mov00 = 0x00002023;
 
-    (&cpu.mmu.memory[cpu.tvec / sizeof(u32_t)])[0] = mov00;
-    (&cpu.mmu.memory[cpu.tvec / sizeof(u32_t)])[1] = mov00;
-    (&cpu.mmu.memory[cpu.tvec / sizeof(u32_t)])[2] = mov00;
-    (&cpu.mmu.memory[cpu.tvec / sizeof(u32_t)])[3] = mov00;
+    for (u32_t i = 0; i < TVEC_HANDLER_SIZE / sizeof(u32_t); ++i) {
+        cpu.mmu.Poke(cpu.tvec + i * sizeof(u32_t), mov00);
+    }
+    ShutdownPort{}.Attach(cpu.mmu);
     cpu.shutdown = false;
 }
 
 void CPUEnv::Execute(u32_t pc)
 {
     cpu.fetchStage.state.read.pc = pc;
-    cpu.Execute();
+
+    switch (mode) {
+        case ExecMode::PIPELINE:
+            cpu.Execute();
+            break;
+        case ExecMode::FUNCTIONAL:
+            interpreter.Execute(cpu);
+            break;
+        case ExecMode::BLOCK:
+            cpu.blockCache.Execute(cpu);
+            break;
+        case ExecMode::JIT:
+            cpu.blockCache.Execute(cpu, true);
+            break;
+        default: assert(!"Unexpected execution mode");
+    }
+    cpu.hostCalls.Flush(cpu);
+}
+
+void CPUEnv::Execute()
+{
+    Execute(entry);
+}
+
+StopReason CPUEnv::Resume(u64_t maxCycles)
+{
+    StopReason reason = StopReason::BUDGET;
+
+    switch (mode) {
+        case ExecMode::PIPELINE:
+            reason = cpu.Execute(maxCycles);
+            break;
+        case ExecMode::FUNCTIONAL:
+            reason = interpreter.Execute(cpu, maxCycles);
+            break;
+        case ExecMode::BLOCK:
+            reason = cpu.blockCache.Execute(cpu, false, maxCycles);
+            break;
+        case ExecMode::JIT:
+            reason = cpu.blockCache.Execute(cpu, true, maxCycles);
+            break;
+        default: assert(!"Unexpected execution mode");
+    }
+    if (reason != StopReason::BUDGET) {
+        cpu.hostCalls.Flush(cpu);
+    }
+    return reason;
+}
+
+StopReason CPUEnv::Step(u64_t n)
+{
+    if (mode == ExecMode::PIPELINE) {
+        return cpu.Step(n);
+    }
+    return interpreter.Execute(cpu, n);
 }
 
 } // namespace Sim
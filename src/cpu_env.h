@@ -3,16 +3,58 @@
 
 #include <types.h>
 #include <cpu.h>
+#include <devices.h>
+#include <interpreter.h>
+#include <elf_loader.h>
+#include <vector>
 
 namespace Sim {
 
+// Caller-owned guest memory borrowed by CPUEnv without copying. The buffer
+// must stay alive for as long as the CPUEnv (or a copy) runs; guest stores and
+// the trap stub write straight into it.
+struct MemorySpan final {
+public:
+    u32_t *words = nullptr;
+    u32_t count = 0;
+};
+
+enum class ExecMode : u8_t {
+    PIPELINE, FUNCTIONAL, BLOCK, JIT
+};
+
 struct CPUEnv final {
 public:
     Sim::CPU cpu = {};
+    Sim::Interpreter interpreter = {};
+    ExecMode mode = ExecMode::PIPELINE;
+    u32_t entry = 0;
     static constexpr u32_t TVEC_HANDLER_SIZE = 16;
 
-    CPUEnv(void *mem, u32_t memSize = 4096, u32_t tvec = 4096 - TVEC_HANDLER_SIZE);
+    // PAGED backs the whole 4 GiB address space sparsely; only the non-zero
+    // words of the image are materialised.
+    CPUEnv(void const *mem, u32_t memSize = 4096, u32_t tvec = 4096 - TVEC_HANDLER_SIZE,
+        MMUBackend backend = MMUBackend::FLAT);
+    // Adopt the image without copying; the buffer is owned by cpu.mmu.memory.
+    explicit CPUEnv(std::vector<u32_t> &&mem);
+    explicit CPUEnv(MemorySpan mem);
+    // Map an opened ELF image into a PAGED address space and take its entry.
+    CPUEnv(ElfImage const &elf);
     void Execute(u32_t pc);
+    void Execute();
+
+    // Continue from the current state for at most maxCycles cycles (see
+    // CPU::cycles) in the selected mode. Step runs n cycles one instruction or
+    // tick at a time, so it never overshoots in the block modes.
+    StopReason Resume(u64_t maxCycles);
+    StopReason Step(u64_t n = 1);
+
+    // Reload an owned FLAT memory with a new image, as the copying constructor
+    // would, reusing the memory buffer and caches.
+    void Reset(void const *mem, u32_t memSize);
+
+private:
+    void InstallTrapHandler();
 };
 
 } // namespace Sim
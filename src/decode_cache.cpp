@@ -0,0 +1,107 @@
+#include "decode_cache.h"
+#include "cpu.h"
+#include "batch_decoder.h"
+
+namespace Sim {
+
+DecodedInstruction const &DecodeCache::Decode(CPU &cpu, u32_t pc, Instruction inst)
+{
+    Entry &entry = entries[Index(pc)];
+    if (entry.v && entry.pc == pc && entry.inst.raw == inst.raw) {
+        ++hits;
+        return entry.decoded;
+    }
+    if (Prefill(cpu, pc) && entry.v && entry.pc == pc && entry.inst.raw == inst.raw) {
+        ++misses;
+        return entry.decoded;
+    }
+    return Fill(cpu, entry, pc, inst);
+}
+
+HUExceptionType DecodeCache::Fetch(CPU &cpu, u32_t pc, DecodedInstruction const **dst)
+{
+    Entry &entry = entries[Index(pc)];
+    if (entry.v && entry.pc == pc) {
+        ++hits;
+        *dst = &entry.decoded;
+        return HUExceptionType::NONE;
+    }
+    if (Prefill(cpu, pc) && entry.v && entry.pc == pc) {
+        ++misses;
+        *dst = &entry.decoded;
+        return HUExceptionType::NONE;
+    }
+
+    Instruction inst = {};
+    if (auto ex = cpu.mmu.Load(cpu, pc, &inst.raw); ex != HUExceptionType::NONE) {
+        return ex;
+    }
+    *dst = &Fill(cpu, entry, pc, inst);
+    return HUExceptionType::NONE;
+}
+
+void DecodeCache::Invalidate(u32_t a)
+{
+    Entry &entry = entries[Index(a)];
+    if (entry.pc == (a & ~(u32_t)3)) {
+        entry.v = false;
+    }
+}
+
+void DecodeCache::Flush()
+{
+    for (auto &entry : entries) {
+        entry.v = false;
+    }
+    prefilled.clear();
+}
+
+DecodedInstruction const &DecodeCache::Fill(CPU &cpu, Entry &entry, u32_t pc, Instruction inst)
+{
+    ++misses;
+    entry.pc = pc;
+    entry.inst = inst;
+    entry.v = true;
+    entry.decoded = cpu.decodeStage.Predecode(inst);
+    return entry.decoded;
+}
+
+bool DecodeCache::Prefill(CPU &cpu, u32_t pc)
+{
+    constexpr u32_t PAGE_WORDS = TLB::PAGE_SIZE / sizeof(u32_t);
+    static thread_local BatchDecoder batch = {};
+    static thread_local u32_t words[PAGE_WORDS] = {};
+
+    u32_t const page = pc & ~(TLB::PAGE_SIZE - 1);
+    if (!prefilled.insert(page).second) {
+        return false;
+    }
+    if (!cpu.mmu.CopyPage(page, words)) {
+        return false;
+    }
+
+    batch.Decode({ reinterpret_cast<Instruction const *>(words), PAGE_WORDS });
+    for (u32_t i = 0; i < PAGE_WORDS; ++i) {
+        u32_t const a = page + i * sizeof(u32_t);
+        Entry &entry = entries[Index(a)];
+        if (entry.v && entry.pc != a) {
+            continue;
+        }
+
+        entry.pc = a;
+        entry.inst.raw = words[i];
+        entry.v = true;
+        DecodedInstruction &decoded = entry.decoded;
+        decoded.execParams = isaDescription[(u32_t)batch.isaEntry[i]].execParams;
+        decoded.isaEntry = batch.isaEntry[i];
+        decoded.immExt = batch.immExt[i];
+        decoded.rs1a = batch.rs1[i];
+        decoded.rs2a = batch.rs2[i];
+        decoded.rda = batch.rd[i];
+        decoded.raw = words[i];
+    }
+    ++prefills;
+    return true;
+}
+
+} // namespace Sim
@@ -0,0 +1,66 @@
+#ifndef SIM_DECODE_CACHE_H
+#define SIM_DECODE_CACHE_H
+
+#include <types.h>
+#include <isa.h>
+#include <unordered_set>
+#include <vector>
+
+namespace Sim {
+
+enum class HUExceptionType : u8_t;
+
+struct DecodedInstruction final {
+    CUExecParams execParams = {};
+    ISAEntry isaEntry = ISAEntry::UNKNOWN;
+    u32_t immExt = 0;
+    u8_t rs1a = 0;
+    u8_t rs2a = 0;
+    u8_t rda = 0;
+    // The instruction word, for tracers.
+    u32_t raw = 0;
+};
+
+// Direct-mapped cache of decoded instructions tagged by PC. Entries are
+// invalidated by MMU::Store; memory modified behind the MMU's back requires
+// an explicit Flush(). The first miss on a page of plain memory decodes the
+// whole page with BatchDecoder into the slots that do not hold another
+// page's instructions; later misses decode one word.
+struct DecodeCache final {
+public:
+    static constexpr u32_t SIZE = 4096;
+
+    u64_t hits = 0;
+    u64_t misses = 0;
+    u64_t prefills = 0;
+
+    DecodedInstruction const &Decode(CPU &cpu, u32_t pc, Instruction inst);
+    HUExceptionType Fetch(CPU &cpu, u32_t pc, DecodedInstruction const **dst);
+
+    void Invalidate(u32_t a);
+    void Flush();
+
+private:
+    struct Entry final {
+        u32_t pc = 0;
+        Instruction inst = {};
+        bool v = false;
+        DecodedInstruction decoded = {};
+    };
+    std::vector<Entry> entries = std::vector<Entry>(SIZE);
+    // Pages decoded in bulk since the last Flush().
+    std::unordered_set<u32_t> prefilled = {};
+
+    static u32_t Index(u32_t pc)
+    {
+        return (pc / sizeof(u32_t)) & (SIZE - 1);
+    }
+
+    DecodedInstruction const &Fill(CPU &cpu, Entry &entry, u32_t pc, Instruction inst);
+    // True if the page holding pc was decoded in bulk just now.
+    bool Prefill(CPU &cpu, u32_t pc);
+};
+
+} // namespace Sim
+
+#endif // SIM_DECODE_CACHE_H
@@ -0,0 +1,72 @@
+#include "device_bus.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace Sim {
+
+void DeviceBus::Map(u32_t base, u32_t size, DeviceRead read, DeviceWrite write)
+{
+    Unmap(base, size);
+
+    auto it = std::upper_bound(regions.begin(), regions.end(), base,
+        [](u32_t a, Region const &region) { return a < region.base; });
+    regions.insert(it, { base, size, std::move(read), std::move(write) });
+    lastHit = 0;
+}
+
+void DeviceBus::Unmap(u32_t base, u32_t size)
+{
+    u64_t end = (u64_t)base + size;
+    std::erase_if(regions, [base, end](Region const &region) {
+        return region.base < end && base < (u64_t)region.base + region.size;
+    });
+    lastHit = 0;
+}
+
+DeviceBus::Region const *DeviceBus::Find(u32_t a)
+{
+    if (regions.empty()) {
+        return nullptr;
+    }
+    if (Region const &region = regions[lastHit]; a - region.base < region.size) {
+        return &region;
+    }
+
+    auto it = std::upper_bound(regions.begin(), regions.end(), a,
+        [](u32_t a, Region const &region) { return a < region.base; });
+    if (it == regions.begin() || a - (it - 1)->base >= (it - 1)->size) {
+        return nullptr;
+    }
+    lastHit = it - 1 - regions.begin();
+    return &*(it - 1);
+}
+
+DeviceBus::Window DeviceBus::PageWindow(u32_t page, u32_t pageSize) const
+{
+    Window window = {};
+    u64_t begin = page;
+    u64_t end = begin + pageSize;
+    u64_t writeBegin = end;
+    u64_t writeEnd = begin;
+
+    for (auto const &region : regions) {
+        u64_t regionEnd = (u64_t)region.base + region.size;
+        if (region.base >= end || regionEnd <= begin) {
+            continue;
+        }
+        window.reads |= (bool)region.read;
+        if (region.write) {
+            writeBegin = std::min(writeBegin, std::max(begin, (u64_t)region.base));
+            writeEnd = std::max(writeEnd, std::min(end, regionEnd));
+        }
+    }
+
+    if (writeBegin < writeEnd) {
+        window.base = writeBegin;
+        window.size = writeEnd - writeBegin;
+    }
+    return window;
+}
+
+} // namespace Sim
@@ -0,0 +1,59 @@
+#ifndef SIM_DEVICE_BUS_H
+#define SIM_DEVICE_BUS_H
+
+#include <types.h>
+#include <functional>
+#include <vector>
+
+namespace Sim {
+
+struct CPU;
+
+// Offsets are relative to the region base; accesses are whole aligned words.
+using DeviceRead = std::function<u32_t(CPU &cpu, u32_t offset)>;
+using DeviceWrite = std::function<void(CPU &cpu, u32_t offset, u32_t data)>;
+
+// Address ranges claimed by memory-mapped devices. A region without a read
+// (write) handler lets loads (stores) through to memory, so a device may
+// shadow RAM for one direction only. Lookups happen on the MMU slow path;
+// MapPage keeps device pages out of the TLB for the directions they handle
+// (see Window), so plain RAM accesses never consult the bus.
+struct DeviceBus final {
+public:
+    struct Region final {
+        u32_t base = 0;
+        u32_t size = 0;
+        DeviceRead read = {};
+        DeviceWrite write = {};
+    };
+
+    // Part of a page that must not be accessed through the TLB: stores to
+    // [base, base + size) go to a device, and loads from anywhere on the page
+    // do if reads is set.
+    struct Window final {
+        u32_t base = 0;
+        u32_t size = 0;
+        bool reads = false;
+    };
+
+    // Regions overlapping [base, base + size) are replaced.
+    void Map(u32_t base, u32_t size, DeviceRead read, DeviceWrite write);
+    void Unmap(u32_t base, u32_t size);
+
+    Region const *Find(u32_t a);
+    Window PageWindow(u32_t page, u32_t pageSize) const;
+
+    bool Empty() const
+    {
+        return regions.empty();
+    }
+
+private:
+    // Sorted by base, non-overlapping.
+    std::vector<Region> regions = {};
+    u32_t lastHit = 0;
+};
+
+} // namespace Sim
+
+#endif // SIM_DEVICE_BUS_H
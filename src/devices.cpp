@@ -0,0 +1,126 @@
+#include "devices.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+namespace Sim {
+
+void ShutdownPort::Attach(MMU &mmu, u32_t base)
+{
+    mmu.MapDevice(base, SIZE, {}, [](CPU &cpu, u32_t, u32_t) {
+        cpu.shutdown = true;
+    });
+}
+
+void Uart::Attach(MMU &mmu, u32_t base)
+{
+    auto read = [this](CPU &, u32_t offset) -> u32_t {
+        if (offset == STATUS) {
+            return TX_EMPTY | (input.empty() ? 0 : RX_READY);
+        }
+        if (offset != DATA || input.empty()) {
+            return 0;
+        }
+        u8_t byte = input.front();
+        input.pop_front();
+        return byte;
+    };
+    auto write = [this](CPU &, u32_t offset, u32_t data) {
+        if (offset != DATA) {
+            return;
+        }
+        if (output) {
+            output((u8_t)data);
+        } else {
+            std::putchar((u8_t)data);
+        }
+    };
+    mmu.MapDevice(base, SIZE, read, write);
+}
+
+void Timer::Attach(MMU &mmu, u32_t base)
+{
+    auto read = [this](CPU &cpu, u32_t offset) -> u32_t {
+        switch (offset) {
+            case 0: return (u32_t)cpu.cycles;
+            case 4: return (u32_t)(cpu.cycles >> 32);
+            case 8: return (u32_t)compare;
+            case 12: return (u32_t)(compare >> 32);
+            case 16: return cpu.cycles >= compare;
+            default: return 0;
+        }
+    };
+    auto write = [this](CPU &, u32_t offset, u32_t data) {
+        if (offset == 8) {
+            compare = (compare & ~(u64_t)0xffffffff) | data;
+        } else if (offset == 12) {
+            compare = (compare & 0xffffffff) | ((u64_t)data << 32);
+        }
+    };
+    mmu.MapDevice(base, SIZE, read, write);
+}
+
+void Framebuffer::Attach(MMU &mmu, u32_t base)
+{
+    auto read = [this](CPU &, u32_t offset) {
+        return pixels[offset / sizeof(u32_t)];
+    };
+    auto write = [this](CPU &, u32_t offset, u32_t data) {
+        pixels[offset / sizeof(u32_t)] = data;
+        ++version;
+    };
+    mmu.MapDevice(base, std::size(pixels) * sizeof(u32_t), read, write);
+}
+
+void AtomicUnit::Attach(MMU &mmu, u32_t base)
+{
+    auto read = [this](CPU &cpu, u32_t offset) -> u32_t {
+        switch (offset) {
+            case ADDR: return addr;
+            case DATA: return data;
+            case EXPECT: return expect;
+            default: break;
+        }
+
+        u32_t *host = cpu.mmu.HostWord(cpu, addr);
+        if (!host) {
+            return 0;
+        }
+        std::atomic_ref<u32_t> word(*host);
+        auto update = [&word](auto &&op) {
+            u32_t old = word.load();
+            while (!word.compare_exchange_weak(old, op(old))) {
+            }
+            return old;
+        };
+        switch (offset) {
+            case SWAP: return word.exchange(data);
+            case ADD: return word.fetch_add(data);
+            case AND: return word.fetch_and(data);
+            case OR: return word.fetch_or(data);
+            case XOR: return word.fetch_xor(data);
+            case MIN: return update([this](u32_t old) { return (i32_t)old < (i32_t)data ? old : data; });
+            case MAX: return update([this](u32_t old) { return (i32_t)old > (i32_t)data ? old : data; });
+            case MINU: return update([this](u32_t old) { return std::min(old, data); });
+            case MAXU: return update([this](u32_t old) { return std::max(old, data); });
+            case CAS: {
+                u32_t old = expect;
+                word.compare_exchange_strong(old, data);
+                return old;
+            }
+            default: return 0;
+        }
+    };
+    auto write = [this](CPU &, u32_t offset, u32_t value) {
+        switch (offset) {
+            case ADDR: addr = value; break;
+            case DATA: data = value; break;
+            case EXPECT: expect = value; break;
+            default: break;
+        }
+    };
+    mmu.MapDevice(base, SIZE, read, write);
+}
+
+} // namespace Sim
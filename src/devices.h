@@ -0,0 +1,108 @@
+#ifndef SIM_DEVICES_H
+#define SIM_DEVICES_H
+
+#include <types.h>
+#include <cpu.h>
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace Sim {
+
+// Peripherals for MMU::MapDevice. Attach() registers handlers referring to
+// the device object, which must outlive the CPU it is attached to and any
+// copy of that CPU.
+
+// Any store sets cpu.shutdown; loads read the memory underneath. CPUEnv maps
+// one at address 0, where its trap stub stores.
+struct ShutdownPort final {
+public:
+    static constexpr u32_t BASE = 0;
+    static constexpr u32_t SIZE = 4;
+
+    void Attach(MMU &mmu, u32_t base = BASE);
+};
+
+// Byte-wide serial port.
+//   +0 DATA:   store transmits the low byte, load receives one (0 if none)
+//   +4 STATUS: bit 0 receive data ready, bit 5 transmitter empty (always)
+struct Uart final {
+public:
+    static constexpr u32_t BASE = 0x10000000;
+    static constexpr u32_t SIZE = 8;
+    static constexpr u32_t DATA = 0;
+    static constexpr u32_t STATUS = 4;
+    static constexpr u32_t RX_READY = 1 << 0;
+    static constexpr u32_t TX_EMPTY = 1 << 5;
+
+    // Receives transmitted bytes; defaults to the host's stdout.
+    std::function<void(u8_t byte)> output = {};
+    std::deque<u8_t> input = {};
+
+    void Attach(MMU &mmu, u32_t base = BASE);
+};
+
+// Machine timer counting CPU::cycles. Nothing takes interrupts, so guests
+// poll PENDING.
+//   +0/+4  MTIME lo/hi, read-only
+//   +8/+12 MTIMECMP lo/hi
+//   +16    PENDING: 1 once MTIME >= MTIMECMP
+struct Timer final {
+public:
+    static constexpr u32_t BASE = 0x02000000;
+    static constexpr u32_t SIZE = 20;
+
+    u64_t compare = ~(u64_t)0;
+
+    void Attach(MMU &mmu, u32_t base = BASE);
+};
+
+// Linear 32-bit pixel buffer kept on the host side, row-major.
+struct Framebuffer final {
+public:
+    static constexpr u32_t BASE = 0x20000000;
+
+    u32_t width = 0;
+    u32_t height = 0;
+    std::vector<u32_t> pixels = {};
+    // Bumped by every store, so hosts can tell when to redraw.
+    u64_t version = 0;
+
+    Framebuffer(u32_t width, u32_t height) : width(width), height(height), pixels(width * height) {}
+
+    void Attach(MMU &mmu, u32_t base = BASE);
+};
+
+// Atomic read-modify-write of guest memory for harts sharing it (see Smp),
+// standing in for the A extension RV32I lacks. Each hart attaches its own
+// unit, so the operand registers are private to the hart that wrote them.
+//   +0  ADDR:   word address operated on
+//   +4  DATA:   operand
+//   +8  EXPECT: value CAS compares against
+//   +12 ..     loading an operation performs it on the word at ADDR as one
+//              sequentially consistent step and returns the old value; one
+//              whose ADDR is not plain memory changes nothing and returns 0
+struct AtomicUnit final {
+public:
+    static constexpr u32_t BASE = 0x02010000;
+    static constexpr u32_t ADDR = 0;
+    static constexpr u32_t DATA = 4;
+    static constexpr u32_t EXPECT = 8;
+
+    enum Op : u32_t {
+        SWAP = 12, ADD = 16, AND = 20, OR = 24, XOR = 28, MIN = 32, MAX = 36, MINU = 40, MAXU = 44,
+        // Stores DATA only if the word equals EXPECT.
+        CAS = 48,
+    };
+    static constexpr u32_t SIZE = CAS + 4;
+
+    u32_t addr = 0;
+    u32_t data = 0;
+    u32_t expect = 0;
+
+    void Attach(MMU &mmu, u32_t base = BASE);
+};
+
+} // namespace Sim
+
+#endif // SIM_DEVICES_H
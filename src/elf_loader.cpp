@@ -0,0 +1,141 @@
+#include "elf_loader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Sim {
+
+ElfStatus ElfImage::Open(char const *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return ElfStatus::OPEN_FAILED;
+    }
+
+    struct stat st = {};
+    if (fstat(fd, &st) || (u64_t)st.st_size < sizeof(Elf32_Ehdr)) {
+        close(fd);
+        return ElfStatus::BAD_FORMAT;
+    }
+
+    // Writable but private: guest stores into aliased pages are copied by the
+    // kernel and never reach the file.
+    u64_t size = st.st_size;
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return ElfStatus::OPEN_FAILED;
+    }
+    file = std::shared_ptr<u8_t>((u8_t *)p, [size](u8_t *q) { munmap(q, size); });
+    fileSize = size;
+    segments.clear();
+    symbols.clear();
+    end = 0;
+
+    Elf32_Ehdr ehdr = {};
+    std::memcpy(&ehdr, file.get(), sizeof(ehdr));
+    if (std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) || ehdr.e_ident[EI_CLASS] != ELFCLASS32 ||
+        ehdr.e_ident[EI_DATA] != ELFDATA2LSB || ehdr.e_phentsize != sizeof(Elf32_Phdr) ||
+        ehdr.e_phoff + (u64_t)ehdr.e_phnum * sizeof(Elf32_Phdr) > fileSize) {
+        return ElfStatus::BAD_FORMAT;
+    }
+    if (ehdr.e_machine != EM_RISCV || ehdr.e_type != ET_EXEC) {
+        return ElfStatus::UNSUPPORTED;
+    }
+
+    for (u32_t i = 0; i < ehdr.e_phnum; ++i) {
+        Elf32_Phdr phdr = {};
+        std::memcpy(&phdr, file.get() + ehdr.e_phoff + i * sizeof(Elf32_Phdr), sizeof(phdr));
+        if (phdr.p_type != PT_LOAD) {
+            continue;
+        }
+        if (phdr.p_offset + (u64_t)phdr.p_filesz > fileSize || phdr.p_filesz > phdr.p_memsz ||
+            phdr.p_vaddr + (u64_t)phdr.p_memsz > ((u64_t)1 << 32)) {
+            return ElfStatus::BAD_FORMAT;
+        }
+        segments.push_back({ phdr.p_vaddr, phdr.p_offset, phdr.p_filesz, phdr.p_memsz });
+        end = std::max(end, phdr.p_vaddr + phdr.p_memsz);
+    }
+
+    entry = ehdr.e_entry;
+    ReadSymbols(ehdr);
+    return ElfStatus::OK;
+}
+
+// Malformed or missing symbol tables are ignored; symbols are only used for
+// reporting.
+void ElfImage::ReadSymbols(Elf32_Ehdr const &ehdr)
+{
+    if (!ehdr.e_shoff || ehdr.e_shentsize != sizeof(Elf32_Shdr) ||
+        ehdr.e_shoff + (u64_t)ehdr.e_shnum * sizeof(Elf32_Shdr) > fileSize) {
+        return;
+    }
+
+    auto section = [this, &ehdr](u32_t i) {
+        Elf32_Shdr shdr = {};
+        std::memcpy(&shdr, file.get() + ehdr.e_shoff + i * sizeof(Elf32_Shdr), sizeof(shdr));
+        return shdr;
+    };
+
+    for (u32_t i = 0; i < ehdr.e_shnum; ++i) {
+        Elf32_Shdr symtab = section(i);
+        if (symtab.sh_type != SHT_SYMTAB || symtab.sh_link >= ehdr.e_shnum ||
+            symtab.sh_offset + (u64_t)symtab.sh_size > fileSize) {
+            continue;
+        }
+        Elf32_Shdr strtab = section(symtab.sh_link);
+        if (strtab.sh_offset + (u64_t)strtab.sh_size > fileSize) {
+            continue;
+        }
+
+        char const *names = (char const *)file.get() + strtab.sh_offset;
+        for (u32_t off = 0; off + sizeof(Elf32_Sym) <= symtab.sh_size; off += sizeof(Elf32_Sym)) {
+            Elf32_Sym sym = {};
+            std::memcpy(&sym, file.get() + symtab.sh_offset + off, sizeof(sym));
+            if (ELF32_ST_TYPE(sym.st_info) != STT_FUNC || sym.st_name >= strtab.sh_size) {
+                continue;
+            }
+            symbols.push_back({ sym.st_value, sym.st_size,
+                std::string(names + sym.st_name, strnlen(names + sym.st_name, strtab.sh_size - sym.st_name)) });
+        }
+    }
+
+    std::sort(symbols.begin(), symbols.end(), [](ElfSymbol const &a, ElfSymbol const &b) {
+        return a.addr < b.addr;
+    });
+}
+
+void ElfImage::Map(PagedMemory &memory) const
+{
+    constexpr u64_t PAGE_SIZE = PagedMemory::PAGE_SIZE;
+
+    for (auto const &seg : segments) {
+        u64_t fileEnd = (u64_t)seg.vaddr + seg.fileSize;
+        u64_t memEnd = (u64_t)seg.vaddr + seg.memSize;
+
+        for (u64_t page = seg.vaddr & ~(PAGE_SIZE - 1); page < fileEnd; page += PAGE_SIZE) {
+            u64_t begin = std::max<u64_t>(page, seg.vaddr);
+            u64_t end = std::min(page + PAGE_SIZE, fileEnd);
+            u64_t offset = seg.offset + (begin - seg.vaddr);
+
+            if (begin == page && end == page + PAGE_SIZE && offset % PAGE_SIZE == 0) {
+                auto *host = (PagedMemory::Page *)(file.get() + offset);
+                memory.MapShared(page, std::shared_ptr<PagedMemory::Page>(file, host));
+                continue;
+            }
+
+            u8_t *dst = (u8_t *)memory.WritablePage(page).words;
+            std::memcpy(dst + (begin - page), file.get() + offset, end - begin);
+            if (end < page + PAGE_SIZE && end < memEnd) {
+                std::memset(dst + (end - page), 0, std::min(page + PAGE_SIZE, memEnd) - end);
+            }
+        }
+    }
+}
+
+} // namespace Sim
@@ -0,0 +1,59 @@
+#ifndef SIM_ELF_LOADER_H
+#define SIM_ELF_LOADER_H
+
+#include <types.h>
+#include <elf.h>
+#include <paged_memory.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Sim {
+
+enum class ElfStatus : u8_t {
+    OK,
+    OPEN_FAILED, BAD_FORMAT, UNSUPPORTED,
+};
+
+struct ElfSymbol final {
+public:
+    u32_t addr = 0;
+    u32_t size = 0;
+    std::string name = {};
+};
+
+// Statically linked ELF32 RISC-V executable, mmapped privately. Map() aliases
+// every page-aligned, fully file-backed page of a PT_LOAD segment straight
+// into guest memory; only pages straddling segment boundaries are copied and
+// .bss beyond them is left to the zero page. Segment permissions are not
+// enforced. Mapped pages keep the file mapping alive, so the image may be
+// destroyed once mapped.
+struct ElfImage final {
+public:
+    ElfStatus Open(char const *path);
+    void Map(PagedMemory &memory) const;
+
+    u32_t entry = 0;
+    // End of the highest PT_LOAD segment, where the program break starts.
+    u32_t end = 0;
+    // Function symbols from .symtab sorted by address; empty if stripped.
+    std::vector<ElfSymbol> symbols = {};
+
+private:
+    void ReadSymbols(Elf32_Ehdr const &ehdr);
+
+    struct Segment final {
+        u32_t vaddr = 0;
+        u32_t offset = 0;
+        u32_t fileSize = 0;
+        u32_t memSize = 0;
+    };
+
+    std::shared_ptr<u8_t> file = {};
+    u64_t fileSize = 0;
+    std::vector<Segment> segments = {};
+};
+
+} // namespace Sim
+
+#endif // SIM_ELF_LOADER_H
@@ -0,0 +1,165 @@
+#include "host_calls.h"
+#include "cpu.h"
+
+#include <cerrno>
+#include <unistd.h>
+#include <utility>
+
+namespace Sim {
+
+namespace {
+
+u32_t Error(u32_t errnum)
+{
+    return (u32_t)-(i32_t)errnum;
+}
+
+bool ReadGuest(CPU &cpu, u32_t a, u32_t size, std::vector<u8_t> &dst)
+{
+    if (a + (u64_t)size > cpu.mmu.Size()) {
+        return false;
+    }
+
+    dst.resize(size);
+    for (u32_t i = 0; i < size; ++i) {
+        u32_t b = a + i;
+        dst[i] = (u8_t)(cpu.mmu.Peek(b & ~(u32_t)3) >> ((b % 4) * 8));
+    }
+    return true;
+}
+
+// Goes through MMU::Store so that code caches and dirty pages stay coherent.
+// Words the buffer only partly covers take byte stores, which leave the rest
+// of the word to other harts storing into it.
+bool WriteGuest(CPU &cpu, u32_t a, u8_t const *src, u32_t size)
+{
+    if (a + (u64_t)size > cpu.mmu.Size()) {
+        return false;
+    }
+
+    for (u32_t i = 0; i < size;) {
+        u32_t b = a + i;
+        if (b % 4 || size - i < 4) {
+            cpu.mmu.Store(cpu, b, src[i], CUMemOp::BYTE);
+            ++i;
+            continue;
+        }
+        u32_t data = 0;
+        for (u32_t j = 0; j < 4; ++j) {
+            data |= (u32_t)src[i + j] << (j * 8);
+        }
+        cpu.mmu.Store(cpu, b, data);
+        i += 4;
+    }
+    return true;
+}
+
+} // namespace
+
+void HostCallTable::Register(u32_t number, HostCallHandler handler, bool batched)
+{
+    if (number >= std::size(handlers)) {
+        handlers.resize(number + 1);
+    }
+    handlers[number] = { std::move(handler), batched };
+}
+
+void HostCallTable::RegisterLinux(bool batchWrites)
+{
+    Register(WRITE, [this](CPU &cpu, HostCallArgs const &call) {
+        u32_t fd = call.args[0];
+        std::vector<u8_t> buffer = {};
+        if (call.data.empty() && !ReadGuest(cpu, call.args[1], call.args[2], buffer)) {
+            return Error(EFAULT);
+        }
+        auto const &data = call.data.empty() ? buffer : call.data;
+
+        if (output) {
+            output(fd, data.data(), std::size(data));
+        } else if (fd != 1 && fd != 2) {
+            return Error(EBADF);
+        } else if (!data.empty() && ::write(fd, data.data(), std::size(data)) < 0) {
+            return Error(EBADF);
+        }
+        return (u32_t)std::size(data);
+    }, batchWrites);
+
+    Register(READ, [this](CPU &cpu, HostCallArgs const &call) {
+        u32_t fd = call.args[0];
+        if (call.args[1] + (u64_t)call.args[2] > cpu.mmu.Size()) {
+            return Error(EFAULT);
+        }
+
+        std::vector<u8_t> buffer(call.args[2]);
+        i32_t n = 0;
+        if (input) {
+            n = input(fd, buffer.data(), std::size(buffer));
+        } else if (fd != 0) {
+            return Error(EBADF);
+        } else {
+            n = ::read(fd, buffer.data(), std::size(buffer));
+            n = n < 0 ? -(i32_t)EBADF : n;
+        }
+        if (n > 0) {
+            WriteGuest(cpu, call.args[1], buffer.data(), n);
+        }
+        return (u32_t)n;
+    });
+
+    auto exit = [this](CPU &cpu, HostCallArgs const &call) {
+        exitCode = call.args[0];
+        cpu.shutdown = true;
+        return call.args[0];
+    };
+    Register(EXIT, exit);
+    Register(EXIT_GROUP, exit);
+
+    Register(BRK, [this](CPU &cpu, HostCallArgs const &call) {
+        u32_t a = call.args[0];
+        if (a >= brkStart && a <= cpu.mmu.Size()) {
+            brk = a;
+        }
+        return brk;
+    });
+}
+
+bool HostCallTable::Dispatch(CPU &cpu, HostCallArgs &call, u32_t *result)
+{
+    if (call.number >= std::size(handlers) || !handlers[call.number].handler) {
+        return false;
+    }
+    ++calls;
+
+    Entry const &entry = handlers[call.number];
+    if (entry.batched) {
+        if (!ReadGuest(cpu, call.args[1], call.args[2], call.data)) {
+            *result = Error(EFAULT);
+            return true;
+        }
+        *result = call.args[2];
+        queue.push_back(std::move(call));
+        if (std::size(queue) >= BATCH_SIZE) {
+            Flush(cpu);
+        }
+        return true;
+    }
+
+    Flush(cpu);
+    *result = entry.handler(cpu, call);
+    return true;
+}
+
+void HostCallTable::Flush(CPU &cpu)
+{
+    if (queue.empty()) {
+        return;
+    }
+
+    ++batches;
+    for (auto const &call : queue) {
+        handlers[call.number].handler(cpu, call);
+    }
+    queue.clear();
+}
+
+} // namespace Sim
@@ -0,0 +1,76 @@
+#ifndef SIM_HOST_CALLS_H
+#define SIM_HOST_CALLS_H
+
+#include <types.h>
+#include <functional>
+#include <vector>
+
+namespace Sim {
+
+struct CPU;
+
+struct HostCallArgs final {
+public:
+    u32_t number = 0;
+    u32_t args[6] = {};
+    // Batched calls only: copy of the guest buffer at args[1], args[2] bytes.
+    std::vector<u8_t> data = {};
+};
+
+// Returns the value written back to a0.
+using HostCallHandler = std::function<u32_t(CPU &cpu, HostCallArgs const &call)>;
+
+// ECALL handlers keyed by a7. While any handler is registered, an ECALL is
+// serviced natively when it reaches the memory stage (or is interpreted)
+// and execution continues after it; an ECALL with no handler for a7 still
+// traps with HUExceptionType::INT, as does EBREAK.
+//
+// Batched calls must have the write(fd, buf, count) shape: the buffer is
+// captured and the guest gets count back at once, while the handler runs
+// when the queue is flushed. The queue is flushed when it holds BATCH_SIZE
+// calls, before any unbatched call and by Flush().
+struct HostCallTable final {
+public:
+    static constexpr u32_t BATCH_SIZE = 64;
+
+    enum Linux : u32_t {
+        READ = 63, WRITE = 64, EXIT = 93, EXIT_GROUP = 94, BRK = 214,
+    };
+
+    // Host side of the Linux set; defaults use the process's own descriptors.
+    std::function<void(u32_t fd, u8_t const *data, u32_t size)> output = {};
+    std::function<i32_t(u32_t fd, u8_t *data, u32_t size)> input = {};
+
+    u32_t exitCode = 0;
+    // Program break; brk() only moves it within [brkStart, memory size].
+    u32_t brkStart = 0;
+    u32_t brk = 0;
+    u64_t calls = 0;
+    u64_t batches = 0;
+
+    bool Active() const
+    {
+        return !handlers.empty();
+    }
+
+    void Register(u32_t number, HostCallHandler handler, bool batched = false);
+    // write/read/exit/exit_group/brk with Linux numbers and return values.
+    void RegisterLinux(bool batchWrites = false);
+
+    // Runs the handler for call.number; false if there is none.
+    bool Dispatch(CPU &cpu, HostCallArgs &call, u32_t *result);
+    void Flush(CPU &cpu);
+
+private:
+    struct Entry final {
+        HostCallHandler handler = {};
+        bool batched = false;
+    };
+
+    std::vector<Entry> handlers = {};
+    std::vector<HostCallArgs> queue = {};
+};
+
+} // namespace Sim
+
+#endif // SIM_HOST_CALLS_H
@@ -0,0 +1,45 @@
+#include "interpreter.h"
+
+#include <cassert>
+
+namespace Sim {
+
+void Interpreter::Execute(CPU &cpu)
+{
+    while (!cpu.shutdown) {
+        Step(cpu);
+    }
+}
+
+StopReason Interpreter::Execute(CPU &cpu, u64_t maxCycles)
+{
+    u64_t traps = cpu.huModule.trapCount;
+    for (u64_t i = 0; i < maxCycles && !cpu.shutdown && cpu.huModule.trapCount == traps; ++i) {
+        Step(cpu);
+    }
+    return cpu.StopReasonSince(traps);
+}
+
+void Interpreter::Step(CPU &cpu)
+{
+    u32_t const pc = cpu.fetchStage.state.read.pc;
+    ++cpu.cycles;
+    cpu.perf.Cycle();
+
+    DecodedInstruction const *decoded = nullptr;
+    if (auto ex = cpu.decodeCache.Fetch(cpu, pc, &decoded); ex != HUExceptionType::NONE) {
+        cpu.huModule.TakeTrap(cpu, ex, pc);
+        return;
+    }
+
+    if (ExecuteInstruction(cpu, *decoded, pc) && cpu.flowTracer) {
+        cpu.flowTracer->Flow(pc, 1);
+    }
+}
+
+bool Interpreter::ExecuteInstruction(CPU &cpu, DecodedInstruction const &decoded, u32_t pc)
+{
+    return ExecuteInstruction(cpu, decoded, pc, decoded.execParams);
+}
+
+} // namespace Sim
@@ -0,0 +1,160 @@
+#ifndef SIM_INTERPRETER_H
+#define SIM_INTERPRETER_H
+
+#include <types.h>
+#include <cpu.h>
+#include <profiler.h>
+#include <trace.h>
+#include <lockstep.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+namespace Sim {
+
+// Instruction-at-a-time model of the CPU: shares the ISA table, MMU and the
+// architectural state (regfile, fetchStage pc, huModule exception info) with
+// the pipeline, but bypasses the stage latches and hazard handling.
+struct Interpreter final {
+public:
+    void Execute(CPU &cpu);
+    // Run at most maxCycles instructions, returning early on shutdown or
+    // after a trap.
+    StopReason Execute(CPU &cpu, u64_t maxCycles);
+    void Step(CPU &cpu);
+
+    // Returns false if the instruction trapped, in which case the pc already
+    // points at tvec.
+    bool ExecuteInstruction(CPU &cpu, DecodedInstruction const &decoded, u32_t pc);
+
+    // Same as above with the execution parameters supplied separately, so
+    // that callers passing a constexpr entry of isaDescription get a copy
+    // specialised for that instruction. Callers that reserved trace slots (see
+    // TraceWriter::Reserve) pass a cursor into them in `slot`.
+    [[gnu::always_inline]] static inline bool ExecuteInstruction(CPU &cpu, DecodedInstruction const &decoded,
+        u32_t pc, CUExecParams const &params, TraceWriter::Slot **slot = nullptr);
+
+private:
+    [[gnu::always_inline]] static inline void Observe(CPU &cpu, TraceRecord const &record,
+        TraceWriter::Slot **slot);
+};
+
+inline void Interpreter::Observe(CPU &cpu, TraceRecord const &record, TraceWriter::Slot **slot)
+{
+    if (slot && *slot) {
+        TraceWriter::Pack(*(*slot)++, record);
+    } else if (cpu.tracer) {
+        cpu.tracer->Record(record);
+    }
+    if (cpu.checker) {
+        cpu.checker->Retire(cpu, record);
+    }
+}
+
+inline bool Interpreter::ExecuteInstruction(CPU &cpu, DecodedInstruction const &decoded, u32_t pc,
+    CUExecParams const &params, TraceWriter::Slot **slot)
+{
+    u32_t *gpr = cpu.decodeStage.regfile.gpr;
+
+    if (!params.isOpcodeOk) {
+        cpu.huModule.TakeTrap(cpu, HUExceptionType::BAD_OPCODE, pc);
+        return false;
+    }
+    if (params.isECall && cpu.hostCalls.Active()) {
+        HostCallArgs call = {};
+        call.number = gpr[17];
+        std::copy(gpr + 10, gpr + 16, call.args);
+        if (u32_t result = 0; cpu.hostCalls.Dispatch(cpu, call, &result)) {
+            gpr[10] = result;
+            cpu.fetchStage.state.read.pc = pc + 4;
+            cpu.perf.Retire(decoded.isaEntry);
+            if (cpu.profiler) {
+                cpu.profiler->Retire(pc, decoded.raw, cpu.cycles);
+            }
+            if ((slot && *slot) || cpu.tracer || cpu.checker) {
+                Observe(cpu, { .pc = pc, .inst = decoded.raw, .rd = 10, .rdValue = result }, slot);
+            }
+            return true;
+        }
+    }
+    if (params.intpt) {
+        cpu.huModule.TakeTrap(cpu, HUExceptionType::INT, pc);
+        return false;
+    }
+
+    u32_t const immExt = decoded.immExt;
+    u32_t sv1 = gpr[decoded.rs1a];
+    u32_t sv2 = gpr[decoded.rs2a];
+    u32_t const memWdata = sv2;
+    u32_t const jumpBase = params.isJumpReg ? (sv1 & ~(u32_t)1) : pc;
+
+    if (params.aluSrc1 == CUALUSrc::PC) {
+        sv1 = pc;
+    }
+    if (params.aluSrc2 == CUALUSrc::IMM) {
+        sv2 = immExt;
+    }
+
+    u32_t const aluRes = ExecuteStage::ALUOperator(params.aluOp, sv1, sv2);
+    bool const pcR = params.isJump ||
+        (params.isBranch && ExecuteStage::CMPOperator(params.cmpOp, sv1, sv2));
+
+    u32_t const pcNext = pc + 4;
+    u32_t regWdata = aluRes;
+
+    switch (params.resSrc) {
+        case CUResSrc::ALU:
+            break;
+        case CUResSrc::MEM:
+            if (auto ex = cpu.memoryStage.LoadOperator(cpu, params, aluRes, &regWdata);
+                ex != HUExceptionType::NONE) {
+                cpu.huModule.TakeTrap(cpu, ex, pc);
+                return false;
+            }
+            break;
+        case CUResSrc::PC:
+            regWdata = pcNext;
+            break;
+        default: assert(!"Unexpected CUResSrc");
+    }
+
+    if (params.memWrite) {
+        if (auto ex = cpu.mmu.Store(cpu, aluRes, memWdata, params.memOp); ex != HUExceptionType::NONE) {
+            cpu.huModule.TakeTrap(cpu, ex, pc);
+            return false;
+        }
+    }
+
+    if (params.isFence) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    if (params.regWrite) {
+        gpr[decoded.rda] = regWdata;
+        gpr[0] = 0;
+    }
+
+    cpu.fetchStage.state.read.pc = pcR ? jumpBase + immExt : pcNext;
+    cpu.perf.Retire(decoded.isaEntry);
+    if (cpu.profiler) {
+        cpu.profiler->Retire(pc, decoded.raw, cpu.cycles);
+    }
+    if ((slot && *slot) || cpu.tracer || cpu.checker) {
+        TraceRecord record = { .pc = pc, .inst = decoded.raw };
+        if (params.regWrite && decoded.rda) {
+            record.rd = decoded.rda;
+            record.rdValue = regWdata;
+        }
+        if (params.resSrc == CUResSrc::MEM || params.memWrite) {
+            record.access = params.memWrite ? TraceAccess::STORE : TraceAccess::LOAD;
+            record.addr = aluRes;
+            record.data = params.memWrite ? memWdata : regWdata;
+        }
+        Observe(cpu, record, slot);
+    }
+    return true;
+}
+
+} // namespace Sim
+
+#endif // SIM_INTERPRETER_H
@@ -2,6 +2,7 @@
 #define SIM_ISA_H
 
 #include <types.h>
+#include <iterator>
 
 namespace Sim {
 
@@ -20,9 +21,15 @@ enum class Opcode : u8_t {
     UNKNOWN
 };
 
+#define SIM_ISA_ENTRIES(X) \
+    X(LUI) X(AUIPC) X(JAL) X(JALR) X(BEQ) X(BNE) X(BLT) X(BGE) X(BLTU) X(BGEU) X(LB) X(LH) X(LW) X(LBU) X(LHU) \
+    X(SB) X(SH) X(SW) X(ADDI) X(SLTI) X(SLTIU) X(XORI) X(ORI) X(ANDI) X(SLLI) X(SRLI) X(SRAI) X(ADD) X(SUB) \
+    X(SLL) X(SLT) X(SLTU) X(XOR) X(SRL) X(SRA) X(OR) X(AND) X(FENCE) X(ECALL) X(EBREAK)
+
 enum class ISAEntry : u8_t {
-    LUI, AUIPC, JAL, JALR, BEQ, BNE, BLT, BGE, BLTU, BGEU, LB, LH, LW, LBU, LHU, SB, SH, SW, ADDI, SLTI, SLTIU,
-    XORI, ORI, ANDI, SLLI, SRLI, SRAI, ADD, SUB, SLL, SLT, SLTU, XOR, SRL, SRA, OR, AND, FENCE, ECALL, EBREAK,
+#define SIM_ISA_ENTRY(name) name,
+    SIM_ISA_ENTRIES(SIM_ISA_ENTRY)
+#undef SIM_ISA_ENTRY
     UNKNOWN
 };
 
@@ -37,9 +44,291 @@ struct ISAEntryDescription final {
     CUExecParams execParams = {};
 };
 
-extern ISAEntryDescription const isaDescription[];
+template<InstructionType iType, CUALUOp aluOp, CUALUSrc src1, CUALUSrc src2>
+constexpr CUExecParams BuildALUInst()
+{
+    CUExecParams params = {};
+    params.iType = iType;
+    params.regWrite = true;
+    params.aluSrc1 = src1;
+    params.aluSrc2 = src2;
+    params.aluOp = aluOp;
+    params.resSrc = CUResSrc::ALU;
+    params.isOpcodeOk = true;
+    return params;
+}
+
+template<InstructionType iType, CUALUOp aluOp>
+constexpr CUExecParams BuildArithm()
+{
+    if (iType == InstructionType::R) {
+        return BuildALUInst<iType, aluOp, CUALUSrc::REG, CUALUSrc::REG>();
+    } else if (iType == InstructionType::I) {
+        return BuildALUInst<iType, aluOp, CUALUSrc::REG, CUALUSrc::IMM>();
+    }
+    return CUExecParams{};
+}
+
+template<InstructionType iType, bool isJumpReg>
+constexpr CUExecParams BuildJump()
+{
+    CUExecParams params = {};
+    params.regWrite = true;
+    params.iType = iType;
+    params.resSrc = CUResSrc::PC;
+    params.isJump = true;
+    params.isJumpReg = isJumpReg;
+    params.isOpcodeOk = true;
+    return params;
+}
+
+template<CUCmpOp cmpOp>
+constexpr CUExecParams BuildBranch()
+{
+    CUExecParams params = {};
+    params.iType = InstructionType::B;
+    params.cmpOp = cmpOp;
+    params.isBranch = true;
+    params.isOpcodeOk = true;
+    return params;
+}
+
+template<CUMemOp memOp, bool signExt>
+constexpr CUExecParams BuildLoad()
+{
+    CUExecParams params = {};
+    params.iType = InstructionType::I;
+    params.regWrite = true;
+    params.aluSrc1 = CUALUSrc::REG;
+    params.aluSrc2 = CUALUSrc::IMM;
+    params.aluOp = CUALUOp::ADD;
+    params.resSrc = CUResSrc::MEM;
+    params.memOp = memOp;
+    params.memSignExt = signExt;
+    params.isOpcodeOk = true;
+    return params;
+}
+
+template<CUMemOp memOp>
+constexpr CUExecParams BuildStore()
+{
+    CUExecParams params = {};
+    params.iType = InstructionType::S;
+    params.aluSrc1 = CUALUSrc::REG;
+    params.aluSrc2 = CUALUSrc::IMM;
+    params.aluOp = CUALUOp::ADD;
+    params.memWrite = true;
+    params.memOp = memOp;
+    params.memSignExt = false;
+    params.isOpcodeOk = true;
+    return params;
+}
+
+template<bool isInt, bool isECall = false>
+constexpr CUExecParams BuildSystem()
+{
+    CUExecParams params = {};
+    params.iType = InstructionType::I;
+    params.intpt = isInt;
+    params.isECall = isECall;
+    params.isOpcodeOk = true;
+    return params;
+}
+
+constexpr CUExecParams BuildFence()
+{
+    CUExecParams params = BuildSystem<false>();
+    params.isFence = true;
+    return params;
+}
+
+inline constexpr ISAEntryDescription isaDescription[] = {
+    ISAEntryDescription{ "LUI",    ISAEntry::LUI,    Opcode::LUI,      InstructionType::U, 0b000, 0b0000000,
+        BuildALUInst<InstructionType::U, CUALUOp::PASS_SRC2, CUALUSrc::UNKNOWN, CUALUSrc::IMM>() }, // 0
+    ISAEntryDescription{ "AUIPC",  ISAEntry::AUIPC,  Opcode::AUIPC,    InstructionType::U, 0b000, 0b0000000, 
+        BuildALUInst<InstructionType::U, CUALUOp::ADD, CUALUSrc::PC, CUALUSrc::IMM>() }, // 1
+    ISAEntryDescription{ "JAL",    ISAEntry::JAL,    Opcode::JAL,      InstructionType::J, 0b000, 0b0000000, 
+        BuildJump<InstructionType::J, false>() }, // 2
+    ISAEntryDescription{ "JALR",   ISAEntry::JALR,   Opcode::JALR,     InstructionType::I, 0b000, 0b0000000, 
+        BuildJump<InstructionType::I, true>() }, // 3
+    ISAEntryDescription{ "BEQ",    ISAEntry::BEQ,    Opcode::BRANCH,   InstructionType::B, 0b000, 0b0000000, 
+        BuildBranch<CUCmpOp::EQ>() }, // 4
+    ISAEntryDescription{ "BNE",    ISAEntry::BNE,    Opcode::BRANCH,   InstructionType::B, 0b001, 0b0000000, 
+        BuildBranch<CUCmpOp::NE>() }, // 5
+    ISAEntryDescription{ "BLT",    ISAEntry::BLT,    Opcode::BRANCH,   InstructionType::B, 0b100, 0b0000000, 
+        BuildBranch<CUCmpOp::LT>() }, // 6
+    ISAEntryDescription{ "BGE",    ISAEntry::BGE,    Opcode::BRANCH,   InstructionType::B, 0b101, 0b0000000, 
+        BuildBranch<CUCmpOp::GE>() }, // 7
+    ISAEntryDescription{ "BLTU",   ISAEntry::BLTU,   Opcode::BRANCH,   InstructionType::B, 0b110, 0b0000000, 
+        BuildBranch<CUCmpOp::LTU>() }, // 8
+    ISAEntryDescription{ "BGEU",   ISAEntry::BGEU,   Opcode::BRANCH,   InstructionType::B, 0b111, 0b0000000, 
+        BuildBranch<CUCmpOp::GEU>() }, // 9
+    ISAEntryDescription{ "LB",     ISAEntry::LB,     Opcode::LOAD,     InstructionType::I, 0b000, 0b0000000,
+        BuildLoad<CUMemOp::BYTE, true>()}, // 10
+    ISAEntryDescription{ "LH",     ISAEntry::LH,     Opcode::LOAD,     InstructionType::I, 0b001, 0b0000000,
+        BuildLoad<CUMemOp::HALF, true>()}, // 11
+    ISAEntryDescription{ "LW",     ISAEntry::LW,     Opcode::LOAD,     InstructionType::I, 0b010, 0b0000000, 
+        BuildLoad<CUMemOp::WORD, false>() }, // 12
+    ISAEntryDescription{ "LBU",    ISAEntry::LBU,    Opcode::LOAD,     InstructionType::I, 0b100, 0b0000000, 
+        BuildLoad<CUMemOp::BYTE, false>() }, // 13
+    ISAEntryDescription{ "LHU",    ISAEntry::LHU,    Opcode::LOAD,     InstructionType::I, 0b101, 0b0000000,
+        BuildLoad<CUMemOp::HALF, false>()}, // 14
+    ISAEntryDescription{ "SB",     ISAEntry::SB,     Opcode::STORE,    InstructionType::S, 0b000, 0b0000000,
+        BuildStore<CUMemOp::BYTE>() }, // 15
+    ISAEntryDescription{ "SH",     ISAEntry::SH,     Opcode::STORE,    InstructionType::S, 0b001, 0b0000000,
+        BuildStore<CUMemOp::HALF>() }, // 16
+    ISAEntryDescription{ "SW",     ISAEntry::SW,     Opcode::STORE,    InstructionType::S, 0b010, 0b0000000, 
+        BuildStore<CUMemOp::WORD>() }, // 17
+    ISAEntryDescription{ "ADDI",   ISAEntry::ADDI,   Opcode::OP_IMM,   InstructionType::I, 0b000, 0b0000000, 
+        BuildArithm<InstructionType::I, CUALUOp::ADD>() }, // 18
+    ISAEntryDescription{ "SLTI",   ISAEntry::SLTI,   Opcode::OP_IMM,   InstructionType::I, 0b010, 0b0000000,
+        BuildArithm<InstructionType::I, CUALUOp::SLT>() }, // 19
+    ISAEntryDescription{ "SLTIU",  ISAEntry::SLTIU,  Opcode::OP_IMM,   InstructionType::I, 0b011, 0b0000000, 
+        BuildArithm<InstructionType::I, CUALUOp::SLTU>() }, // 20
+    ISAEntryDescription{ "XORI",   ISAEntry::XORI,   Opcode::OP_IMM,   InstructionType::I, 0b100, 0b0000000, 
+        BuildArithm<InstructionType::I, CUALUOp::XOR>() }, // 21
+    ISAEntryDescription{ "ORI",    ISAEntry::ORI,    Opcode::OP_IMM,   InstructionType::I, 0b110, 0b0000000, 
+        BuildArithm<InstructionType::I, CUALUOp::OR>() }, // 22
+    ISAEntryDescription{ "ANDI",   ISAEntry::ANDI,   Opcode::OP_IMM,   InstructionType::I, 0b111, 0b0000000, 
+        BuildArithm<InstructionType::I, CUALUOp::AND>() }, // 23
+    ISAEntryDescription{ "SLLI",   ISAEntry::SLLI,   Opcode::OP_IMM,   InstructionType::I, 0b001, 0b0000000, 
+        BuildArithm<InstructionType::I, CUALUOp::SLL>() }, // 24
+    ISAEntryDescription{ "SRLI",   ISAEntry::SRLI,   Opcode::OP_IMM,   InstructionType::I, 0b101, 0b0000000, 
+        BuildArithm<InstructionType::I, CUALUOp::SRL>() }, // 25
+    ISAEntryDescription{ "SRAI",   ISAEntry::SRAI,   Opcode::OP_IMM,   InstructionType::I, 0b101, 0b0100000, 
+        BuildArithm<InstructionType::I, CUALUOp::SRA>() }, // 26
+    ISAEntryDescription{ "ADD",    ISAEntry::ADD,    Opcode::OP,       InstructionType::R, 0b000, 0b0000000, 
+        BuildArithm<InstructionType::R, CUALUOp::ADD>() }, // 27
+    ISAEntryDescription{ "SUB",    ISAEntry::SUB,    Opcode::OP,       InstructionType::R, 0b000, 0b0100000, 
+        BuildArithm<InstructionType::R, CUALUOp::SUB>() }, // 28
+    ISAEntryDescription{ "SLL",    ISAEntry::SLL,    Opcode::OP,       InstructionType::R, 0b001, 0b0000000, 
+        BuildArithm<InstructionType::R, CUALUOp::SLL>() }, // 29
+    ISAEntryDescription{ "SLT",    ISAEntry::SLT,    Opcode::OP,       InstructionType::R, 0b010, 0b0000000,
+        BuildArithm<InstructionType::R, CUALUOp::SLT>() }, // 30
+    ISAEntryDescription{ "SLTU",   ISAEntry::SLTU,   Opcode::OP,       InstructionType::R, 0b011, 0b0000000, 
+        BuildArithm<InstructionType::R, CUALUOp::SLTU>() }, // 31
+    ISAEntryDescription{ "XOR",    ISAEntry::XOR,    Opcode::OP,       InstructionType::R, 0b100, 0b0000000, 
+        BuildArithm<InstructionType::R, CUALUOp::XOR>() }, // 32
+    ISAEntryDescription{ "SRL",    ISAEntry::SRL,    Opcode::OP,       InstructionType::R, 0b101, 0b0000000, 
+        BuildArithm<InstructionType::R, CUALUOp::SRL>() }, // 33
+    ISAEntryDescription{ "SRA",    ISAEntry::SRA,    Opcode::OP,       InstructionType::R, 0b101, 0b0100000,
+        BuildArithm<InstructionType::R, CUALUOp::SRA>() }, // 34
+    ISAEntryDescription{ "OR",     ISAEntry::OR,     Opcode::OP,       InstructionType::R, 0b110, 0b0000000, 
+        BuildArithm<InstructionType::R, CUALUOp::OR>() }, // 35
+    ISAEntryDescription{ "AND",    ISAEntry::AND,    Opcode::OP,       InstructionType::R, 0b111, 0b0000000, 
+        BuildArithm<InstructionType::R, CUALUOp::AND>() }, // 36
+    ISAEntryDescription{ "FENCE",  ISAEntry::FENCE,  Opcode::MISC_MEM, InstructionType::I, 0b000, 0b0000000,
+        BuildFence() }, // 37
+    ISAEntryDescription{ "ECALL",  ISAEntry::ECALL,  Opcode::SYSTEM,   InstructionType::I, 0b000, 0b0000000,
+        BuildSystem<true, true>() }, // 38
+    ISAEntryDescription{ "EBREAK", ISAEntry::EBREAK, Opcode::SYSTEM, InstructionType::I, 0b000, 0b0000000,
+        BuildSystem<true>() }, // 39
+    ISAEntryDescription{ "UNKNOWN",ISAEntry::UNKNOWN,Opcode::UNKNOWN,  InstructionType::UNKNOWN_TYPE, 0, 0,
+        CUExecParams{ .isOpcodeOk = false }} // 40
+};
+
+constexpr bool IsISADescriptionIndexed()
+{
+    for (u32_t i = 0; i <= (u32_t)ISAEntry::UNKNOWN; ++i) {
+        if ((u32_t)isaDescription[i].isaEntry != i) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(IsISADescriptionIndexed(), "isaDescription must be indexed by ISAEntry");
+
+// Flat decode table, generated from isaDescription at compile time. It is
+// indexed by the bits that tell instructions apart: opcode, funct3, funct7[5]
+// (bit 30) and imm[0] (bit 20, ECALL vs EBREAK). Each entry holds the
+// ISAEntry in its low bits and, above them, a DecodeCheck naming the other
+// bits that must be zero for the word to decode to that entry.
+enum DecodeCheck : u8_t {
+    CHECK_NONE, CHECK_FUNCT7, CHECK_IMM,
+};
+
+inline constexpr u32_t DECODE_INDEX_BITS = 12;
+inline constexpr u32_t DECODE_CHECK_SHIFT = 6;
+inline constexpr u32_t decodeCheckMask[] = {
+    0x00000000, // CHECK_NONE
+    0xbe000000, // CHECK_FUNCT7: funct7 except bit 30
+    0xffe00000, // CHECK_IMM: imm[11:1]
+};
+static_assert((u32_t)ISAEntry::UNKNOWN < (1 << DECODE_CHECK_SHIFT));
+
+constexpr u32_t DecodeIndex(u32_t raw)
+{
+    return (raw & 0x7f) | ((raw >> 5) & 0x380) | ((raw >> 20) & 0x400) | ((raw >> 9) & 0x800);
+}
+
+// funct3 does not matter for the opcodes without one and is ignored for
+// JALR and FENCE; funct7 only tells ADD/SUB and the right shifts apart.
+constexpr u8_t BuildDecodeEntry(u32_t index)
+{
+    u32_t const opcode = index & 0x7f;
+    u32_t const funct3 = (index >> 7) & 0x7;
+    u32_t const bit30 = (index >> 10) & 1;
+    u32_t const bit20 = (index >> 11) & 1;
+
+    u8_t entry = (u8_t)ISAEntry::UNKNOWN;
+    for (auto const &desc : isaDescription) {
+        Opcode const op = desc.opcode;
+        bool const usesFunct3 = op != Opcode::LUI && op != Opcode::AUIPC && op != Opcode::JAL &&
+            op != Opcode::JALR && op != Opcode::MISC_MEM && op != Opcode::SYSTEM;
+        bool const usesFunct7 = (op == Opcode::OP && (desc.funct3 == 0b000 || desc.funct3 == 0b101)) ||
+            (op == Opcode::OP_IMM && desc.funct3 == 0b101);
+
+        if (desc.isaEntry == ISAEntry::UNKNOWN || (u32_t)op != opcode) {
+            continue;
+        }
+        if ((usesFunct3 && desc.funct3 != funct3) || (usesFunct7 && (u32_t)(desc.funct7 >> 5) != bit30)) {
+            continue;
+        }
+        if (op == Opcode::SYSTEM && (u32_t)(desc.isaEntry == ISAEntry::EBREAK) != bit20) {
+            continue;
+        }
+
+        if (entry != (u8_t)ISAEntry::UNKNOWN) {
+            throw "isaDescription entries overlap";
+        }
+        DecodeCheck const check = usesFunct7 ? CHECK_FUNCT7 : op == Opcode::SYSTEM ? CHECK_IMM : CHECK_NONE;
+        entry = (u8_t)desc.isaEntry | (u8_t)(check << DECODE_CHECK_SHIFT);
+    }
+    return entry;
+}
+
+struct DecodeTable final {
+public:
+    u8_t entries[1 << DECODE_INDEX_BITS] = {};
+
+    constexpr DecodeTable()
+    {
+        for (u32_t i = 0; i < std::size(entries); ++i) {
+            entries[i] = BuildDecodeEntry(i);
+        }
+    }
+};
+
+inline constexpr DecodeTable decodeTable = {};
+
+constexpr ISAEntry DecodeISAEntry(Instruction instr)
+{
+    u8_t const entry = decodeTable.entries[DecodeIndex(instr.raw)];
+    u32_t const isaEntry = entry & ((1 << DECODE_CHECK_SHIFT) - 1);
+    // Selects UNKNOWN without a branch if a checked bit is set.
+    u32_t const bad = -(u32_t)!!(instr.raw & decodeCheckMask[entry >> DECODE_CHECK_SHIFT]);
+    return (ISAEntry)(isaEntry ^ ((isaEntry ^ (u32_t)ISAEntry::UNKNOWN) & bad));
+}
+
+constexpr ISAEntryDescription const &UnpackISAEntryDescription(Instruction instr)
+{
+    return isaDescription[(u32_t)DecodeISAEntry(instr)];
+}
 
-ISAEntryDescription const &UnpackISAEntryDescription(Instruction instr);
+static_assert(DecodeISAEntry({ .raw = 0x40a58633 }) == ISAEntry::SUB);
+static_assert(DecodeISAEntry({ .raw = 0x00100073 }) == ISAEntry::EBREAK);
+static_assert(DecodeISAEntry({ .raw = 0x00200073 }) == ISAEntry::UNKNOWN);
+static_assert(DecodeISAEntry({ .raw = 0x00000072 }) == ISAEntry::UNKNOWN);
 
 } // namespace Sim
 
@@ -0,0 +1,399 @@
+#include "jit.h"
+#include "cpu.h"
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define SIM_JIT_X86_64 1
+#endif
+
+namespace Sim {
+
+Jit::Jit(Jit &&other)
+{
+    *this = std::move(other);
+}
+
+Jit &Jit::operator=(Jit &&other)
+{
+    std::swap(hotThreshold, other.hotThreshold);
+    std::swap(compiledBlocks, other.compiledBlocks);
+    std::swap(code, other.code);
+    std::swap(codeSize, other.codeSize);
+    return *this;
+}
+
+#ifdef SIM_JIT_X86_64
+
+enum class StoreResult : u32_t {
+    OK, TRAPPED, EXIT
+};
+
+// Faults trap here rather than leaving the access to the interpreter, which
+// would perform it a second time.
+static u64_t JitLoad(CPU *cpu, u32_t a, u32_t kind, u32_t pc)
+{
+    CUExecParams params = {};
+    params.memOp = (CUMemOp)(kind & 0xff);
+    params.memSignExt = kind >> 8;
+
+    u32_t data = 0;
+    if (auto ex = cpu->memoryStage.LoadOperator(*cpu, params, a, &data); ex != HUExceptionType::NONE) {
+        cpu->huModule.TakeTrap(*cpu, ex, pc);
+        return Jit::TRAPPED | pc;
+    }
+    return data;
+}
+
+static u32_t JitStore(CPU *cpu, u32_t a, u32_t data, u32_t memOp, u32_t pc)
+{
+    u64_t gen = cpu->blockCache.Generation();
+    if (auto ex = cpu->mmu.Store(*cpu, a, data, (CUMemOp)memOp); ex != HUExceptionType::NONE) {
+        cpu->huModule.TakeTrap(*cpu, ex, pc);
+        return (u32_t)StoreResult::TRAPPED;
+    }
+    if (cpu->shutdown || gen != cpu->blockCache.Generation()) {
+        return (u32_t)StoreResult::EXIT;
+    }
+    return (u32_t)StoreResult::OK;
+}
+
+// Register assignment: rbx holds the guest regfile, r12 the CPU, eax/ecx/edx
+// are scratch.
+struct X86Emitter final {
+public:
+    std::vector<u8_t> buf = {};
+    u32_t blockPc = 0;
+    // Offset of CPU::cycles from r12, and the instructions already added to it.
+    u32_t cyclesDisp = 0;
+    u32_t charged = 0;
+
+    void Byte(u8_t b)
+    {
+        buf.push_back(b);
+    }
+
+    void Bytes(std::initializer_list<u8_t> bs)
+    {
+        buf.insert(buf.end(), bs);
+    }
+
+    void Imm32(u32_t v)
+    {
+        for (u32_t i = 0; i < 4; ++i) {
+            Byte((v >> (8 * i)) & 0xff);
+        }
+    }
+
+    void Imm64(u64_t v)
+    {
+        Imm32((u32_t)v);
+        Imm32((u32_t)(v >> 32));
+    }
+
+    // mov r32, [rbx + 4 * reg]; r is 0 (eax) or 1 (ecx)
+    void LoadGpr(u8_t r, u8_t reg)
+    {
+        Bytes({ 0x8b, (u8_t)(0x83 | (r << 3)) });
+        Imm32(reg * sizeof(u32_t));
+    }
+
+    // mov [rbx + 4 * reg], eax
+    void StoreGpr(u8_t reg)
+    {
+        if (reg == 0) {
+            return;
+        }
+        Bytes({ 0x89, 0x83 });
+        Imm32(reg * sizeof(u32_t));
+    }
+
+    // mov dword [rbx + 4 * reg], imm32
+    void StoreGprImm(u8_t reg, u32_t v)
+    {
+        if (reg == 0) {
+            return;
+        }
+        Bytes({ 0xc7, 0x83 });
+        Imm32(reg * sizeof(u32_t));
+        Imm32(v);
+    }
+
+    // mov r32, imm32; r is 0 (eax), 1 (ecx) or 2 (edx)
+    void MovImm(u8_t r, u32_t v)
+    {
+        Byte(0xb8 + r);
+        Imm32(v);
+    }
+
+    void Prologue()
+    {
+        Bytes({ 0x53 });                   // push rbx
+        Bytes({ 0x41, 0x54 });             // push r12
+        Bytes({ 0x48, 0x83, 0xec, 0x08 }); // sub rsp, 8
+        Bytes({ 0x48, 0x89, 0xfb });       // mov rbx, rdi
+        Bytes({ 0x49, 0x89, 0xf4 });       // mov r12, rsi
+    }
+
+    void Epilogue()
+    {
+        Bytes({ 0x48, 0x83, 0xc4, 0x08 }); // add rsp, 8
+        Bytes({ 0x41, 0x5c });             // pop r12
+        Bytes({ 0x5b });                   // pop rbx
+        Bytes({ 0xc3 });                   // ret
+    }
+
+    void Exit(u32_t pc)
+    {
+        MovImm(0, pc);
+        Epilogue();
+    }
+
+    void ExitInterpret(u32_t pc)
+    {
+        Bytes({ 0x48, 0xb8 }); // mov rax, imm64
+        Imm64(Jit::INTERPRET | pc);
+        Epilogue();
+    }
+
+    void ExitTrapped(u32_t pc)
+    {
+        Bytes({ 0x48, 0xb8 }); // mov rax, imm64
+        Imm64(Jit::TRAPPED | pc);
+        Epilogue();
+    }
+
+    // Counts the cycles up to and including the instruction at pc, which is
+    // about to reach a device that may read them. Run() sets the final count.
+    void ChargeCycles(u32_t pc)
+    {
+        u32_t count = (pc - blockPc) / sizeof(u32_t) + 1;
+        Bytes({ 0x49, 0x81, 0x84, 0x24 }); // add qword [r12 + disp32], imm32
+        Imm32(cyclesDisp);
+        Imm32(count - charged);
+        charged = count;
+    }
+
+    void Call(void const *fn)
+    {
+        Bytes({ 0x4c, 0x89, 0xe7 }); // mov rdi, r12
+        Bytes({ 0x48, 0xb8 });       // mov rax, imm64
+        Imm64((u64_t)fn);
+        Bytes({ 0xff, 0xd0 });       // call rax
+    }
+
+    // Short forward jump with a patched displacement.
+    u32_t Jcc8(u8_t opcode)
+    {
+        Bytes({ opcode, 0 });
+        return std::size(buf);
+    }
+
+    void Bind8(u32_t at)
+    {
+        u32_t disp = std::size(buf) - at;
+        assert(disp < 128 && "Short jump out of range");
+        buf[at - 1] = (u8_t)disp;
+    }
+
+    // eax = eax <op> ecx
+    void ALU(CUALUOp op)
+    {
+        switch (op) {
+            case CUALUOp::ADD:  Bytes({ 0x01, 0xc8 }); break;
+            case CUALUOp::SUB:  Bytes({ 0x29, 0xc8 }); break;
+            case CUALUOp::SLL:  Bytes({ 0xd3, 0xe0 }); break;
+            case CUALUOp::SLT:  Bytes({ 0x39, 0xc8, 0x0f, 0x9c, 0xc0, 0x0f, 0xb6, 0xc0 }); break;
+            case CUALUOp::SLTU: Bytes({ 0x39, 0xc8, 0x0f, 0x92, 0xc0, 0x0f, 0xb6, 0xc0 }); break;
+            case CUALUOp::XOR:  Bytes({ 0x31, 0xc8 }); break;
+            case CUALUOp::SRL:  Bytes({ 0xd3, 0xe8 }); break;
+            case CUALUOp::SRA:  Bytes({ 0xd3, 0xf8 }); break;
+            case CUALUOp::OR:   Bytes({ 0x09, 0xc8 }); break;
+            case CUALUOp::AND:  Bytes({ 0x21, 0xc8 }); break;
+            case CUALUOp::PASS_SRC2: Bytes({ 0x89, 0xc8 }); break;
+            default: assert(!"Unexpected ALU operation");
+        }
+    }
+
+    // cmovcc eax, edx after cmp eax, ecx
+    void CMov(CUCmpOp op)
+    {
+        u8_t cc = 0;
+        switch (op) {
+            case CUCmpOp::EQ:  cc = 0x44; break;
+            case CUCmpOp::NE:  cc = 0x45; break;
+            case CUCmpOp::LT:  cc = 0x4c; break;
+            case CUCmpOp::GE:  cc = 0x4d; break;
+            case CUCmpOp::LTU: cc = 0x42; break;
+            case CUCmpOp::GEU: cc = 0x43; break;
+            default: assert(!"Unexpected CMP operation");
+        }
+        Bytes({ 0x0f, cc, 0xc2 });
+    }
+
+    // Returns false once the instruction has ended the block.
+    bool Instruction(DecodedInstruction const &op, u32_t pc)
+    {
+        CUExecParams const &params = op.execParams;
+        if (!params.isOpcodeOk || params.intpt) {
+            ExitInterpret(pc);
+            return false;
+        }
+        if (params.isFence) {
+            Bytes({ 0x0f, 0xae, 0xf0 }); // mfence
+            return true;
+        }
+
+        LoadGpr(0, op.rs1a);
+        LoadGpr(1, op.rs2a);
+
+        if (params.isJump) {
+            if (params.isJumpReg) {
+                Bytes({ 0x89, 0xc2 }); // mov edx, eax
+                Bytes({ 0x81, 0xe2 }); // and edx, ~1
+                Imm32(~(u32_t)1);
+            } else {
+                MovImm(2, pc);
+            }
+            Bytes({ 0x81, 0xc2 }); // add edx, imm
+            Imm32(op.immExt);
+            if (params.regWrite) {
+                StoreGprImm(op.rda, pc + sizeof(u32_t));
+            }
+            Bytes({ 0x89, 0xd0 }); // mov eax, edx
+            Epilogue();
+            return false;
+        }
+
+        if (params.aluSrc1 == CUALUSrc::PC) {
+            MovImm(0, pc);
+        }
+        if (params.memWrite) {
+            Bytes({ 0x89, 0xca }); // mov edx, ecx
+        }
+        if (params.aluSrc2 == CUALUSrc::IMM) {
+            MovImm(1, op.immExt);
+        }
+
+        if (params.isBranch) {
+            Bytes({ 0x39, 0xc8 }); // cmp eax, ecx
+            MovImm(0, pc + sizeof(u32_t));
+            MovImm(2, pc + op.immExt);
+            CMov(params.cmpOp);
+            Epilogue();
+            return false;
+        }
+
+        ALU(params.aluOp);
+
+        if (params.resSrc == CUResSrc::MEM) {
+            Bytes({ 0x89, 0xc6 }); // mov esi, eax
+            MovImm(2, (u32_t)params.memOp | ((u32_t)params.memSignExt << 8));
+            MovImm(1, pc);
+            ChargeCycles(pc);
+            Call((void const *)&JitLoad);
+            Bytes({ 0x48, 0x0f, 0xba, 0xe0, 0x21 }); // bt rax, 33
+            u32_t ok = Jcc8(0x73);                     // jnc
+            Epilogue();                                // rax is TRAPPED | pc
+            Bind8(ok);
+        }
+
+        if (params.memWrite) {
+            Bytes({ 0x89, 0xc6 }); // mov esi, eax
+            MovImm(1, (u32_t)params.memOp);
+            Bytes({ 0x41, 0xb8 }); // mov r8d, imm32
+            Imm32(pc);
+            ChargeCycles(pc);
+            Call((void const *)&JitStore);
+            Bytes({ 0x85, 0xc0 });                     // test eax, eax
+            u32_t ok = Jcc8(0x74);                     // jz
+            Bytes({ 0x83, 0xf8, (u8_t)StoreResult::TRAPPED }); // cmp eax, TRAPPED
+            u32_t exit = Jcc8(0x75);                   // jne
+            ExitTrapped(pc);
+            Bind8(exit);
+            Exit(pc + sizeof(u32_t));
+            Bind8(ok);
+        }
+
+        if (params.regWrite) {
+            StoreGpr(op.rda);
+        }
+        return true;
+    }
+};
+
+Jit::~Jit()
+{
+    if (code) {
+        munmap(code, CODE_BUFFER_SIZE);
+    }
+}
+
+bool Jit::Compile(CPU &cpu, BasicBlock &block)
+{
+    X86Emitter emitter = {};
+    emitter.blockPc = block.pc;
+    emitter.cyclesDisp = (u8_t *)&cpu.cycles - (u8_t *)&cpu;
+    emitter.Prologue();
+
+    u32_t pc = block.pc;
+    bool open = true;
+    for (auto const &op : block.ops) {
+        open = emitter.Instruction(op, pc);
+        if (!open) {
+            break;
+        }
+        pc += sizeof(u32_t);
+    }
+    if (open) {
+        emitter.Exit(block.endPc);
+    }
+
+    u32_t size = (std::size(emitter.buf) + 15) & ~(u32_t)15;
+    if (size > CODE_BUFFER_SIZE) {
+        return false;
+    }
+
+    if (!code) {
+        void *p = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        code = (u8_t *)p;
+    }
+    if (codeSize + size > CODE_BUFFER_SIZE) {
+        cpu.blockCache.DropNativeCode();
+        codeSize = 0;
+    }
+
+    if (mprotect(code, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    std::memcpy(code + codeSize, emitter.buf.data(), std::size(emitter.buf));
+    if (mprotect(code, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        return false;
+    }
+
+    block.native = (JitCode)(code + codeSize);
+    codeSize += size;
+    ++compiledBlocks;
+    return true;
+}
+
+#else
+
+Jit::~Jit()
+{}
+
+bool Jit::Compile(CPU &cpu, BasicBlock &block)
+{
+    return false;
+}
+
+#endif // SIM_JIT_X86_64
+
+} // namespace Sim
@@ -0,0 +1,45 @@
+#ifndef SIM_JIT_H
+#define SIM_JIT_H
+
+#include <types.h>
+
+namespace Sim {
+
+struct BasicBlock;
+
+// Host code for a translated block. Returns the next guest pc; Jit::INTERPRET
+// is set when the instruction at that pc has to be executed by the
+// interpreter (system instructions, bad opcodes), Jit::TRAPPED when its memory
+// access faulted and the trap has been taken.
+using JitCode = u64_t (*)(u32_t *gpr, CPU *cpu);
+
+// x86-64 backend for hot basic blocks. Guest registers stay in the regfile
+// and memory accesses call back into the MMU, so everything that needs exact
+// architectural behaviour is left to the interpreter. On other hosts Compile
+// always fails and blocks keep running through the block cache.
+struct Jit final {
+public:
+    static constexpr u32_t CODE_BUFFER_SIZE = 16 << 20;
+    static constexpr u64_t INTERPRET = (u64_t)1 << 32;
+    static constexpr u64_t TRAPPED = (u64_t)1 << 33;
+
+    u32_t hotThreshold = 16;
+    u64_t compiledBlocks = 0;
+
+    Jit() = default;
+    Jit(Jit const &) = delete;
+    Jit &operator=(Jit const &) = delete;
+    Jit(Jit &&other);
+    Jit &operator=(Jit &&other);
+    ~Jit();
+
+    bool Compile(CPU &cpu, BasicBlock &block);
+
+private:
+    u8_t *code = nullptr;
+    u32_t codeSize = 0;
+};
+
+} // namespace Sim
+
+#endif // SIM_JIT_H
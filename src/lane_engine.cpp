@@ -0,0 +1,488 @@
+#include "lane_engine.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIM_LANE_ENGINE_X86 1
+#endif
+
+namespace Sim {
+
+namespace {
+
+// The instruction at pc, the same for every lane there.
+struct LaneOp final {
+    CUExecParams params = {};
+    u32_t pc = 0;
+    u32_t imm = 0;
+    u8_t rs1 = 0;
+    u8_t rs2 = 0;
+    u8_t rd = 0;
+};
+
+struct LaneSelection final {
+    u64_t active = 0;
+    u32_t pc = 0;
+    u32_t liveCount = 0;
+    u32_t activeCount = 0;
+    // Instructions until the first live lane runs out of budget.
+    u32_t left = 0;
+};
+
+// The kernels are written once over GCC vector types of N lanes and always
+// inlined into per-path wrappers, which compile them for that instruction set.
+// Spelled out per width: vector_size is not applied to dependent types. No
+// helper takes or returns a vector by value, which would depend on the
+// instruction set of the caller (-Wpsabi); they work on references into the
+// rows, which are aligned for the widest vector, or write through one.
+template<u32_t N>
+struct LaneVector;
+
+template<>
+struct LaneVector<1> final {
+    typedef u32_t U __attribute__((vector_size(4)));
+    typedef i32_t S __attribute__((vector_size(4)));
+};
+
+template<>
+struct LaneVector<8> final {
+    typedef u32_t U __attribute__((vector_size(32)));
+    typedef i32_t S __attribute__((vector_size(32)));
+};
+
+template<>
+struct LaneVector<16> final {
+    typedef u32_t U __attribute__((vector_size(64)));
+    typedef i32_t S __attribute__((vector_size(64)));
+};
+
+// Lanes i to i + N - 1 of a row.
+template<typename U>
+[[gnu::always_inline]] inline U &Row(u32_t *row, u32_t i)
+{
+    return *reinterpret_cast<U *>(row + i);
+}
+
+template<typename U, typename S>
+[[gnu::always_inline]] inline void ALUOperator(CUALUOp op, U const &rs1v, U const &rs2v, U *res)
+{
+    switch (op) {
+        case CUALUOp::ADD:
+            *res = rs1v + rs2v;
+            break;
+        case CUALUOp::SUB:
+            *res = rs1v - rs2v;
+            break;
+        case CUALUOp::SLL:
+            *res = rs1v << (rs2v & 31);
+            break;
+        case CUALUOp::SLT:
+            *res = (U)((S)rs1v < (S)rs2v) & 1;
+            break;
+        case CUALUOp::SLTU:
+            *res = (U)(rs1v < rs2v) & 1;
+            break;
+        case CUALUOp::XOR:
+            *res = rs1v ^ rs2v;
+            break;
+        case CUALUOp::SRL:
+            *res = rs1v >> (rs2v & 31);
+            break;
+        case CUALUOp::SRA:
+            *res = (U)((S)rs1v >> (S)(rs2v & 31));
+            break;
+        case CUALUOp::OR:
+            *res = rs1v | rs2v;
+            break;
+        case CUALUOp::AND:
+            *res = rs1v & rs2v;
+            break;
+        case CUALUOp::PASS_SRC2:
+            *res = rs2v;
+            break;
+        default: assert(!"Unexpected ALU operation");
+    };
+}
+
+// All ones where the comparison holds.
+template<typename U, typename S>
+[[gnu::always_inline]] inline void CMPOperator(CUCmpOp op, U const &rs1v, U const &rs2v, U *res)
+{
+    switch (op) {
+        case CUCmpOp::EQ:
+            *res = (U)(rs1v == rs2v);
+            break;
+        case CUCmpOp::NE:
+            *res = (U)(rs1v != rs2v);
+            break;
+        case CUCmpOp::LT:
+            *res = (U)((S)rs1v < (S)rs2v);
+            break;
+        case CUCmpOp::GE:
+            *res = (U)((S)rs1v >= (S)rs2v);
+            break;
+        case CUCmpOp::LTU:
+            *res = (U)(rs1v < rs2v);
+            break;
+        case CUCmpOp::GEU:
+            *res = (U)(rs1v >= rs2v);
+            break;
+        default: assert(!"Unexpected CMP operation");
+    };
+}
+
+// Interpreter::ExecuteInstruction for the active lanes, except that loads
+// leave rd alone: the caller performs them with the addresses left in addr.
+template<u32_t N>
+[[gnu::always_inline]] inline void ExecuteRows(LaneRows &r, LaneOp const &op, u32_t width)
+{
+    using U = typename LaneVector<N>::U;
+    using S = typename LaneVector<N>::S;
+    CUExecParams const &params = op.params;
+    U const pc = U{} + op.pc;
+    U const imm = U{} + op.imm;
+    U const pcNext = pc + 4;
+    bool const writeRd = params.regWrite && op.rd && params.resSrc != CUResSrc::MEM;
+
+    for (u32_t i = 0; i < width; i += N) {
+        U const active = Row<U>(r.active, i);
+        U const a = Row<U>(r.gpr[op.rs1], i);
+        U const b = Row<U>(r.gpr[op.rs2], i);
+        U const sv1 = params.aluSrc1 == CUALUSrc::PC ? pc : a;
+        U const sv2 = params.aluSrc2 == CUALUSrc::IMM ? imm : b;
+
+        U aluRes = {};
+        ALUOperator<U, S>(params.aluOp, sv1, sv2, &aluRes);
+        U pcR = U{} - (u32_t)params.isJump;
+        if (params.isBranch) {
+            CMPOperator<U, S>(params.cmpOp, sv1, sv2, &pcR);
+        }
+        U const jumpBase = params.isJumpReg ? (a & ~(u32_t)1) : pc;
+        U const next = pcR ? jumpBase + imm : pcNext;
+
+        U &pcRow = Row<U>(r.pc, i);
+        pcRow = active ? next : pcRow;
+        Row<U>(r.addr, i) = aluRes;
+        if (writeRd) {
+            U const regWdata = params.resSrc == CUResSrc::PC ? pcNext : aluRes;
+            U &rdRow = Row<U>(r.gpr[op.rd], i);
+            rdRow = active ? regWdata : rdRow;
+        }
+        Row<U>(r.retired, i) -= active;
+    }
+}
+
+// Drops the lanes out of budget and activates the live lanes at the lowest pc.
+template<u32_t N>
+[[gnu::always_inline]] inline LaneSelection SelectRows(LaneRows &r, u32_t width, u32_t budget)
+{
+    using U = typename LaneVector<N>::U;
+    U const budgetV = U{} + budget;
+    U minPc = ~U{};
+    U minLeft = ~U{};
+
+    for (u32_t i = 0; i < width; i += N) {
+        U const retired = Row<U>(r.retired, i);
+        U &lanes = Row<U>(r.live, i);
+        lanes &= (U)(retired < budgetV);
+        U const pc = lanes ? Row<U>(r.pc, i) : ~U{};
+        U const left = lanes ? budgetV - retired : ~U{};
+        minPc = pc < minPc ? pc : minPc;
+        minLeft = left < minLeft ? left : minLeft;
+    }
+
+    LaneSelection sel = { .pc = minPc[0], .left = minLeft[0] };
+    for (u32_t j = 1; j < N; ++j) {
+        sel.pc = std::min<u32_t>(sel.pc, minPc[j]);
+        sel.left = std::min<u32_t>(sel.left, minLeft[j]);
+    }
+
+    u64_t live = 0;
+    for (u32_t i = 0; i < width; i += N) {
+        U const lanes = Row<U>(r.live, i);
+        U const active = lanes & (U)(Row<U>(r.pc, i) == sel.pc);
+        Row<U>(r.active, i) = active;
+        for (u32_t j = 0; j < N; ++j) {
+            live |= (u64_t)(lanes[j] & 1) << (i + j);
+            sel.active |= (u64_t)(active[j] & 1) << (i + j);
+        }
+    }
+    sel.liveCount = std::popcount(live);
+    sel.activeCount = std::popcount(sel.active);
+    return sel;
+}
+
+struct LaneKernels final {
+    void (*execute)(LaneRows &r, LaneOp const &op, u32_t width) = nullptr;
+    LaneSelection (*select)(LaneRows &r, u32_t width, u32_t budget) = nullptr;
+};
+
+void ExecuteScalar(LaneRows &r, LaneOp const &op, u32_t width)
+{
+    ExecuteRows<1>(r, op, width);
+}
+
+LaneSelection SelectScalar(LaneRows &r, u32_t width, u32_t budget)
+{
+    return SelectRows<1>(r, width, budget);
+}
+
+#ifdef SIM_LANE_ENGINE_X86
+
+__attribute__((target("avx2"))) void ExecuteAVX2(LaneRows &r, LaneOp const &op, u32_t width)
+{
+    ExecuteRows<8>(r, op, width);
+}
+
+__attribute__((target("avx2"))) LaneSelection SelectAVX2(LaneRows &r, u32_t width, u32_t budget)
+{
+    return SelectRows<8>(r, width, budget);
+}
+
+__attribute__((target("avx512f"))) void ExecuteAVX512(LaneRows &r, LaneOp const &op, u32_t width)
+{
+    ExecuteRows<16>(r, op, width);
+}
+
+__attribute__((target("avx512f"))) LaneSelection SelectAVX512(LaneRows &r, u32_t width, u32_t budget)
+{
+    return SelectRows<16>(r, width, budget);
+}
+
+#endif // SIM_LANE_ENGINE_X86
+
+LaneKernels Kernels(LaneEngine::Path path)
+{
+#ifdef SIM_LANE_ENGINE_X86
+    if (path == LaneEngine::Path::AVX512) {
+        return { &ExecuteAVX512, &SelectAVX512 };
+    }
+    if (path == LaneEngine::Path::AVX2) {
+        return { &ExecuteAVX2, &SelectAVX2 };
+    }
+#endif
+    return { &ExecuteScalar, &SelectScalar };
+}
+
+
+} // namespace
+
+LaneEngine::Path LaneEngine::Best()
+{
+#ifdef SIM_LANE_ENGINE_X86
+    if (__builtin_cpu_supports("avx512f")) {
+        return Path::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return Path::AVX2;
+    }
+#endif
+    return Path::SCALAR;
+}
+
+LaneEngine::LaneEngine(void const *image, u32_t imageSize, u32_t lanes)
+{
+    assert(lanes && lanes <= MAX_LANES && "Invalid lane count");
+
+    for (u32_t i = 0; i < lanes; ++i) {
+        envs.push_back(std::make_unique<CPUEnv>(image, imageSize));
+        envs.back()->mode = ExecMode::FUNCTIONAL;
+    }
+    // A whole number of the widest vectors.
+    width = (lanes + 15) & ~(u32_t)15;
+}
+
+void LaneEngine::Run(u32_t pc, u64_t maxCycles)
+{
+    LaneRows &r = *rows;
+    LaneKernels const kernels = Kernels(path);
+
+    for (u32_t l = 0; l < width; ++l) {
+        bool const running = l < Lanes() && !envs[l]->cpu.shutdown;
+        for (u32_t i = 0; i < 32; ++i) {
+            r.gpr[i][l] = running ? envs[l]->cpu.decodeStage.regfile.gpr[i] : 0;
+        }
+        r.pc[l] = pc;
+        r.live[l] = running ? ~(u32_t)0 : 0;
+        r.retired[l] = 0;
+        base[l] = l < Lanes() ? envs[l]->cpu.cycles : 0;
+    }
+
+    // Every lane still running at the end of a round has used all of it.
+    u32_t budget = (u32_t)std::min<u64_t>(maxCycles, ~(u32_t)0);
+    u64_t left = maxCycles - budget;
+
+    LaneSelection sel = {};
+    bool select = true;
+    bool fallback = false;
+    u32_t windowSteps = 0;
+    u64_t windowActive = 0;
+    u64_t windowLive = 0;
+
+    while (true) {
+        if (select) {
+            sel = kernels.select(r, width, budget);
+            if (!sel.liveCount) {
+                if (!left || !NextRound()) {
+                    break;
+                }
+                budget = (u32_t)std::min<u64_t>(left, ~(u32_t)0);
+                left -= budget;
+                continue;
+            }
+        }
+
+        windowActive += sel.activeCount;
+        windowLive += sel.liveCount;
+        if (++windowSteps == OCCUPANCY_WINDOW) {
+            if (windowActive * 100 < windowLive * minOccupancy) {
+                fallback = true;
+                break;
+            }
+            windowSteps = 0;
+            windowActive = 0;
+            windowLive = 0;
+        }
+        ++steps;
+
+        u32_t const leader = std::countr_zero(sel.active);
+        CPU &lead = envs[leader]->cpu;
+        DecodedInstruction const *decoded = nullptr;
+        if (lead.decodeCache.Fetch(lead, sel.pc, &decoded) != HUExceptionType::NONE ||
+            !decoded->execParams.isOpcodeOk || decoded->execParams.isECall || decoded->execParams.intpt) {
+            for (u64_t m = sel.active; m; m &= m - 1) {
+                StepLane(std::countr_zero(m));
+            }
+            select = true;
+            continue;
+        }
+
+        CUExecParams const &params = decoded->execParams;
+        LaneOp const op = {
+            .params = params,
+            .pc = sel.pc,
+            .imm = decoded->immExt,
+            .rs1 = decoded->rs1a,
+            .rs2 = decoded->rs2a,
+            .rd = decoded->rda,
+        };
+        kernels.execute(r, op, width);
+        vectorRetired += sel.activeCount;
+
+        // Memory goes lane by lane through each lane's MMU, devices included.
+        bool event = false;
+        if (params.resSrc == CUResSrc::MEM || params.memWrite) {
+            for (u64_t m = sel.active; m; m &= m - 1) {
+                u32_t const l = std::countr_zero(m);
+                CPU &cpu = envs[l]->cpu;
+                cpu.cycles = base[l] + r.retired[l];
+                HUExceptionType ex = HUExceptionType::NONE;
+                if (params.memWrite) {
+                    ex = cpu.mmu.Store(cpu, r.addr[l], r.gpr[op.rs2][l], params.memOp);
+                } else if (u32_t data = 0; (ex = cpu.memoryStage.LoadOperator(cpu, params, r.addr[l], &data)) ==
+                    HUExceptionType::NONE && params.regWrite && op.rd) {
+                    r.gpr[op.rd][l] = data;
+                }
+
+                if (ex != HUExceptionType::NONE) {
+                    cpu.huModule.TakeTrap(cpu, ex, sel.pc);
+                    r.pc[l] = cpu.fetchStage.state.read.pc;
+                    event = true;
+                }
+                if (cpu.shutdown) {
+                    r.live[l] = 0;
+                    event = true;
+                }
+            }
+        }
+
+        // Lanes stay together, and need no selection, until some wait or
+        // might branch apart.
+        select = event || params.isBranch || params.isJumpReg || sel.activeCount != sel.liveCount ||
+            --sel.left == 0;
+        sel.pc = r.pc[leader];
+    }
+
+    Sync();
+    if (fallback) {
+        Fallback(budget + left);
+    }
+    for (auto &env : envs) {
+        env->cpu.hostCalls.Flush(env->cpu);
+    }
+}
+
+void LaneEngine::StepLane(u32_t lane)
+{
+    LaneRows &r = *rows;
+    CPU &cpu = envs[lane]->cpu;
+    u32_t *gpr = cpu.decodeStage.regfile.gpr;
+
+    for (u32_t i = 0; i < 32; ++i) {
+        gpr[i] = r.gpr[i][lane];
+    }
+    cpu.fetchStage.state.read.pc = r.pc[lane];
+    cpu.cycles = base[lane] + r.retired[lane];
+    envs[lane]->interpreter.Step(cpu);
+
+    for (u32_t i = 0; i < 32; ++i) {
+        r.gpr[i][lane] = gpr[i];
+    }
+    r.pc[lane] = cpu.fetchStage.state.read.pc;
+    ++r.retired[lane];
+    ++scalarRetired;
+    if (cpu.shutdown) {
+        r.live[lane] = 0;
+    }
+}
+
+bool LaneEngine::NextRound()
+{
+    LaneRows &r = *rows;
+    bool running = false;
+
+    for (u32_t l = 0; l < Lanes(); ++l) {
+        base[l] += r.retired[l];
+        r.retired[l] = 0;
+        r.live[l] = envs[l]->cpu.shutdown ? 0 : ~(u32_t)0;
+        running |= r.live[l] != 0;
+    }
+    return running;
+}
+
+void LaneEngine::Sync()
+{
+    LaneRows const &r = *rows;
+    for (u32_t l = 0; l < Lanes(); ++l) {
+        CPU &cpu = envs[l]->cpu;
+        for (u32_t i = 0; i < 32; ++i) {
+            cpu.decodeStage.regfile.gpr[i] = r.gpr[i][l];
+        }
+        cpu.fetchStage.state.read.pc = r.pc[l];
+        cpu.cycles = base[l] + r.retired[l];
+    }
+}
+
+void LaneEngine::Fallback(u64_t maxCycles)
+{
+    LaneRows const &r = *rows;
+    fellBack = true;
+
+    for (u32_t l = 0; l < Lanes(); ++l) {
+        if (!r.live[l]) {
+            continue;
+        }
+        CPU &cpu = envs[l]->cpu;
+        u64_t const start = cpu.cycles;
+        u64_t const rest = maxCycles - r.retired[l];
+        u64_t const limit = rest > ~start ? ~(u64_t)0 : start + rest;
+        while (!cpu.shutdown && cpu.cycles < limit) {
+            envs[l]->interpreter.Execute(cpu, limit - cpu.cycles);
+        }
+        scalarRetired += cpu.cycles - start;
+    }
+}
+
+} // namespace Sim
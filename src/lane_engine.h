@@ -0,0 +1,103 @@
+#ifndef SIM_LANE_ENGINE_H
+#define SIM_LANE_ENGINE_H
+
+#include <types.h>
+#include <cpu_env.h>
+#include <memory>
+#include <vector>
+
+namespace Sim {
+
+// Registers of every lane in structure-of-arrays layout, one row of
+// MAX_LANES words per register, plus the per-lane pc and masks (~0 or 0).
+struct alignas(64) LaneRows final {
+public:
+    static constexpr u32_t MAX_LANES = 64;
+
+    u32_t gpr[32][MAX_LANES] = {};
+    u32_t pc[MAX_LANES] = {};
+    // Lanes still running, and those at the pc being executed.
+    u32_t live[MAX_LANES] = {};
+    u32_t active[MAX_LANES] = {};
+    // ALU result of the last instruction: the address of loads and stores.
+    u32_t addr[MAX_LANES] = {};
+    u32_t retired[MAX_LANES] = {};
+};
+
+// Runs the same program on many inputs with the lanes' registers side by
+// side, executing each instruction once for all lanes at the same pc through
+// ALU and branch kernels that mirror ExecuteStage::ALUOperator/CMPOperator.
+// Lanes that branch apart wait while the lanes at the lowest pc run, which
+// makes them meet again after forward branches and loop exits. Loads, stores
+// and the instructions the kernels leave out (ECALL, EBREAK, bad opcodes,
+// faulting fetches) run lane by lane against each lane's own CPUEnv, which
+// also holds its memory, devices and state between runs. Once fewer than
+// minOccupancy percent of the running lanes share a pc over OCCUPANCY_WINDOW
+// steps, the rest of the run goes through each lane's interpreter instead.
+//
+// Instructions are fetched once per step, from the first lane at the pc, so
+// lanes must not modify code the others run. Cycles count one per instruction
+// as in ExecMode::FUNCTIONAL, and runs longer than 2^32 instructions are
+// split into rounds that the rows can count; profilers, tracers and checkers attached to a
+// lane are not told about the instructions the kernels retire.
+struct LaneEngine final {
+public:
+    static constexpr u32_t MAX_LANES = LaneRows::MAX_LANES;
+    static constexpr u32_t OCCUPANCY_WINDOW = 1024;
+
+    enum class Path : u8_t {
+        SCALAR, AVX2, AVX512,
+    };
+
+    // The widest path the host supports.
+    static Path Best();
+
+    // May be lowered to compare paths, never raised above Best().
+    Path path = Best();
+    u32_t minOccupancy = 25;
+
+    u64_t steps = 0;
+    // Lane instructions retired by the kernels, and one by one.
+    u64_t vectorRetired = 0;
+    u64_t scalarRetired = 0;
+    bool fellBack = false;
+
+    // Every lane starts from a copy of the image, as CPUEnv would load it.
+    LaneEngine(void const *image, u32_t imageSize, u32_t lanes);
+
+    u32_t Lanes() const
+    {
+        return std::size(envs);
+    }
+
+    CPUEnv &Lane(u32_t i)
+    {
+        return *envs[i];
+    }
+
+    // Runs every lane from pc until it shuts down or has run maxCycles
+    // instructions.
+    void Run(u32_t pc, u64_t maxCycles = ~(u64_t)0);
+
+private:
+    std::vector<std::unique_ptr<CPUEnv>> envs = {};
+    std::unique_ptr<LaneRows> rows = std::make_unique<LaneRows>();
+    u32_t width = 0;
+    // Each lane's cycles before the instructions counted in retired. A lane's
+    // CPU is brought up to date before anything it runs can read the Timer.
+    u64_t base[MAX_LANES] = {};
+
+    void StepLane(u32_t lane);
+    // Folds retired into base and revives the lanes that ran out of a round's
+    // budget; false if all have shut down.
+    bool NextRound();
+    // Copies the rows back into the lanes' CPUs.
+    void Sync();
+    // Runs the live lanes to at most maxCycles instructions since the start
+    // of the round.
+    void Fallback(u64_t maxCycles);
+};
+
+} // namespace Sim
+
+#endif // SIM_LANE_ENGINE_H
@@ -0,0 +1,357 @@
+#include "lockstep.h"
+#include "cpu.h"
+
+#include <cassert>
+#include <cinttypes>
+#include <cstdio>
+
+namespace Sim {
+
+namespace {
+
+// Consecutive traps without a retirement before the reference gives up, e.g.
+// when tvec itself does not decode.
+constexpr u32_t MAX_TRAPS = 4;
+
+u32_t ImmI(u32_t raw)
+{
+    return (u32_t)((i32_t)raw >> 20);
+}
+
+u32_t ImmS(u32_t raw)
+{
+    return (u32_t)((i32_t)raw >> 25 << 5) | ((raw >> 7) & 0x1f);
+}
+
+u32_t ImmB(u32_t raw)
+{
+    return (u32_t)((i32_t)raw >> 31 << 12) | (((raw >> 7) & 1) << 11) | (((raw >> 25) & 0x3f) << 5) |
+        (((raw >> 8) & 0xf) << 1);
+}
+
+u32_t ImmU(u32_t raw)
+{
+    return raw & 0xfffff000;
+}
+
+u32_t ImmJ(u32_t raw)
+{
+    return (u32_t)((i32_t)raw >> 31 << 20) | (raw & 0xff000) | (((raw >> 20) & 1) << 11) |
+        (((raw >> 21) & 0x3ff) << 1);
+}
+
+void AppendRecord(std::string &out, char const *name, TraceRecord const &r)
+{
+    char line[128] = {};
+    int n = std::snprintf(line, sizeof(line), "  %-9s pc %08x  inst %08x", name, r.pc, r.inst);
+    if (r.rd) {
+        n += std::snprintf(line + n, sizeof(line) - n, "  x%-2u = %08x", r.rd, r.rdValue);
+    }
+    if (r.access != TraceAccess::NONE) {
+        std::snprintf(line + n, sizeof(line) - n, "  %s [%08x] = %08x",
+            r.access == TraceAccess::LOAD ? "load" : "store", r.addr, r.data);
+    }
+    out += line;
+    out += '\n';
+}
+
+} // namespace
+
+void ReferenceModel::Load(CPU const &cpu)
+{
+    std::copy(std::begin(cpu.decodeStage.regfile.gpr), std::end(cpu.decodeStage.regfile.gpr), gpr);
+    gpr[0] = 0;
+    tvec = cpu.tvec;
+    memorySize = cpu.mmu.Size();
+
+    if (cpu.mmu.backend == MMUBackend::PAGED) {
+        memory = cpu.mmu.paged;
+        return;
+    }
+    memory = {};
+    for (u64_t a = 0; a < memorySize; a += sizeof(u32_t)) {
+        if (u32_t word = cpu.mmu.Peek(a); word) {
+            memory.Write(a, word);
+        }
+    }
+}
+
+bool ReferenceModel::Step(CPU &cpu, TraceRecord const &dut, TraceRecord *record)
+{
+    for (u32_t traps = 0; traps < MAX_TRAPS; ++traps) {
+        if (Execute(cpu, dut, record)) {
+            return true;
+        }
+        pc = tvec;
+    }
+    return false;
+}
+
+bool ReferenceModel::Execute(CPU &cpu, TraceRecord const &dut, TraceRecord *record)
+{
+    if (pc % 4 || pc >= memorySize) {
+        return false;
+    }
+
+    u32_t const raw = memory.Read(pc);
+    u32_t const opcode = raw & 0x7f;
+    u32_t rd = (raw >> 7) & 0x1f;
+    u32_t const funct3 = (raw >> 12) & 0x7;
+    u32_t const funct7 = raw >> 25;
+    u32_t const a = gpr[(raw >> 15) & 0x1f];
+    u32_t const b = gpr[(raw >> 20) & 0x1f];
+
+    TraceRecord r = { .pc = pc, .inst = raw };
+    u32_t next = pc + 4;
+    bool write = true;
+    u32_t result = 0;
+
+    switch (opcode) {
+        case 0b0110111: // LUI
+            result = ImmU(raw);
+            break;
+        case 0b0010111: // AUIPC
+            result = pc + ImmU(raw);
+            break;
+        case 0b1101111: // JAL
+            result = pc + 4;
+            next = pc + ImmJ(raw);
+            break;
+        case 0b1100111: // JALR
+            if (funct3) {
+                return false;
+            }
+            result = pc + 4;
+            next = (a + ImmI(raw)) & ~(u32_t)1;
+            break;
+        case 0b1100011: { // BRANCH
+            bool taken = false;
+            switch (funct3) {
+                case 0b000: taken = a == b; break;
+                case 0b001: taken = a != b; break;
+                case 0b100: taken = (i32_t)a < (i32_t)b; break;
+                case 0b101: taken = (i32_t)a >= (i32_t)b; break;
+                case 0b110: taken = a < b; break;
+                case 0b111: taken = a >= b; break;
+                default: return false;
+            }
+            if (taken) {
+                next = pc + ImmB(raw);
+            }
+            write = false;
+            break;
+        }
+        case 0b0000011: { // LOAD
+            u32_t const addr = a + ImmI(raw);
+            u32_t const size = 1 << (funct3 & 3);
+            if (funct3 == 0b011 || funct3 > 0b101) {
+                return false;
+            }
+            if (addr % size) {
+                return false;
+            }
+
+            if (auto const *device = cpu.mmu.devices.Find(addr & ~(u32_t)3); device && device->read) {
+                result = dut.access == TraceAccess::LOAD && dut.addr == addr ? dut.data : 0;
+            } else if ((addr & ~(u32_t)3) >= memorySize) {
+                return false;
+            } else {
+                u32_t const word = memory.Read(addr & ~(u32_t)3) >> (addr % 4 * 8);
+                switch (funct3) {
+                    case 0b000: result = (u32_t)(i32_t)(i8_t)word; break;
+                    case 0b001: result = (u32_t)(i32_t)(i16_t)word; break;
+                    case 0b100: result = (u8_t)word; break;
+                    case 0b101: result = (u16_t)word; break;
+                    default: result = word; break;
+                }
+            }
+            r.access = TraceAccess::LOAD;
+            r.addr = addr;
+            r.data = result;
+            break;
+        }
+        case 0b0100011: { // STORE
+            u32_t const addr = a + ImmS(raw);
+            u32_t const size = 1 << funct3;
+            if (funct3 > 0b010 || addr % size) {
+                return false;
+            }
+            u32_t const word = addr & ~(u32_t)3;
+            if (auto const *device = cpu.mmu.devices.Find(word); !device || !device->write) {
+                if (word >= memorySize) {
+                    return false;
+                }
+                u32_t const shift = addr % 4 * 8;
+                u32_t const mask = size == 4 ? ~(u32_t)0 : (((u32_t)1 << size * 8) - 1) << shift;
+                memory.Write(word, (memory.Read(word) & ~mask) | ((b << shift) & mask));
+            }
+            r.access = TraceAccess::STORE;
+            r.addr = addr;
+            r.data = b;
+            write = false;
+            break;
+        }
+        case 0b0010011: { // OP-IMM
+            u32_t const imm = ImmI(raw);
+            u32_t const shamt = imm & 0x1f;
+            switch (funct3) {
+                case 0b000: result = a + imm; break;
+                case 0b010: result = (i32_t)a < (i32_t)imm; break;
+                case 0b011: result = a < imm; break;
+                case 0b100: result = a ^ imm; break;
+                case 0b110: result = a | imm; break;
+                case 0b111: result = a & imm; break;
+                case 0b001:
+                    if (funct7) {
+                        return false;
+                    }
+                    result = a << shamt;
+                    break;
+                case 0b101:
+                    if (funct7 == 0b0000000) {
+                        result = a >> shamt;
+                    } else if (funct7 == 0b0100000) {
+                        result = (u32_t)((i32_t)a >> shamt);
+                    } else {
+                        return false;
+                    }
+                    break;
+            }
+            break;
+        }
+        case 0b0110011: { // OP
+            bool const alt = funct7 == 0b0100000;
+            if (funct7 && !(alt && (funct3 == 0b000 || funct3 == 0b101))) {
+                return false;
+            }
+            switch (funct3) {
+                case 0b000: result = alt ? a - b : a + b; break;
+                case 0b001: result = a << (b & 0x1f); break;
+                case 0b010: result = (i32_t)a < (i32_t)b; break;
+                case 0b011: result = a < b; break;
+                case 0b100: result = a ^ b; break;
+                case 0b101: result = alt ? (u32_t)((i32_t)a >> (b & 0x1f)) : a >> (b & 0x1f); break;
+                case 0b110: result = a | b; break;
+                case 0b111: result = a & b; break;
+            }
+            break;
+        }
+        case 0b0001111: // FENCE
+            if (funct3) {
+                return false;
+            }
+            write = false;
+            break;
+        case 0b1110011: // ECALL retires only if the simulator serviced it.
+            if (raw != 0x00000073 || !cpu.hostCalls.Active() || dut.pc != pc || dut.rd != 10) {
+                return false;
+            }
+            rd = 10;
+            result = dut.rdValue;
+            break;
+        default:
+            return false;
+    }
+
+    if (write && rd) {
+        gpr[rd] = result;
+        r.rd = rd;
+        r.rdValue = result;
+    }
+    pc = next;
+    *record = r;
+    return true;
+}
+
+void LockstepChecker::Attach(CPU &cpu)
+{
+    assert(batch && "Batch must not be empty");
+
+    reference.Load(cpu);
+    std::copy(std::begin(reference.gpr), std::end(reference.gpr), dutGpr);
+    pending = std::make_unique_for_overwrite<TraceRecord[]>(batch);
+    count = 0;
+    started = false;
+    checked = 0;
+    diverged = false;
+    divergence = {};
+    cpu.checker = this;
+}
+
+void LockstepChecker::Detach(CPU &cpu)
+{
+    Check(cpu);
+    cpu.checker = nullptr;
+}
+
+bool LockstepChecker::Check(CPU &cpu)
+{
+    u32_t const n = count;
+    count = 0;
+    if (diverged) {
+        return false;
+    }
+
+    for (u32_t i = 0; i < n; ++i) {
+        TraceRecord const &dut = pending[i];
+        if (!started) {
+            reference.pc = dut.pc;
+            started = true;
+        }
+
+        TraceRecord ref = {};
+        bool const retired = reference.Step(cpu, dut, &ref);
+        if (!retired) {
+            ref = { .pc = reference.pc };
+        }
+        if (dut.rd) {
+            dutGpr[dut.rd] = dut.rdValue;
+        }
+        if (retired && ref == dut) {
+            ++checked;
+            continue;
+        }
+
+        diverged = true;
+        divergence.index = checked;
+        divergence.dut = dut;
+        divergence.ref = ref;
+        divergence.refRetired = retired;
+        std::copy(std::begin(dutGpr), std::end(dutGpr), divergence.dutGpr);
+        std::copy(std::begin(reference.gpr), std::end(reference.gpr), divergence.refGpr);
+        cpu.shutdown = true;
+        return false;
+    }
+    return true;
+}
+
+std::string LockstepChecker::Report() const
+{
+    if (!diverged) {
+        char line[64] = {};
+        std::snprintf(line, sizeof(line), "%" PRIu64 " retirements match\n", checked);
+        return line;
+    }
+
+    char line[128] = {};
+    std::snprintf(line, sizeof(line), "divergence at retirement %" PRIu64 "\n", divergence.index);
+    std::string out = line;
+    AppendRecord(out, "simulator", divergence.dut);
+    if (divergence.refRetired) {
+        AppendRecord(out, "reference", divergence.ref);
+    } else {
+        std::snprintf(line, sizeof(line), "  reference traps repeatedly, now at pc %08x\n", divergence.ref.pc);
+        out += line;
+    }
+
+    for (u32_t i = 1; i < 32; ++i) {
+        if (divergence.dutGpr[i] != divergence.refGpr[i]) {
+            std::snprintf(line, sizeof(line), "  x%-2u simulator %08x  reference %08x\n", i,
+                divergence.dutGpr[i], divergence.refGpr[i]);
+            out += line;
+        }
+    }
+    return out;
+}
+
+} // namespace Sim
@@ -0,0 +1,96 @@
+#ifndef SIM_LOCKSTEP_H
+#define SIM_LOCKSTEP_H
+
+#include <types.h>
+#include <paged_memory.h>
+#include <trace.h>
+#include <memory>
+#include <string>
+
+namespace Sim {
+
+struct CPU;
+
+// Architectural RV32I model to check the simulator's engines against. It
+// decodes straight from the instruction bits and keeps its own registers and
+// memory, sharing nothing with CPU but the state it starts from. Traps go to
+// tvec without retiring. Byte and halfword stores change only the bytes they
+// cover, as in the simulator's MMU.
+struct ReferenceModel final {
+public:
+    u32_t pc = 0;
+    u32_t gpr[32] = {};
+    u32_t tvec = 0;
+    PagedMemory memory = {};
+    u64_t memorySize = (u64_t)1 << 32;
+
+    // Copies the registers, memory image and tvec of cpu.
+    void Load(CPU const &cpu);
+
+    // Runs until an instruction retires and describes it like the tracer
+    // does. Values the model cannot know, device loads and the results of
+    // serviced ECALLs, are taken from `dut`, the retirement the simulator
+    // reported at the same point. False if it keeps trapping instead.
+    bool Step(CPU &cpu, TraceRecord const &dut, TraceRecord *record);
+
+private:
+    // False if the instruction at pc traps.
+    bool Execute(CPU &cpu, TraceRecord const &dut, TraceRecord *record);
+};
+
+// Co-simulation: once attached, every engine reports each retired instruction
+// (JIT blocks run in the interpreter meanwhile), and the reference model
+// replays them in batches of `batch` retirements. The first mismatch in pc,
+// instruction word, register write or memory access stops the CPU and is
+// kept in `divergence`; Report() prints it with the registers that differ.
+struct LockstepChecker final {
+public:
+    struct Divergence final {
+        u64_t index = 0;
+        TraceRecord dut = {};
+        TraceRecord ref = {};
+        // False if the reference trapped where the simulator retired.
+        bool refRetired = true;
+        // Register files right after the divergent instruction.
+        u32_t dutGpr[32] = {};
+        u32_t refGpr[32] = {};
+    };
+
+    u32_t batch = 4096;
+    ReferenceModel reference = {};
+
+    u64_t checked = 0;
+    bool diverged = false;
+    Divergence divergence = {};
+
+    // The reference starts from the state of cpu and the pc of the first
+    // retirement.
+    void Attach(CPU &cpu);
+    // Checks the retirements still pending.
+    void Detach(CPU &cpu);
+
+    void Retire(CPU &cpu, TraceRecord const &record)
+    {
+        pending[count] = record;
+        if (++count == batch) {
+            Check(cpu);
+        }
+    }
+
+    // Replays the pending retirements; false once diverged.
+    bool Check(CPU &cpu);
+
+    std::string Report() const;
+
+private:
+    std::unique_ptr<TraceRecord[]> pending = {};
+    u32_t count = 0;
+    bool started = false;
+    // Registers as retired by the simulator, whose own register file may lag
+    // behind retirement.
+    u32_t dutGpr[32] = {};
+};
+
+} // namespace Sim
+
+#endif // SIM_LOCKSTEP_H
@@ -1,9 +1,36 @@
 #include "cpu_env.h"
+#include "batch_runner.h"
+#include "snapshot.h"
+#include "scheduler.h"
+#include "profiler.h"
+#include "trace.h"
+#include "lockstep.h"
+#include "batch_decoder.h"
+#include "lane_engine.h"
+#include "smp.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <elf.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
 
-void Test0()
+static void SetMode(Sim::CPUEnv &env, Sim::ExecMode mode)
+{
+    env.mode = mode;
+    // Compile blocks on first use so that short programs exercise the JIT.
+    env.cpu.jit.hotThreshold = 1;
+}
+
+void Test0(Sim::ExecMode mode)
 {
     auto memory = std::vector<u32_t>(4096, 0);
 
@@ -14,12 +41,13 @@ void Test0()
 
     auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
         std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
 
     env.Execute(1024);
     assert(env.cpu.huModule.exceptionPC == 1024);
 }
 
-void Test1()
+void Test1(Sim::ExecMode mode)
 {
     auto memory = std::vector<u32_t>(4096, 0);
     u32_t const code[] = {
@@ -32,6 +60,7 @@ void Test1()
     std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
     auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
         std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
 
     env.cpu.mmu.memory[8] = 0x21323424;
     env.cpu.mmu.memory[9] = 0xdeadbabe;
@@ -43,7 +72,7 @@ void Test1()
     assert(env.cpu.mmu.memory[10] == 0xdeadbabe - 0x21323424);
 }
 
-void Test2()
+void Test2(Sim::ExecMode mode)
 {
     auto memory = std::vector<u32_t>(4096, 0);
     u32_t const code[] = {
@@ -55,6 +84,7 @@ void Test2()
     std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
     auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
         std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
 
     env.Execute(1024);
     assert(env.cpu.huModule.exceptionPC == 1024 + 4 * 3);
@@ -64,7 +94,7 @@ void Test2()
     assert(env.cpu.decodeStage.regfile.gpr[12] == 321);
 }
 
-void Test3()
+void Test3(Sim::ExecMode mode)
 {
     auto memory = std::vector<u32_t>(4096, 0);
     u32_t const code[] = {
@@ -84,6 +114,7 @@ void Test3()
     std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
     auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
         std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
 
     env.Execute(1024);
     assert(env.cpu.huModule.exceptionPC == 1024 + 4 * 2);
@@ -93,7 +124,7 @@ void Test3()
     assert(env.cpu.decodeStage.regfile.gpr[10] == 0);
 }
 
-void Test4()
+void Test4(Sim::ExecMode mode)
 {
     auto memory = std::vector<u32_t>(4096, 0);
     u32_t const code[] = {
@@ -125,6 +156,7 @@ void Test4()
     std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
     auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
         std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
 
     env.Execute(1024);
     assert(env.cpu.huModule.exceptionPC == 1024 + 4 * 2);
@@ -134,13 +166,1718 @@ void Test4()
     assert(env.cpu.decodeStage.regfile.gpr[10] == 6);
 }
 
+void Test5(Sim::ExecMode mode)
+{
+    auto memory = std::vector<u32_t>(4096, 0);
+    u32_t const code[] = {
+        0x02002583U, // lw a1, 32(zero)
+        0x00000513U, // li a0, 0
+        0x03200613U, // li a2, 50
+        0x00150513U, // addi a0, a0, 1 (slot)
+        0x40b02623U, // sw a1, 1036(zero)
+        0xfec54ce3U, // blt a0, a2, slot
+        0x00100073U  // ebreak
+    };
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+    auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
+        std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
+
+    env.cpu.mmu.memory[8] = 0x06450513U; // addi a0, a0, 100
+
+    env.Execute(1024);
+    assert(env.cpu.huModule.exceptionPC == 1024 + 4 * 6);
+
+    assert(env.cpu.decodeStage.regfile.gpr[10] == 101);
+}
+
+static u32_t EncodeR(u32_t funct7, u32_t rs2, u32_t rs1, u32_t funct3, u32_t rd, u32_t opcode)
+{
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static u32_t EncodeI(u32_t imm, u32_t rs1, u32_t funct3, u32_t rd, u32_t opcode)
+{
+    return ((imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static u32_t EncodeS(u32_t imm, u32_t rs2, u32_t rs1, u32_t funct3, u32_t opcode)
+{
+    return (((imm >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | ((imm & 0x1f) << 7) | opcode;
+}
+
+static u32_t EncodeB(u32_t imm, u32_t rs2, u32_t rs1, u32_t funct3, u32_t opcode)
+{
+    return (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) |
+        (funct3 << 12) | (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 1) << 7) | opcode;
+}
+
+static u32_t EncodeJ(u32_t imm, u32_t rd, u32_t opcode)
+{
+    return (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3ff) << 21) | (((imm >> 11) & 1) << 20) |
+        (((imm >> 12) & 0xff) << 12) | (rd << 7) | opcode;
+}
+
+// Random straight-line code with forward branches and jumps, wrapped in a
+// counted loop. The code must be placed at base < 2048, below which jalr
+// targets are encoded as absolute offsets from x0. Avoids x0 as a destination and unaligned or out-of-range
+// memory accesses so that every execution mode must agree exactly.
+static std::vector<u32_t> GenerateProgram(u32_t base, u32_t seed, u32_t bodySize, u32_t iterations)
+{
+    u32_t state = seed;
+    auto rnd = [&state](u32_t n) {
+        state = state * 1103515245U + 12345U;
+        return (state >> 8) % n;
+    };
+    auto reg = [&rnd]() { return 1 + rnd(30); };
+    auto dataAddr = [&rnd](u32_t align) { return 128 + rnd(896 / align) * align; };
+
+    u32_t constexpr loopReg = 31;
+    std::vector<u32_t> code = {};
+
+    for (u32_t r = 1; r < loopReg; ++r) {
+        code.push_back(EncodeI(rnd(4096), 0, 0b000, r, 0b0010011)); // addi r, zero, imm
+    }
+    code.push_back(EncodeI(iterations, 0, 0b000, loopReg, 0b0010011));
+
+    u32_t loopStart = std::size(code);
+    u32_t loopEnd = loopStart + bodySize;
+    while (std::size(code) < loopEnd) {
+        u32_t i = std::size(code);
+        u32_t skipMax = std::min<u32_t>(4, loopEnd - i);
+
+        switch (rnd(10)) {
+            case 0: case 1: {
+                u32_t const funct[][2] = {
+                    { 0, 0 }, { 0x20, 0 }, { 0, 1 }, { 0, 2 }, { 0, 3 },
+                    { 0, 4 }, { 0, 5 }, { 0x20, 5 }, { 0, 6 }, { 0, 7 }
+                };
+                auto const &f = funct[rnd(std::size(funct))];
+                code.push_back(EncodeR(f[0], reg(), reg(), f[1], reg(), 0b0110011));
+                break;
+            }
+            case 2: case 3: {
+                u32_t const funct3[] = { 0, 2, 3, 4, 6, 7 };
+                code.push_back(EncodeI(rnd(4096), reg(), funct3[rnd(std::size(funct3))], reg(), 0b0010011));
+                break;
+            }
+            case 4: {
+                u32_t const shifts[][2] = { { 0, 1 }, { 0, 5 }, { 0x20, 5 } };
+                auto const &f = shifts[rnd(std::size(shifts))];
+                code.push_back(EncodeI((f[0] << 5) | rnd(32), reg(), f[1], reg(), 0b0010011));
+                break;
+            }
+            case 5: {
+                u32_t const loads[][2] = { { 0, 1 }, { 1, 2 }, { 2, 4 }, { 4, 1 }, { 5, 2 } };
+                auto const &f = loads[rnd(std::size(loads))];
+                code.push_back(EncodeI(dataAddr(f[1]), 0, f[0], reg(), 0b0000011));
+                break;
+            }
+            case 6: {
+                code.push_back(EncodeS(dataAddr(4), reg(), 0, rnd(3), 0b0100011));
+                break;
+            }
+            case 7: {
+                u32_t const funct3[] = { 0, 1, 4, 5, 6, 7 };
+                code.push_back(EncodeB(4 * (1 + rnd(skipMax)), reg(), reg(), funct3[rnd(std::size(funct3))],
+                    0b1100011));
+                break;
+            }
+            case 8: {
+                u32_t target = 4 * (i + 1 + rnd(skipMax));
+                if (rnd(2)) {
+                    code.push_back(EncodeJ(target - 4 * i, reg(), 0b1101111));
+                } else {
+                    code.push_back(EncodeI(base + target, 0, 0b000, reg(), 0b1100111));
+                }
+                break;
+            }
+            default: {
+                u32_t opcode = rnd(2) ? 0b0110111 : 0b0010111;
+                code.push_back((rnd(1 << 20) << 12) | (reg() << 7) | opcode);
+                break;
+            }
+        }
+    }
+
+    code.push_back(EncodeI(-1, loopReg, 0b000, loopReg, 0b0010011));              // addi x31, x31, -1
+    code.push_back(EncodeB(-4 * (std::size(code) - loopStart), 0, loopReg, 0b001, 0b1100011)); // bnez x31, loop
+    code.push_back(0x00100073U); // ebreak
+    return code;
+}
+
+void Test6()
+{
+    Sim::ExecMode const modes[] = {
+        Sim::ExecMode::PIPELINE, Sim::ExecMode::FUNCTIONAL, Sim::ExecMode::BLOCK, Sim::ExecMode::JIT
+    };
+
+    for (u32_t seed = 1; seed <= 64; ++seed) {
+        auto memory = std::vector<u32_t>(4096, 0);
+        auto code = GenerateProgram(1024, seed, 200, 20);
+        assert(1024 + std::size(code) * sizeof(u32_t) < 2048);
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code.data(), std::size(code) * sizeof(u32_t));
+
+        std::vector<Sim::CPUEnv> envs = {};
+        for (auto mode : modes) {
+            auto &env = envs.emplace_back(memory.data(), std::size(memory) * sizeof(u32_t),
+                std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+            SetMode(env, mode);
+            env.Execute(1024);
+        }
+
+        [[maybe_unused]] auto const &ref = envs[0].cpu;
+        for ([[maybe_unused]] auto const &env : envs) {
+            assert(env.cpu.huModule.exceptionPC == ref.huModule.exceptionPC);
+            assert(env.cpu.huModule.exceptionType == ref.huModule.exceptionType);
+            assert(std::equal(std::begin(ref.decodeStage.regfile.gpr), std::end(ref.decodeStage.regfile.gpr),
+                std::begin(env.cpu.decodeStage.regfile.gpr)));
+            assert(env.cpu.mmu.memory == ref.mmu.memory);
+        }
+    }
+}
+
+void Test7(Sim::ExecMode mode)
+{
+    auto memory = std::vector<u32_t>(4096, 0);
+    u32_t const code[] = {
+        EncodeI(-16, 0, 0b000, 2, 0b0010011),    // addi sp, zero, -16
+        EncodeI(0x123, 0, 0b000, 10, 0b0010011), // addi a0, zero, 0x123
+        EncodeI(0, 2, 0b010, 13, 0b0000011),     // lw a3, 0(sp)
+        EncodeS(0, 10, 2, 0b010, 0b0100011),     // sw a0, 0(sp)
+        EncodeI(0, 2, 0b010, 11, 0b0000011),     // lw a1, 0(sp)
+        EncodeI(-2048, 2, 0b010, 12, 0b0000011), // lw a2, -2048(sp)
+        0x00100073U                              // ebreak
+    };
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+    auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
+        std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE, Sim::MMUBackend::PAGED);
+    SetMode(env, mode);
+
+    env.Execute(1024);
+    assert(env.cpu.huModule.exceptionType == Sim::HUExceptionType::INT);
+    assert(env.cpu.decodeStage.regfile.gpr[11] == 0x123);
+    assert(env.cpu.decodeStage.regfile.gpr[12] == 0);
+    assert(env.cpu.decodeStage.regfile.gpr[13] == 0);
+    assert(env.cpu.mmu.paged.AllocatedPages() == 2);
+
+    auto copy = env.cpu.mmu.paged;
+    copy.Write(0xfffffff0, 0x456);
+    assert(copy.Read(0xfffffff0) == 0x456);
+    assert(env.cpu.mmu.Peek(0xfffffff0) == 0x123);
+}
+
+void Test8(Sim::ExecMode mode)
+{
+    u32_t const code[] = {
+        0x02002503U, // lw a0, 32(zero)
+        0x02402583U, // lw a1, 36(zero)
+        0x40a58633U, // sub a2, a1, a0
+        0x02c02423U, // sw a2, 40(zero)
+        0x00100073U  // ebreak
+    };
+
+    auto owned = std::vector<u32_t>(4096, 0);
+    std::memcpy(owned.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+    owned[8] = 0x21323424;
+    owned[9] = 0xdeadbabe;
+    [[maybe_unused]] u32_t const *ownedData = owned.data();
+
+    auto adopted = Sim::CPUEnv(std::move(owned));
+    SetMode(adopted, mode);
+    assert(adopted.cpu.mmu.memory.data() == ownedData);
+
+    adopted.Execute(1024);
+    assert(adopted.cpu.huModule.exceptionPC == 1024 + 4 * sizeof(u32_t));
+    assert(adopted.cpu.mmu.memory[10] == 0xdeadbabe - 0x21323424);
+
+    auto borrowed = std::vector<u32_t>(4096, 0);
+    std::memcpy(borrowed.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+    borrowed[8] = 0x21323424;
+    borrowed[9] = 0xdeadbabe;
+
+    auto env = Sim::CPUEnv(Sim::MemorySpan{ borrowed.data(), (u32_t)std::size(borrowed) });
+    SetMode(env, mode);
+    assert(env.cpu.mmu.memory.empty());
+
+    env.Execute(1024);
+    assert(env.cpu.huModule.exceptionPC == 1024 + 4 * sizeof(u32_t));
+    assert(borrowed[10] == 0xdeadbabe - 0x21323424);
+}
+
+static u32_t EncodeU(u32_t imm, u32_t rd, u32_t opcode)
+{
+    return (imm << 12) | (rd << 7) | opcode;
+}
+
+// Two PT_LOAD segments: a page-aligned code/data page followed by .bss that
+// spans into the next pages, and a short segment whose page tail in the file
+// holds garbage that must read back as zero. The symbol table has two
+// functions and an object the loader must skip.
+static std::vector<u8_t> BuildElf()
+{
+    u32_t const code[] = {
+        EncodeU(0x10, 5, 0b0110111),              // lui t0, 0x10
+        EncodeI(0x7fc, 5, 0b010, 10, 0b0000011),  // lw a0, 0x7fc(t0)
+        EncodeI(1, 10, 0b000, 11, 0b0010011),     // addi a1, a0, 1
+        EncodeS(0x7fc, 11, 5, 0b010, 0b0100011),  // sw a1, 0x7fc(t0)
+        EncodeI(0x7fc, 5, 0b010, 12, 0b0000011),  // lw a2, 0x7fc(t0)
+        EncodeU(0x11, 6, 0b0110111),              // lui t1, 0x11
+        EncodeI(0, 6, 0b010, 13, 0b0000011),      // lw a3, 0(t1)
+        EncodeS(4, 11, 6, 0b010, 0b0100011),      // sw a1, 4(t1)
+        EncodeI(4, 6, 0b010, 14, 0b0000011),      // lw a4, 4(t1)
+        EncodeU(0x20, 7, 0b0110111),              // lui t2, 0x20
+        EncodeI(0, 7, 0b010, 15, 0b0000011),      // lw a5, 0(t2)
+        EncodeI(8, 7, 0b010, 16, 0b0000011),      // lw a6, 8(t2)
+        0x00100073U                               // ebreak
+    };
+
+    std::vector<u8_t> file(0x3000, 0);
+    Elf32_Ehdr ehdr = {};
+    std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_RISCV;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_entry = 0x10000;
+    ehdr.e_phoff = sizeof(Elf32_Ehdr);
+    ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf32_Phdr);
+    ehdr.e_phnum = 2;
+    ehdr.e_shoff = 0x2400;
+    ehdr.e_shentsize = sizeof(Elf32_Shdr);
+    ehdr.e_shnum = 3;
+    std::memcpy(file.data(), &ehdr, sizeof(ehdr));
+
+    Elf32_Phdr const phdrs[] = {
+        { PT_LOAD, 0x1000, 0x10000, 0x10000, 0x1000, 0x2010, PF_R | PF_W | PF_X, 0x1000 },
+        { PT_LOAD, 0x2000, 0x20000, 0x20000, 8, 16, PF_R | PF_W, 0x1000 },
+    };
+    std::memcpy(file.data() + ehdr.e_phoff, phdrs, sizeof(phdrs));
+
+    std::memcpy(file.data() + 0x1000, code, sizeof(code));
+    u32_t const words[] = { 41, 0x5a5a5a5a, 0xdeadbeef, 0xdeadbeef };
+    std::memcpy(file.data() + 0x17fc, &words[0], sizeof(u32_t));
+    std::memcpy(file.data() + 0x2000, &words[1], 3 * sizeof(u32_t));
+
+    char const names[] = "\0main\0load\0counter";
+    Elf32_Sym const syms[] = {
+        {},
+        { 6, 0x10004, 40, ELF32_ST_INFO(STB_LOCAL, STT_FUNC), 0, 1 },
+        { 1, 0x10000, 4, ELF32_ST_INFO(STB_GLOBAL, STT_FUNC), 0, 1 },
+        { 11, 0x107fc, 4, ELF32_ST_INFO(STB_GLOBAL, STT_OBJECT), 0, 1 },
+    };
+    Elf32_Shdr const shdrs[] = {
+        {},
+        { 0, SHT_STRTAB, 0, 0, 0x2100, sizeof(names), 0, 0, 1, 0 },
+        { 0, SHT_SYMTAB, 0, 0, 0x2200, sizeof(syms), 1, 1, 4, sizeof(Elf32_Sym) },
+    };
+    std::memcpy(file.data() + 0x2100, names, sizeof(names));
+    std::memcpy(file.data() + 0x2200, syms, sizeof(syms));
+    std::memcpy(file.data() + ehdr.e_shoff, shdrs, sizeof(shdrs));
+    return file;
+}
+
+void Test9(Sim::ExecMode mode)
+{
+    auto bytes = BuildElf();
+    char path[] = "/tmp/rv32i-elf-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    [[maybe_unused]] ssize_t written = write(fd, bytes.data(), std::size(bytes));
+    close(fd);
+    assert(written == (ssize_t)std::size(bytes));
+
+    Sim::ElfImage elf = {};
+    [[maybe_unused]] auto status = elf.Open(path);
+    unlink(path);
+    assert(status == Sim::ElfStatus::OK);
+    assert(elf.entry == 0x10000);
+    assert(std::size(elf.symbols) == 2);
+    assert(elf.symbols[0].name == "main" && elf.symbols[0].addr == 0x10000);
+    assert(elf.symbols[1].name == "load" && elf.symbols[1].size == 40);
+
+    auto env = Sim::CPUEnv(elf);
+    SetMode(env, mode);
+    env.Execute();
+
+    [[maybe_unused]] auto const &gpr = env.cpu.decodeStage.regfile.gpr;
+    assert(env.cpu.huModule.exceptionPC == 0x10000 + 4 * 12);
+    assert(gpr[10] == 41);
+    assert(gpr[12] == 42);
+    assert(gpr[13] == 0);
+    assert(gpr[14] == 42);
+    assert(gpr[15] == 0x5a5a5a5a);
+    assert(gpr[16] == 0);
+
+    // Guest stores stay private to the env.
+    auto other = Sim::CPUEnv(elf);
+    assert(other.cpu.mmu.Peek(0x107fc) == 41);
+    assert(other.cpu.mmu.Peek(0x11004) == 0);
+
+    Sim::ElfImage missing = {};
+    status = missing.Open("/nonexistent");
+    assert(status == Sim::ElfStatus::OPEN_FAILED);
+}
+
+void Test10(Sim::ExecMode mode)
+{
+    u32_t constexpr count = 64;
+    std::vector<std::vector<u32_t>> images = {};
+    for (u32_t seed = 1; seed <= count; ++seed) {
+        auto &memory = images.emplace_back(4096, 0);
+        auto code = GenerateProgram(1024, seed, 100, 5);
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code.data(), std::size(code) * sizeof(u32_t));
+    }
+    auto &spin = images.emplace_back(4096, 0);
+    spin[1024 / sizeof(u32_t)] = EncodeJ(0, 0, 0b1101111); // j .
+
+    std::vector<Sim::BatchJob> jobs = {};
+    for (auto const &image : images) {
+        jobs.push_back({ image.data(), (u32_t)(std::size(image) * sizeof(u32_t)), 1024, 100000 });
+    }
+    jobs.back().maxCycles = 500;
+
+    auto runner = Sim::BatchRunner(3, mode);
+    std::vector<Sim::BatchResult> results(std::size(jobs));
+    runner.Run(jobs.data(), results.data(), std::size(jobs));
+    runner.Run(jobs.data(), results.data(), std::size(jobs));
+
+    for (u32_t i = 0; i < count; ++i) {
+        auto env = Sim::CPUEnv(images[i].data(), std::size(images[i]) * sizeof(u32_t));
+        env.mode = mode;
+        env.Execute(1024);
+
+        assert(results[i].finished);
+        assert(results[i].exceptionPC == env.cpu.huModule.exceptionPC);
+        assert(results[i].exceptionType == env.cpu.huModule.exceptionType);
+        assert(std::equal(std::begin(results[i].gpr), std::end(results[i].gpr),
+            std::begin(env.cpu.decodeStage.regfile.gpr)));
+    }
+    assert(!results.back().finished);
+    assert(results.back().cycles == 500);
+}
+
+void Test11(Sim::MMUBackend backend)
+{
+    auto memory = std::vector<u32_t>(4096, 0);
+    auto code = GenerateProgram(1024, 7, 200, 20);
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code.data(), std::size(code) * sizeof(u32_t));
+    u32_t const memSize = std::size(memory) * sizeof(u32_t);
+
+    auto env = Sim::CPUEnv(memory.data(), memSize, memSize - Sim::CPUEnv::TVEC_HANDLER_SIZE, backend);
+    env.cpu.fetchStage.state.read.pc = 1024;
+    for (u32_t i = 0; i < 300; ++i) {
+        env.cpu.Tick();
+    }
+
+    Sim::CPUSnapshot snapshot = {};
+    snapshot.Take(env.cpu);
+    env.cpu.Execute();
+
+    auto const ref = std::vector<u32_t>(std::begin(env.cpu.decodeStage.regfile.gpr),
+        std::end(env.cpu.decodeStage.regfile.gpr));
+    std::vector<u32_t> refMemory = {};
+    for (u32_t a = 0; a < memSize; a += sizeof(u32_t)) {
+        refMemory.push_back(env.cpu.mmu.Peek(a));
+    }
+    auto check = [&]([[maybe_unused]] Sim::CPU &cpu) {
+        assert(cpu.shutdown);
+        assert(std::equal(std::begin(ref), std::end(ref), std::begin(cpu.decodeStage.regfile.gpr)));
+        for (u32_t a = 0; a < memSize; a += sizeof(u32_t)) {
+            assert(cpu.mmu.Peek(a) == refMemory[a / sizeof(u32_t)]);
+        }
+    };
+
+    // Data and the shutdown word share page 0, the only page written.
+    assert(std::size(env.cpu.mmu.dirtyPages) == 1);
+    snapshot.Restore(env.cpu);
+    assert(!env.cpu.shutdown);
+    env.cpu.Execute();
+    check(env.cpu);
+
+    char path[] = "/tmp/rv32i-snap-XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    [[maybe_unused]] auto status = snapshot.Save(path);
+    assert(status == Sim::SnapshotStatus::OK);
+
+    Sim::CPUSnapshot loaded = {};
+    status = loaded.Load(path);
+    assert(status == Sim::SnapshotStatus::OK);
+
+    // The header holds stateSize at offset 12 and memSize at 16, and is
+    // followed by the state and the page index.
+    std::vector<u8_t> file = {};
+    {
+        std::FILE *in = std::fopen(path, "rb");
+        assert(in);
+        for (int c = 0; (c = std::fgetc(in)) != EOF;) {
+            file.push_back(c);
+        }
+        std::fclose(in);
+    }
+    u32_t stateSize = 0;
+    std::memcpy(&stateSize, file.data() + 12, sizeof(stateSize));
+    auto loadCorrupt = [&](u64_t offset, auto value) {
+        auto bytes = file;
+        std::memcpy(bytes.data() + offset, &value, sizeof(value));
+        std::FILE *out = std::fopen(path, "wb");
+        assert(out);
+        std::fwrite(bytes.data(), 1, std::size(bytes), out);
+        std::fclose(out);
+        Sim::CPUSnapshot bad = {};
+        return bad.Load(path);
+    };
+    for (u64_t size : { (u64_t)0, (u64_t)4094, (u64_t)1 << 33 }) {
+        status = loadCorrupt(16, size);
+        assert(status == Sim::SnapshotStatus::BAD_FORMAT);
+    }
+    // An unaligned page, and one past the end of a flat memory.
+    status = loadCorrupt(40 + stateSize, (u32_t)100);
+    assert(status == Sim::SnapshotStatus::BAD_FORMAT);
+    if (backend == Sim::MMUBackend::FLAT) {
+        status = loadCorrupt(40 + stateSize, memSize);
+        assert(status == Sim::SnapshotStatus::BAD_FORMAT);
+    }
+    // Latches holding a register past x31, an enum past its last value or a
+    // bool that is neither, laid out as in the snapshot's state.
+    struct {
+        Sim::HUModule huModule;
+        Sim::FetchStage fetchStage;
+        Sim::DecodeStage decodeStage;
+        Sim::ExecuteStage executeStage;
+        Sim::MemoryStage memoryStage;
+        Sim::WritebackStage writebackStage;
+        bool shutdown;
+        u32_t tvec;
+    } layout = {};
+    assert(sizeof(layout) == stateSize);
+    auto offset = [&layout](void const *field) { return 40 + (u64_t)((u8_t const *)field - (u8_t const *)&layout); };
+    for (u64_t at : { offset(&layout.writebackStage.state.read.regAddr),
+        offset(&layout.executeStage.state.write.rs2a), offset(&layout.memoryStage.state.read.regAddr) }) {
+        status = loadCorrupt(at, (u8_t)32);
+        assert(status == Sim::SnapshotStatus::BAD_FORMAT);
+    }
+    for (u64_t at : { offset(&layout.executeStage.state.read.execParams.aluOp),
+        offset(&layout.memoryStage.state.write.execParams.resSrc), offset(&layout.huModule.exceptionType),
+        offset(&layout.huModule.exceptionExecStage) }) {
+        status = loadCorrupt(at, (u8_t)0xff);
+        assert(status == Sim::SnapshotStatus::BAD_FORMAT);
+    }
+    for (u64_t at : { offset(&layout.shutdown), offset(&layout.memoryStage.state.read.execParams.memWrite) }) {
+        status = loadCorrupt(at, (u8_t)2);
+        assert(status == Sim::SnapshotStatus::BAD_FORMAT);
+    }
+    status = loadCorrupt(offset(&layout.writebackStage.state.read.regAddr), (u8_t)31);
+    assert(status == Sim::SnapshotStatus::OK);
+    unlink(path);
+
+    auto other = Sim::CPUEnv(std::vector<u32_t>(16, 0));
+    status = loaded.Restore(other.cpu);
+    assert(status == Sim::SnapshotStatus::OK);
+    other.cpu.Execute();
+    check(other.cpu);
+    loaded.Restore(other.cpu);
+    other.cpu.Execute();
+    check(other.cpu);
+
+    if (backend == Sim::MMUBackend::FLAT) {
+        auto small = std::vector<u32_t>(16, 0);
+        auto borrowing = Sim::CPUEnv(Sim::MemorySpan{ small.data(), (u32_t)std::size(small) });
+        status = loaded.Restore(borrowing.cpu);
+        assert(status == Sim::SnapshotStatus::SIZE_MISMATCH);
+        assert(borrowing.cpu.fetchStage.state.read.pc == 0);
+        assert(borrowing.cpu.mmu.Size() == std::size(small) * sizeof(u32_t));
+    }
+}
+
+void Test12(Sim::ExecMode mode)
+{
+    auto memory = std::vector<u32_t>(4096, 0);
+    memory[1024 / sizeof(u32_t)] = EncodeJ(0, 0, 0b1101111); // j .
+    auto spin = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t));
+    SetMode(spin, mode);
+    spin.cpu.fetchStage.state.read.pc = 1024;
+
+    assert(spin.Resume(1000) == Sim::StopReason::BUDGET);
+    assert(spin.cpu.cycles == 1000);
+    assert(spin.Step(3) == Sim::StopReason::BUDGET);
+    assert(spin.cpu.cycles == 1003);
+
+    auto code = GenerateProgram(1024, 11, 200, 20);
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code.data(), std::size(code) * sizeof(u32_t));
+
+    auto ref = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t));
+    SetMode(ref, mode);
+    ref.Execute(1024);
+
+    auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t));
+    SetMode(env, mode);
+    env.cpu.fetchStage.state.read.pc = 1024;
+
+    u32_t slices = 0;
+    auto reason = Sim::StopReason::BUDGET;
+    while ((reason = env.Resume(37)) == Sim::StopReason::BUDGET) {
+        ++slices;
+    }
+    assert(slices > 1);
+    assert(reason == Sim::StopReason::EXCEPTION);
+    assert(env.cpu.huModule.exceptionType == Sim::HUExceptionType::INT);
+    assert(env.cpu.huModule.exceptionPC == 1024 + 4 * (std::size(code) - 1));
+
+    while ((reason = env.Step()) == Sim::StopReason::BUDGET) {
+    }
+    assert(reason == Sim::StopReason::SHUTDOWN);
+    assert(env.Resume(10) == Sim::StopReason::SHUTDOWN);
+    assert(std::equal(std::begin(ref.cpu.decodeStage.regfile.gpr), std::end(ref.cpu.decodeStage.regfile.gpr),
+        std::begin(env.cpu.decodeStage.regfile.gpr)));
+    assert(env.cpu.mmu.memory == ref.cpu.mmu.memory);
+
+    if (mode != Sim::ExecMode::BLOCK && mode != Sim::ExecMode::JIT) {
+        return;
+    }
+
+    // Blocks left early, by a store to their own code or by a faulting load
+    // that native code hands to the interpreter, count what ran.
+    std::fill(memory.begin(), memory.end(), 0);
+    u32_t const exits[] = {
+        EncodeU(0x158, 7, 0b0110111),           // lui t2, 0x158
+        EncodeI(0x593, 7, 0b000, 7, 0b0010011), // addi t2, t2, 0x593 (addi a1, a1, 1)
+        EncodeI(3, 0, 0b000, 5, 0b0010011),     // addi t0, zero, 3
+        EncodeI(1, 10, 0b000, 10, 0b0010011),   // loop: addi a0, a0, 1
+        EncodeS(1048, 7, 0, 0b010, 0b0100011),  // sw t2, 1048(zero)
+        EncodeI(1, 10, 0b000, 10, 0b0010011),   // addi a0, a0, 1
+        0x00000013U,                            // nop, then addi a1, a1, 1
+        EncodeI(-1, 5, 0b000, 5, 0b0010011),    // addi t0, t0, -1
+        EncodeB(-20, 0, 5, 0b001, 0b1100011),   // bne t0, zero, loop
+        EncodeI(2, 0, 0b000, 12, 0b0010011),    // addi a2, zero, 2
+        EncodeI(1, 0, 0b010, 13, 0b0000011),    // lw a3, 1(zero)
+        EncodeI(1, 0, 0b000, 14, 0b0010011),    // addi a4, zero, 1
+    };
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), exits, sizeof(exits));
+
+    auto functional = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t));
+    SetMode(functional, Sim::ExecMode::FUNCTIONAL);
+    functional.Execute(1024);
+    assert(functional.cpu.huModule.exceptionType == Sim::HUExceptionType::UNALIGNED_ADDR);
+    assert(functional.cpu.decodeStage.regfile.gpr[11] == 3);
+
+    for (bool threaded : { true, false }) {
+        auto block = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t));
+        SetMode(block, mode);
+        block.cpu.blockCache.threaded = threaded;
+        block.Execute(1024);
+        assert(block.cpu.decodeStage.regfile.gpr[11] == 3 && block.cpu.decodeStage.regfile.gpr[14] == 0);
+        assert(block.cpu.cycles == functional.cpu.cycles);
+    }
+}
+
+void Test13()
+{
+    Sim::ExecMode const modes[] = {
+        Sim::ExecMode::PIPELINE, Sim::ExecMode::FUNCTIONAL, Sim::ExecMode::BLOCK, Sim::ExecMode::JIT
+    };
+    u32_t constexpr count = 200;
+
+    // Host calls are completed asynchronously by a service thread.
+    std::mutex lock = {};
+    std::condition_variable wake = {};
+    std::deque<Sim::HostCall *> pending = {};
+    bool stop = false;
+    std::thread service([&]() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stop || !pending.empty()) {
+            wake.wait(guard, [&]() { return stop || !pending.empty(); });
+            while (!pending.empty()) {
+                Sim::HostCall *call = pending.front();
+                pending.pop_front();
+                assert(call->number == 1);
+                call->Complete(call->args[0] + 100);
+            }
+        }
+    });
+
+    auto scheduler = Sim::Scheduler([&](Sim::HostCall &call) {
+        std::lock_guard<std::mutex> guard(lock);
+        pending.push_back(&call);
+        wake.notify_one();
+    });
+
+    std::vector<std::unique_ptr<Sim::CPUEnv>> envs = {};
+    for (u32_t i = 0; i < count; ++i) {
+        auto memory = std::vector<u32_t>(4096, 0);
+        u32_t const code[] = {
+            EncodeI(i, 0, 0b000, 10, 0b0010011),  // addi a0, zero, i
+            EncodeI(1, 0, 0b000, 17, 0b0010011),  // addi a7, zero, 1
+            0x00000073U,                          // ecall
+            EncodeI(0, 10, 0b000, 11, 0b0010011), // addi a1, a0, 0
+            0x00000073U,                          // ecall
+            0x00100073U                           // ebreak
+        };
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+        auto &env = *envs.emplace_back(std::make_unique<Sim::CPUEnv>(std::move(memory)));
+        SetMode(env, modes[i % std::size(modes)]);
+        env.cpu.fetchStage.state.read.pc = 1024;
+        scheduler.Spawn(scheduler.Guest(env, 3));
+    }
+    scheduler.Run();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    wake.notify_one();
+    service.join();
+
+    for (u32_t i = 0; i < count; ++i) {
+        [[maybe_unused]] auto const &cpu = envs[i]->cpu;
+        assert(cpu.shutdown);
+        assert(cpu.huModule.exceptionPC == 1024 + 4 * 5);
+        assert(cpu.decodeStage.regfile.gpr[11] == i + 100);
+        assert(cpu.decodeStage.regfile.gpr[10] == i + 200);
+    }
+}
+
+void Test14(Sim::ExecMode mode)
+{
+    for (bool batched : { false, true }) {
+        auto memory = std::vector<u32_t>(4096, 0);
+        u32_t const code[] = {
+            EncodeI(1, 0, 0b000, 10, 0b0010011),     // addi a0, zero, 1
+            EncodeI(1536, 0, 0b000, 11, 0b0010011),  // addi a1, zero, 1536
+            EncodeI(3, 0, 0b000, 12, 0b0010011),     // addi a2, zero, 3
+            EncodeI(64, 0, 0b000, 17, 0b0010011),    // addi a7, zero, 64
+            0x00000073U,                             // ecall (write)
+            EncodeI(0, 10, 0b000, 5, 0b0010011),     // addi t0, a0, 0
+            EncodeI(2, 0, 0b000, 10, 0b0010011),     // addi a0, zero, 2
+            0x00000073U,                             // ecall (write)
+            EncodeI(1, 0, 0b000, 17, 0b0010011),     // addi a7, zero, 1
+            EncodeI(5, 0, 0b000, 10, 0b0010011),     // addi a0, zero, 5
+            0x00000073U,                             // ecall (custom)
+            EncodeI(0, 10, 0b000, 6, 0b0010011),     // addi t1, a0, 0
+            EncodeI(93, 0, 0b000, 17, 0b0010011),    // addi a7, zero, 93
+            EncodeI(4, 5, 0b000, 10, 0b0010011),     // addi a0, t0, 4
+            0x00000073U,                             // ecall (exit)
+            EncodeI(0, 0, 0b000, 0, 0b0010011),      // nop: keeps the pipeline
+            EncodeI(0, 0, 0b000, 0, 0b0010011),      // from decoding past the
+            EncodeI(0, 0, 0b000, 0, 0b0010011),      // end before exit retires
+        };
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+        memory[1536 / sizeof(u32_t)] = 0x000a6968; // "hi\n"
+
+        auto env = Sim::CPUEnv(std::move(memory));
+        SetMode(env, mode);
+
+        std::string output = {};
+        auto &hostCalls = env.cpu.hostCalls;
+        hostCalls.RegisterLinux(batched);
+        hostCalls.Register(1, [](Sim::CPU &, Sim::HostCallArgs const &call) {
+            return call.args[0] + 100;
+        });
+        hostCalls.output = [&output](u32_t fd, u8_t const *data, u32_t size) {
+            output += std::to_string(fd);
+            output.append((char const *)data, size);
+        };
+
+        env.Execute(1024);
+
+        [[maybe_unused]] auto const &cpu = env.cpu;
+        assert(cpu.shutdown);
+        assert(cpu.huModule.trapCount == 0);
+        assert(hostCalls.exitCode == 7);
+        assert(hostCalls.calls == 4);
+        assert(hostCalls.batches == (batched ? 1 : 0));
+        assert(output == "1hi\n2hi\n");
+        assert(cpu.decodeStage.regfile.gpr[5] == 3);
+        assert(cpu.decodeStage.regfile.gpr[6] == 105);
+    }
+
+    // read() into a buffer that shares its first and last words leaves the
+    // other bytes of those words alone.
+    {
+        auto memory = std::vector<u32_t>(4096, 0);
+        u32_t const code[] = {
+            EncodeI(0, 0, 0b000, 10, 0b0010011),    // addi a0, zero, 0
+            EncodeI(1537, 0, 0b000, 11, 0b0010011), // addi a1, zero, 1537
+            EncodeI(10, 0, 0b000, 12, 0b0010011),   // addi a2, zero, 10
+            EncodeI(63, 0, 0b000, 17, 0b0010011),   // addi a7, zero, 63
+            0x00000073U,                            // ecall (read)
+            0x00100073U                             // ebreak
+        };
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+        memory[1536 / sizeof(u32_t)] = 0x11223344;
+        memory[1544 / sizeof(u32_t)] = 0x55667788;
+
+        auto env = Sim::CPUEnv(std::move(memory));
+        SetMode(env, mode);
+        env.cpu.hostCalls.RegisterLinux();
+        env.cpu.hostCalls.input = [](u32_t, u8_t *data, u32_t size) {
+            std::memcpy(data, "abcdefghij", size);
+            return (i32_t)size;
+        };
+        env.Execute(1024);
+
+        assert(env.cpu.decodeStage.regfile.gpr[10] == 10);
+        assert(env.cpu.mmu.Peek(1536) == 0x63626144 && env.cpu.mmu.Peek(1540) == 0x67666564);
+        assert(env.cpu.mmu.Peek(1544) == 0x556a6968);
+    }
+
+    // Numbers without a handler still trap.
+    auto memory = std::vector<u32_t>(4096, 0);
+    memory[1024 / sizeof(u32_t)] = EncodeI(500, 0, 0b000, 17, 0b0010011); // addi a7, zero, 500
+    memory[1024 / sizeof(u32_t) + 1] = 0x00000073U;                         // ecall
+
+    auto env = Sim::CPUEnv(std::move(memory));
+    SetMode(env, mode);
+    env.cpu.hostCalls.RegisterLinux();
+    env.Execute(1024);
+
+    assert(env.cpu.shutdown);
+    assert(env.cpu.huModule.exceptionType == Sim::HUExceptionType::INT);
+    assert(env.cpu.huModule.exceptionPC == 1024 + 4);
+    assert(env.cpu.hostCalls.calls == 0);
+}
+
+void Test15(Sim::ExecMode mode)
+{
+    Sim::Uart uart = {};
+    Sim::Timer timer = {};
+    Sim::Framebuffer framebuffer(16, 16);
+
+    auto memory = std::vector<u32_t>(4096, 0);
+    u32_t const code[] = {
+        EncodeI(1, 0, 0b000, 5, 0b0010011),      // addi t0, zero, 1
+        EncodeI(28, 5, 0b001, 5, 0b0010011),     // slli t0, t0, 28 (uart)
+        EncodeI('O', 0, 0b000, 6, 0b0010011),    // addi t1, zero, 'O'
+        EncodeS(0, 6, 5, 0b010, 0b0100011),      // sw t1, 0(t0)
+        EncodeI('K', 0, 0b000, 6, 0b0010011),    // addi t1, zero, 'K'
+        EncodeS(0, 6, 5, 0b010, 0b0100011),      // sw t1, 0(t0)
+        EncodeI(4, 5, 0b010, 7, 0b0000011),      // lw t2, 4(t0)
+        EncodeI(0, 5, 0b010, 28, 0b0000011),     // lw t3, 0(t0)
+        EncodeI(1, 0, 0b000, 29, 0b0010011),     // addi t4, zero, 1
+        EncodeI(25, 29, 0b001, 29, 0b0010011),   // slli t4, t4, 25 (timer)
+        EncodeI(0, 29, 0b010, 8, 0b0000011),     // lw s0, 0(t4)
+        EncodeS(8, 0, 29, 0b010, 0b0100011),     // sw zero, 8(t4)
+        EncodeS(12, 0, 29, 0b010, 0b0100011),    // sw zero, 12(t4)
+        EncodeI(16, 29, 0b010, 18, 0b0000011),   // lw s2, 16(t4)
+        EncodeI(1, 0, 0b000, 19, 0b0010011),     // addi s3, zero, 1
+        EncodeI(29, 19, 0b001, 19, 0b0010011),   // slli s3, s3, 29 (framebuffer)
+        EncodeI(0x7f, 0, 0b000, 20, 0b0010011),  // addi s4, zero, 0x7f
+        EncodeS(8, 20, 19, 0b010, 0b0100011),    // sw s4, 8(s3)
+        EncodeI(8, 19, 0b010, 21, 0b0000011),    // lw s5, 8(s3)
+        EncodeS(256, 20, 0, 0b010, 0b0100011),   // sw s4, 256(zero)
+        EncodeI(256, 0, 0b010, 22, 0b0000011),   // lw s6, 256(zero)
+        EncodeI(0, 29, 0b010, 23, 0b0000011),    // lw s7, 0(t4)
+        0x00100073U                              // ebreak
+    };
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+
+    auto env = Sim::CPUEnv(std::move(memory));
+    SetMode(env, mode);
+
+    std::string output = {};
+    uart.output = [&output](u8_t byte) { output += (char)byte; };
+    uart.input.push_back('x');
+    uart.Attach(env.cpu.mmu);
+    timer.Attach(env.cpu.mmu);
+    framebuffer.Attach(env.cpu.mmu);
+
+    env.Execute(1024);
+
+    auto const &cpu = env.cpu;
+    [[maybe_unused]] u32_t const *gpr = cpu.decodeStage.regfile.gpr;
+    assert(cpu.shutdown);
+    assert(cpu.huModule.exceptionPC == 1024 + 4 * 22);
+    assert(output == "OK");
+    assert(gpr[7] == (Sim::Uart::TX_EMPTY | Sim::Uart::RX_READY));
+    assert(gpr[28] == 'x' && uart.input.empty());
+    // Both reads are in one block, and count the cycles up to and including
+    // their own instruction; the pipeline reads in the memory stage, two
+    // cycles after an instruction-at-a-time engine would.
+    assert(gpr[8] == 11 + (mode == Sim::ExecMode::PIPELINE ? 2 : 0) && gpr[23] - gpr[8] == 11);
+    assert(timer.compare == 0 && gpr[18] == 1);
+    assert(framebuffer.pixels[2] == 0x7f && framebuffer.version == 1 && gpr[21] == 0x7f);
+    // RAM next to the shutdown port is plain memory.
+    assert(env.cpu.mmu.Peek(256) == 0x7f && gpr[22] == 0x7f);
+
+    // Misaligned device loads trap before they reach the device: no input
+    // byte is consumed and no atomic operation runs.
+    u32_t const registers[] = { Sim::Uart::BASE + Sim::Uart::DATA, Sim::AtomicUnit::BASE + Sim::AtomicUnit::ADD };
+    for (u32_t reg : registers) {
+        auto memory = std::vector<u32_t>(4096, 0);
+        u32_t const code[] = {
+            EncodeU(reg >> 12, 5, 0b0110111),            // lui t0, reg
+            EncodeI(reg % 4096 + 1, 5, 0b001, 6, 0b0000011), // lh t1, 1(reg)
+            0x00100073U                                  // ebreak
+        };
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+        memory[256 / sizeof(u32_t)] = 5;
+        auto misaligned = Sim::CPUEnv(std::move(memory));
+        SetMode(misaligned, mode);
+        Sim::Uart input = {};
+        input.input.push_back('x');
+        Sim::AtomicUnit unit = {};
+        input.Attach(misaligned.cpu.mmu);
+        unit.Attach(misaligned.cpu.mmu);
+        unit.addr = 256;
+        unit.data = 3;
+
+        misaligned.Execute(1024);
+        assert(misaligned.cpu.huModule.exceptionType == Sim::HUExceptionType::UNALIGNED_ADDR);
+        assert(misaligned.cpu.huModule.exceptionPC == 1024 + 4);
+        assert(std::size(input.input) == 1 && misaligned.cpu.mmu.Peek(256) == 5);
+    }
+}
+
+template<bool enabled>
+void Test16()
+{
+    if constexpr (!enabled) {
+        static_assert(std::is_empty_v<Sim::Perf>);
+        return;
+    } else {
+        Sim::ExecMode const modes[] = {
+            Sim::ExecMode::PIPELINE, Sim::ExecMode::FUNCTIONAL, Sim::ExecMode::BLOCK, Sim::ExecMode::JIT
+        };
+
+        for (u32_t seed = 1; seed <= 8; ++seed) {
+            auto memory = std::vector<u32_t>(4096, 0);
+            auto code = GenerateProgram(1024, seed, 200, 20);
+            std::memcpy(memory.data() + 1024 / sizeof(u32_t), code.data(), std::size(code) * sizeof(u32_t));
+
+            std::vector<Sim::CPUEnv> envs = {};
+            for (auto mode : modes) {
+                auto &env = envs.emplace_back(memory.data(), std::size(memory) * sizeof(u32_t));
+                SetMode(env, mode);
+                env.Execute(1024);
+            }
+
+            Sim::PerfCounters<true> const &pipeline = envs[0].cpu.perf;
+            Sim::PerfCounters<true> const &functional = envs[1].cpu.perf;
+            for (auto const &env : envs) {
+                Sim::PerfCounters<true> const &perf = env.cpu.perf;
+                assert(std::equal(std::begin(perf.retired), std::end(perf.retired), std::begin(pipeline.retired)));
+                assert(perf.exceptions[(u32_t)Sim::HUExceptionType::INT] == 1);
+            }
+
+            // ebreak traps instead of retiring.
+            assert(functional.cycles == functional.Retired() + 1);
+            assert(functional.loadUseStalls == 0 && functional.flushes == 0);
+
+            assert(pipeline.cycles == envs[0].cpu.cycles && pipeline.cycles > pipeline.Retired());
+            assert(pipeline.flushes >= 20);
+            u64_t forwards = 0;
+            for (u64_t n : pipeline.forwards) {
+                forwards += n;
+            }
+            assert(forwards == 2 * pipeline.cycles);
+        }
+    }
+}
+
+// main calls f 50 times, f calls g, and g spins in a 20-iteration loop, so
+// nearly every sample lands in main;f;g.
+void Test17(Sim::ExecMode mode)
+{
+    auto memory = std::vector<u32_t>(4096, 0);
+    u32_t const code[] = {
+        // main (1024)
+        EncodeI(50, 0, 0b000, 8, 0b0010011),     // addi s0, zero, 50
+        EncodeJ(20, 1, 0b1101111),               // loop: jal ra, f
+        EncodeI(-1, 8, 0b000, 8, 0b0010011),     // addi s0, s0, -1
+        EncodeB(-8, 0, 8, 0b001, 0b1100011),     // bne s0, zero, loop
+        0x00100073U,                             // ebreak
+        EncodeI(0, 0, 0b000, 0, 0b0010011),      // nop
+        // f (1048)
+        EncodeI(0, 1, 0b000, 9, 0b0010011),      // addi s1, ra, 0
+        EncodeJ(12, 1, 0b1101111),               // jal ra, g
+        EncodeI(0, 9, 0b000, 1, 0b0010011),      // addi ra, s1, 0
+        EncodeI(0, 1, 0b000, 0, 0b1100111),      // jalr zero, 0(ra)
+        // g (1064)
+        EncodeI(20, 0, 0b000, 5, 0b0010011),     // addi t0, zero, 20
+        EncodeI(-1, 5, 0b000, 5, 0b0010011),     // spin: addi t0, t0, -1
+        EncodeB(-4, 0, 5, 0b001, 0b1100011),     // bne t0, zero, spin
+        EncodeI(0, 1, 0b000, 0, 0b1100111),      // jalr zero, 0(ra)
+    };
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+
+    auto env = Sim::CPUEnv(std::vector<u32_t>(memory));
+    SetMode(env, mode);
+
+    Sim::Profiler profiler = {};
+    profiler.period = 7;
+    profiler.symbols = { { 1024, 24, "main" }, { 1048, 16, "f" }, { 1064, 16, "g" } };
+    profiler.Attach(env.cpu);
+    env.Execute(1024);
+    profiler.Detach(env.cpu);
+
+    assert(env.cpu.shutdown);
+    assert(env.cpu.huModule.exceptionPC == 1024 + 4 * 4);
+    assert(profiler.calls == 100);
+    assert(profiler.returns == 100);
+    assert(profiler.samples > 100);
+
+    std::string folded = profiler.FoldedStacks();
+    assert(folded.find("main;f;g ") != std::string::npos);
+    assert(folded.find("main;g") == std::string::npos);
+
+    std::string flat = profiler.FlatProfile(4);
+    [[maybe_unused]] size_t g = flat.find("  g\n");
+    assert(g != std::string::npos && g < flat.find("  f\n") && g < flat.find("  main\n"));
+    assert(flat.find("g+0x4") != std::string::npos);
+    assert(profiler.Symbolize(2000) == "0x000007d0");
+
+    // Samples land on the instruction retiring in the sampled cycle, not on
+    // the first instruction of its block, so the two-instruction spin loop
+    // splits them evenly; in the pipeline the two cycles flushed by the taken
+    // bne go to the addi retiring after them. Engines retiring an instruction
+    // per cycle sample exactly the pcs the interpreter does.
+    [[maybe_unused]] u64_t const spin = profiler.SamplesAt(1068);
+    [[maybe_unused]] u64_t const branch = profiler.SamplesAt(1072);
+    if (mode == Sim::ExecMode::PIPELINE) {
+        assert(branch && spin > 2 * branch && spin < 4 * branch);
+    } else {
+        assert(branch && spin < 2 * branch && branch < 2 * spin);
+
+        auto reference = Sim::CPUEnv(std::move(memory));
+        SetMode(reference, Sim::ExecMode::FUNCTIONAL);
+        Sim::Profiler expected = {};
+        expected.period = profiler.period;
+        expected.Attach(reference.cpu);
+        reference.Execute(1024);
+        expected.Detach(reference.cpu);
+        for (u32_t pc = 1024; pc < 1024 + sizeof(code); pc += sizeof(u32_t)) {
+            assert(profiler.SamplesAt(pc) == expected.SamplesAt(pc));
+        }
+        assert(profiler.samples == expected.samples);
+    }
+}
+
+// Every engine produces the same trace; seeking lands on the same records as
+// reading through, across chunk boundaries.
+void Test18()
+{
+    Sim::ExecMode const modes[] = {
+        Sim::ExecMode::FUNCTIONAL, Sim::ExecMode::PIPELINE, Sim::ExecMode::BLOCK, Sim::ExecMode::JIT
+    };
+
+    for (u32_t seed = 1; seed <= 2; ++seed) {
+        auto memory = std::vector<u32_t>(4096, 0);
+        auto code = GenerateProgram(1024, seed, 200, 1000);
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code.data(), std::size(code) * sizeof(u32_t));
+
+        std::vector<Sim::TraceRecord> expected = {};
+        for (auto mode : modes) {
+            char path[] = "/tmp/rv32i-trace-XXXXXX";
+            int fd = mkstemp(path);
+            assert(fd >= 0);
+            close(fd);
+
+            auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t));
+            SetMode(env, mode);
+            Sim::TraceWriter writer = {};
+            [[maybe_unused]] auto status = writer.Open(path);
+            assert(status == Sim::TraceStatus::OK);
+            writer.Attach(env.cpu);
+            env.Execute(1024);
+            writer.Detach(env.cpu);
+            status = writer.Close();
+            assert(status == Sim::TraceStatus::OK);
+            assert(writer.Records() > Sim::TraceWriter::CHUNK_RECORDS);
+
+            Sim::TraceReader reader = {};
+            status = reader.Open(path);
+            unlink(path);
+            assert(status == Sim::TraceStatus::OK);
+            assert(reader.Count() == writer.Records());
+
+            std::vector<Sim::TraceRecord> records = {};
+            for (Sim::TraceRecord record = {}; reader.Next(&record);) {
+                records.push_back(record);
+            }
+            assert(std::size(records) == writer.Records());
+
+            if (expected.empty()) {
+                expected = records;
+                assert(records[0].pc == 1024 && records[0].inst == code[0] && records[0].rd == 1);
+                assert(std::any_of(records.begin(), records.end(),
+                    [](auto const &r) { return r.access == Sim::TraceAccess::LOAD; }));
+                assert(std::any_of(records.begin(), records.end(),
+                    [](auto const &r) { return r.access == Sim::TraceAccess::STORE; }));
+            }
+            assert(records == expected);
+
+            for ([[maybe_unused]] u64_t index : { (u64_t)std::size(records) - 1, (u64_t)Sim::TraceWriter::CHUNK_RECORDS, 7ul, 0ul }) {
+                [[maybe_unused]] Sim::TraceRecord record = {};
+                assert(reader.Seek(index) && reader.Position() == index);
+                assert(reader.Next(&record) && record == records[index]);
+            }
+            assert(!reader.Seek(std::size(records)));
+        }
+
+        // FLOW keeps just the pcs, and JIT blocks native.
+        for (auto mode : modes) {
+            char path[] = "/tmp/rv32i-trace-XXXXXX";
+            int fd = mkstemp(path);
+            assert(fd >= 0);
+            close(fd);
+
+            auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t));
+            SetMode(env, mode);
+            Sim::TraceWriter writer = {};
+            [[maybe_unused]] auto status = writer.Open(path, Sim::TraceLevel::FLOW);
+            assert(status == Sim::TraceStatus::OK);
+            writer.Attach(env.cpu);
+            env.Execute(1024);
+            writer.Detach(env.cpu);
+            status = writer.Close();
+            assert(status == Sim::TraceStatus::OK);
+            assert(writer.Records() == std::size(expected));
+            assert(mode != Sim::ExecMode::JIT || env.cpu.jit.compiledBlocks > 0);
+
+            Sim::TraceReader reader = {};
+            status = reader.Open(path);
+            unlink(path);
+            assert(status == Sim::TraceStatus::OK && reader.Level() == Sim::TraceLevel::FLOW);
+            assert(reader.Count() == std::size(expected));
+
+            u64_t n = 0;
+            for (Sim::TraceRecord record = {}; reader.Next(&record); ++n) {
+                assert(record == Sim::TraceRecord{ .pc = expected[n].pc });
+            }
+            assert(n == std::size(expected));
+
+            for ([[maybe_unused]] u64_t index : { (u64_t)std::size(expected) - 1, (u64_t)Sim::TraceWriter::CHUNK_RECORDS, 7ul, 0ul }) {
+                [[maybe_unused]] Sim::TraceRecord record = {};
+                assert(reader.Seek(index) && reader.Position() == index);
+                assert(reader.Next(&record) && record.pc == expected[index].pc);
+            }
+            assert(!reader.Seek(std::size(expected)));
+        }
+
+        // A writer that is not open drops what it is given.
+        for (auto mode : modes) {
+            auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t));
+            SetMode(env, mode);
+            Sim::TraceWriter writer = {};
+            writer.Attach(env.cpu);
+            env.Execute(1024);
+            assert(env.cpu.shutdown && writer.Records() == 0);
+        }
+    }
+
+    // A store over its own word is recorded with the word that executed.
+    for (auto mode : modes) {
+        auto memory = std::vector<u32_t>(4096, 0);
+        u32_t const code[] = {
+            EncodeS(1024, 0, 0, 0b010, 0b0100011), // sw zero, 1024(zero)
+            0x00100073U                            // ebreak
+        };
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+
+        char path[] = "/tmp/rv32i-trace-XXXXXX";
+        int fd = mkstemp(path);
+        assert(fd >= 0);
+        close(fd);
+
+        auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t));
+        SetMode(env, mode);
+        Sim::TraceWriter writer = {};
+        [[maybe_unused]] auto status = writer.Open(path);
+        assert(status == Sim::TraceStatus::OK);
+        writer.Attach(env.cpu);
+        env.Execute(1024);
+        writer.Detach(env.cpu);
+        status = writer.Close();
+        assert(status == Sim::TraceStatus::OK);
+
+        Sim::TraceReader reader = {};
+        status = reader.Open(path);
+        unlink(path);
+        [[maybe_unused]] Sim::TraceRecord record = {};
+        assert(status == Sim::TraceStatus::OK && reader.Next(&record));
+        assert(record.pc == 1024 && record.inst == code[0] && record.access == Sim::TraceAccess::STORE);
+    }
+}
+
+// The reference model agrees with every engine on random programs, and the
+// first retirement that differs stops the run.
+void Test19(Sim::ExecMode mode)
+{
+    for (u32_t seed = 1; seed <= 3; ++seed) {
+        auto memory = std::vector<u32_t>(4096, 0);
+        auto code = GenerateProgram(1024, seed, 200, 20);
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code.data(), std::size(code) * sizeof(u32_t));
+
+        auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
+            std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+        SetMode(env, mode);
+        Sim::LockstepChecker checker = {};
+        checker.batch = 64;
+        checker.Attach(env.cpu);
+        env.Execute(1024);
+        checker.Detach(env.cpu);
+        assert(!checker.diverged && checker.checked > 1000);
+    }
+
+    // Cases the checker first caught: lui above 0xff, backward jal, sub-word
+    // loads and writes to x0 forwarded by the pipeline.
+    {
+        auto memory = std::vector<u32_t>(4096, 0);
+        memory[32] = 0xfedc8a77;
+        u32_t const code[] = {
+            EncodeJ(12, 0, 0b1101111),             // jal zero, 1036
+            EncodeI(1, 0, 0b000, 4, 0b0010011),    // addi x4, zero, 1
+            0x00100073U,                           // ebreak
+            EncodeU(0x80001, 1, 0b0110111),        // lui x1, 0x80001
+            EncodeI(5, 1, 0b000, 0, 0b0010011),    // addi zero, x1, 5
+            EncodeR(0, 0, 0, 0b000, 2, 0b0110011), // add x2, zero, zero
+            EncodeI(128, 0, 0b010, 0, 0b0000011),  // lw zero, 128(zero)
+            EncodeR(0, 0, 0, 0b000, 3, 0b0110011), // add x3, zero, zero
+            EncodeI(129, 0, 0b000, 5, 0b0000011),  // lb x5, 129(zero)
+            EncodeI(130, 0, 0b101, 6, 0b0000011),  // lhu x6, 130(zero)
+            EncodeJ(-36, 7, 0b1101111),            // jal x7, 1028
+        };
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+        auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
+            std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+        SetMode(env, mode);
+
+        Sim::LockstepChecker checker = {};
+        checker.Attach(env.cpu);
+        env.Execute(1024);
+        checker.Detach(env.cpu);
+        assert(!checker.diverged && checker.checked == 11);
+
+        [[maybe_unused]] u32_t const *gpr = env.cpu.decodeStage.regfile.gpr;
+        assert(gpr[1] == 0x80001000 && gpr[2] == 0 && gpr[3] == 0 && gpr[4] == 1);
+        assert(gpr[5] == 0xffffff8a && gpr[6] == 0xfedc && gpr[7] == 1024 + 44);
+    }
+
+    auto memory = std::vector<u32_t>(4096, 0);
+    u32_t const code[] = {
+        EncodeI(128, 0, 0b010, 5, 0b0000011), // lw x5, 128(zero)
+        EncodeI(1, 5, 0b000, 6, 0b0010011),   // addi x6, x5, 1
+        0x00100073U                           // ebreak
+    };
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+    auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
+        std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
+
+    Sim::LockstepChecker checker = {};
+    checker.batch = 1;
+    checker.Attach(env.cpu);
+    // Behind the reference's back.
+    env.cpu.mmu.Poke(128, 42);
+    env.Execute(1024);
+    checker.Detach(env.cpu);
+
+    assert(checker.diverged && checker.divergence.index == 0);
+    assert(checker.divergence.dut.data == 42 && checker.divergence.ref.data == 0);
+    assert(checker.Report().find("x5  simulator 0000002a  reference 00000000") != std::string::npos);
+}
+
+// Every ISA entry decodes from its canonical encoding through the generated
+// table, and the bits outside the table index are still checked.
+void Test20()
+{
+    for (auto const &desc : Sim::isaDescription) {
+        if (desc.isaEntry == Sim::ISAEntry::UNKNOWN) {
+            continue;
+        }
+        u32_t raw = (u32_t)desc.opcode | ((u32_t)desc.funct3 << 12) | ((u32_t)desc.funct7 << 25);
+        if (desc.isaEntry == Sim::ISAEntry::EBREAK) {
+            raw |= 1 << 20;
+        }
+        assert(&Sim::UnpackISAEntryDescription({ .raw = raw }) == &desc);
+    }
+
+    u32_t const invalid[] = {
+        EncodeI(0, 1, 0b000, 3, 0b0010000),                 // addi without opcode[1:0] = 0b11
+        EncodeR(0x01, 2, 1, 0b000, 3, 0b0110011),           // add, funct7 = 0x01
+        EncodeR(0x21, 2, 1, 0b101, 3, 0b0110011),           // sra, funct7 = 0x21
+        EncodeI((0x21 << 5) | 3, 1, 0b101, 3, 0b0010011),   // srai, funct7 = 0x21
+        EncodeI(2, 0, 0b000, 0, 0b1110011),                 // system, imm = 2
+        EncodeI(0x801, 0, 0b000, 0, 0b1110011),             // system, imm = 0x801
+        EncodeB(8, 2, 1, 0b010, 0b1100011),                 // branch, funct3 = 2
+        EncodeI(0, 1, 0b011, 3, 0b0000011),                 // load, funct3 = 3
+        EncodeS(0, 2, 1, 0b011, 0b0100011),                 // store, funct3 = 3
+    };
+    for ([[maybe_unused]] u32_t raw : invalid) {
+        assert(Sim::DecodeISAEntry({ .raw = raw }) == Sim::ISAEntry::UNKNOWN);
+    }
+}
+
+void Test21()
+{
+    // Random words with a valid opcode, so that most decode, plus all-random
+    // ones; the count is not a multiple of any step so every tail is hit.
+    u8_t const opcodes[] = { 0b0110111, 0b0010111, 0b1101111, 0b1100111, 0b1100011, 0b0000011,
+        0b0100011, 0b0010011, 0b0110011, 0b0001111, 0b1110011 };
+    u32_t state = 1;
+    std::vector<Sim::Instruction> words = {};
+    for (u32_t i = 0; i < 10007; ++i) {
+        state = state * 1103515245U + 12345U;
+        u32_t raw = state ^ (state << 13);
+        if (i % 8) {
+            raw = (raw & ~(u32_t)0x7f) | opcodes[(state >> 16) % std::size(opcodes)];
+        }
+        words.push_back({ .raw = raw });
+    }
+    words.push_back({ .raw = 0x00000073U });
+    words.push_back({ .raw = 0x00100073U });
+
+    Sim::DecodeStage stage = {};
+    for (auto path : { Sim::BatchDecoder::Path::SCALAR, Sim::BatchDecoder::Path::SSE4, Sim::BatchDecoder::Path::AVX2 }) {
+        if (path > Sim::BatchDecoder::Best()) {
+            continue;
+        }
+        Sim::BatchDecoder batch = {};
+        batch.path = path;
+        batch.Decode(words);
+        for (size_t i = 0; i < std::size(words); ++i) {
+            [[maybe_unused]] auto const expected = stage.Predecode(words[i]);
+            assert(batch.isaEntry[i] == expected.isaEntry);
+            assert(batch.iType[i] == expected.execParams.iType);
+            assert(batch.immExt[i] == expected.immExt);
+            assert(batch.rd[i] == expected.rda);
+            assert(batch.rs1[i] == expected.rs1a);
+            assert(batch.rs2[i] == expected.rs2a);
+        }
+    }
+
+    // The program's page is decoded in bulk on first touch; nothing else
+    // misses.
+    auto memory = std::vector<u32_t>(4096, 0);
+    auto code = GenerateProgram(1024, 7, 200, 20);
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code.data(), std::size(code) * sizeof(u32_t));
+    auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
+        std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, Sim::ExecMode::FUNCTIONAL);
+    env.Execute(1024);
+    assert(env.cpu.decodeStage.regfile.gpr[31] == 0);
+    assert(env.cpu.decodeCache.prefills == 1);
+    assert(env.cpu.decodeCache.misses == 1);
+}
+
+void Test22()
+{
+    u32_t constexpr LANES = 13;
+    auto compare = [](Sim::LaneEngine &engine, std::vector<Sim::CPUEnv> &refs) {
+        for (u32_t l = 0; l < engine.Lanes(); ++l) {
+            [[maybe_unused]] Sim::CPU &cpu = engine.Lane(l).cpu;
+            [[maybe_unused]] Sim::CPU &ref = refs[l].cpu;
+            assert(std::equal(std::begin(cpu.decodeStage.regfile.gpr), std::end(cpu.decodeStage.regfile.gpr),
+                std::begin(ref.decodeStage.regfile.gpr)));
+            assert(cpu.fetchStage.state.read.pc == ref.fetchStage.state.read.pc);
+            assert(cpu.cycles == ref.cycles && cpu.shutdown == ref.shutdown);
+            assert(cpu.huModule.exceptionPC == ref.huModule.exceptionPC);
+            for (u32_t a = 0; a < 4096 * sizeof(u32_t); a += sizeof(u32_t)) {
+                assert(cpu.mmu.Peek(a) == ref.mmu.Peek(a));
+            }
+        }
+    };
+
+    for (auto path : { Sim::LaneEngine::Path::SCALAR, Sim::LaneEngine::Path::AVX2, Sim::LaneEngine::Path::AVX512 }) {
+        if (path > Sim::LaneEngine::Best()) {
+            continue;
+        }
+        for (u32_t seed = 1; seed <= 4; ++seed) {
+            auto memory = std::vector<u32_t>(4096, 0);
+            auto code = GenerateProgram(1024, seed, 200, 20);
+            std::memcpy(memory.data() + 1024 / sizeof(u32_t), code.data(), std::size(code) * sizeof(u32_t));
+
+            // Lanes differ in the data the program loads, so their branches
+            // go apart; the last seeds cut the run short or force fallback.
+            Sim::LaneEngine engine(memory.data(), std::size(memory) * sizeof(u32_t), LANES);
+            engine.path = path;
+            engine.minOccupancy = seed == 4 ? 101 : engine.minOccupancy;
+            u32_t const budget = seed == 3 ? 1500 : ~(u32_t)0;
+            std::vector<Sim::CPUEnv> refs = {};
+            for (u32_t l = 0; l < LANES; ++l) {
+                refs.emplace_back(memory.data(), std::size(memory) * sizeof(u32_t));
+                u32_t state = seed * 977 + l;
+                for (u32_t a = 128; a < 1024; a += sizeof(u32_t)) {
+                    state = state * 1103515245U + 12345U;
+                    u32_t const word = l ? state : 0;
+                    engine.Lane(l).cpu.mmu.Poke(a, word);
+                    refs[l].cpu.mmu.Poke(a, word);
+                }
+                Sim::CPU &ref = refs[l].cpu;
+                ref.fetchStage.state.read.pc = 1024;
+                while (!ref.shutdown && ref.cycles < budget) {
+                    refs[l].interpreter.Execute(ref, budget - ref.cycles);
+                }
+            }
+
+            engine.Run(1024, budget);
+            compare(engine, refs);
+            assert(engine.fellBack == (seed == 4));
+            if (seed < 3) {
+                assert(engine.vectorRetired > 10 * engine.scalarRetired);
+                assert(engine.vectorRetired < engine.steps * LANES);
+            }
+        }
+
+        // Each lane polls the timer up to its own deadline, so loads through
+        // the kernels must see the lane's cycles as they are.
+        auto memory = std::vector<u32_t>(4096, 0);
+        u32_t const code[] = {
+            EncodeI(128, 0, 0b010, 9, 0b0000011),   // lw s1, 128(zero)
+            EncodeI(1, 0, 0b000, 29, 0b0010011),    // addi t4, zero, 1
+            EncodeI(25, 29, 0b001, 29, 0b0010011),  // slli t4, t4, 25 (timer)
+            EncodeI(0, 29, 0b010, 7, 0b0000011),    // loop: lw t2, 0(t4)
+            EncodeB(-4, 9, 7, 0b110, 0b1100011),    // bltu t2, s1, loop
+            0x00100073U                             // ebreak
+        };
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+
+        Sim::LaneEngine engine(memory.data(), std::size(memory) * sizeof(u32_t), LANES);
+        engine.path = path;
+        Sim::Timer timers[2 * LANES] = {};
+        std::vector<Sim::CPUEnv> refs = {};
+        for (u32_t l = 0; l < LANES; ++l) {
+            refs.emplace_back(memory.data(), std::size(memory) * sizeof(u32_t));
+            engine.Lane(l).cpu.mmu.Poke(128, 200 + 37 * l);
+            refs[l].cpu.mmu.Poke(128, 200 + 37 * l);
+            timers[l].Attach(engine.Lane(l).cpu.mmu);
+            timers[LANES + l].Attach(refs[l].cpu.mmu);
+            refs[l].cpu.fetchStage.state.read.pc = 1024;
+            refs[l].interpreter.Execute(refs[l].cpu);
+        }
+        engine.Run(1024);
+        compare(engine, refs);
+        assert(engine.Lane(LANES - 1).cpu.shutdown && engine.vectorRetired > engine.scalarRetired);
+    }
+}
+
+void Test23(Sim::ExecMode mode)
+{
+    {
+        auto env = Sim::CPUEnv(std::vector<u32_t>(4096, 0));
+        Sim::AtomicUnit unit = {};
+        unit.Attach(env.cpu.mmu);
+        [[maybe_unused]] auto op = [&env](u32_t addr, u32_t offset, u32_t data, u32_t expect = 0) {
+            u32_t old = 0;
+            env.cpu.mmu.Store(env.cpu, Sim::AtomicUnit::BASE + Sim::AtomicUnit::ADDR, addr);
+            env.cpu.mmu.Store(env.cpu, Sim::AtomicUnit::BASE + Sim::AtomicUnit::DATA, data);
+            env.cpu.mmu.Store(env.cpu, Sim::AtomicUnit::BASE + Sim::AtomicUnit::EXPECT, expect);
+            env.cpu.mmu.Load(env.cpu, Sim::AtomicUnit::BASE + offset, &old);
+            return old;
+        };
+        env.cpu.mmu.Poke(256, 5);
+        assert(op(256, Sim::AtomicUnit::ADD, 3) == 5 && env.cpu.mmu.Peek(256) == 8);
+        assert(op(256, Sim::AtomicUnit::SWAP, (u32_t)-16) == 8);
+        assert(op(256, Sim::AtomicUnit::MIN, 1) == (u32_t)-16 && env.cpu.mmu.Peek(256) == (u32_t)-16);
+        assert(op(256, Sim::AtomicUnit::MINU, 1) == (u32_t)-16 && env.cpu.mmu.Peek(256) == 1);
+        assert(op(256, Sim::AtomicUnit::MAX, (u32_t)-3) == 1 && env.cpu.mmu.Peek(256) == 1);
+        assert(op(256, Sim::AtomicUnit::MAXU, (u32_t)-3) == 1 && env.cpu.mmu.Peek(256) == (u32_t)-3);
+        assert(op(256, Sim::AtomicUnit::AND, 0xff) == (u32_t)-3 && env.cpu.mmu.Peek(256) == 0xfd);
+        assert(op(256, Sim::AtomicUnit::OR, 0x102) == 0xfd && env.cpu.mmu.Peek(256) == 0x1ff);
+        assert(op(256, Sim::AtomicUnit::XOR, 0x0f0) == 0x1ff && env.cpu.mmu.Peek(256) == 0x10f);
+        assert(op(256, Sim::AtomicUnit::CAS, 7, 6) == 0x10f && env.cpu.mmu.Peek(256) == 0x10f);
+        assert(op(256, Sim::AtomicUnit::CAS, 7, 0x10f) == 0x10f && env.cpu.mmu.Peek(256) == 7);
+        // Device registers and unaligned words are not operated on.
+        assert(op(Sim::AtomicUnit::BASE, Sim::AtomicUnit::ADD, 1) == 0 && unit.addr == Sim::AtomicUnit::BASE);
+        assert(op(258, Sim::AtomicUnit::SWAP, 1) == 0 && env.cpu.mmu.Peek(256) == 7);
+        assert(op(1 << 20, Sim::AtomicUnit::SWAP, 1) == 0);
+
+        // Byte and halfword stores leave the rest of the word alone.
+        env.cpu.mmu.Poke(260, 0x11223344);
+        [[maybe_unused]] auto ex = env.cpu.mmu.Store(env.cpu, 261, 0xab, Sim::CUMemOp::BYTE);
+        assert(ex == Sim::HUExceptionType::NONE && env.cpu.mmu.Peek(260) == 0x1122ab44);
+        ex = env.cpu.mmu.Store(env.cpu, 262, 0x1cdef, Sim::CUMemOp::HALF);
+        assert(ex == Sim::HUExceptionType::NONE && env.cpu.mmu.Peek(260) == 0xcdefab44);
+        ex = env.cpu.mmu.Store(env.cpu, 263, 0, Sim::CUMemOp::HALF);
+        assert(ex == Sim::HUExceptionType::UNALIGNED_ADDR && env.cpu.mmu.Peek(260) == 0xcdefab44);
+    }
+
+    // Every hart adds to a counter through its atomic unit and, under a CAS
+    // spinlock, to a plain one, and stores to its own byte of a shared word;
+    // hart 0 then publishes a value behind a fence that the others wait for.
+    u32_t constexpr HARTS = 4;
+    u32_t constexpr ITERATIONS = 300;
+    u32_t const code[] = {
+        EncodeU(Sim::AtomicUnit::BASE >> 12, 5, 0b0110111), // lui t0, atomic unit
+        EncodeI(1, 0, 0b000, 7, 0b0010011),          // addi t2, zero, 1
+        EncodeS(4, 7, 5, 0b010, 0b0100011),          // sw t2, DATA(t0)
+        EncodeI(ITERATIONS, 0, 0b000, 28, 0b0010011), // addi t3, zero, ITERATIONS
+        EncodeI(512, 0, 0b000, 6, 0b0010011),        // loop: addi t1, zero, 512
+        EncodeS(0, 6, 5, 0b010, 0b0100011),          // sw t1, ADDR(t0)
+        EncodeI(16, 5, 0b010, 29, 0b0000011),        // lw t4, ADD(t0)
+        EncodeI(520, 0, 0b000, 6, 0b0010011),        // addi t1, zero, 520
+        EncodeS(0, 6, 5, 0b010, 0b0100011),          // sw t1, ADDR(t0)
+        EncodeS(8, 0, 5, 0b010, 0b0100011),          // sw zero, EXPECT(t0)
+        EncodeI(48, 5, 0b010, 29, 0b0000011),        // lock: lw t4, CAS(t0)
+        EncodeB((u32_t)-4, 0, 29, 0b001, 0b1100011), // bne t4, zero, lock
+        EncodeI(516, 0, 0b010, 30, 0b0000011),       // lw t5, 516(zero)
+        EncodeI(1, 30, 0b000, 30, 0b0010011),        // addi t5, t5, 1
+        EncodeS(516, 30, 0, 0b010, 0b0100011),       // sw t5, 516(zero)
+        0x0ff0000fU,                                 // fence
+        EncodeS(520, 0, 0, 0b010, 0b0100011),        // sw zero, 520(zero)
+        EncodeI(1, 10, 0b000, 6, 0b0010011),         // addi t1, a0, 1
+        EncodeS(532, 6, 10, 0b000, 0b0100011),       // sb t1, 532(a0)
+        EncodeI((u32_t)-1, 28, 0b000, 28, 0b0010011), // addi t3, t3, -1
+        EncodeB((u32_t)-64, 0, 28, 0b001, 0b1100011), // bne t3, zero, loop
+        EncodeB(20, 0, 10, 0b001, 0b1100011),        // bne a0, zero, wait
+        EncodeI(0x5a5, 0, 0b000, 6, 0b0010011),      // addi t1, zero, 0x5a5
+        EncodeS(524, 6, 0, 0b010, 0b0100011),        // sw t1, 524(zero)
+        0x0ff0000fU,                                 // fence
+        EncodeS(528, 7, 0, 0b010, 0b0100011),        // sw t2, 528(zero)
+        EncodeI(528, 0, 0b010, 30, 0b0000011),       // wait: lw t5, 528(zero)
+        EncodeB((u32_t)-4, 0, 30, 0b000, 0b1100011), // beq t5, zero, wait
+        0x0ff0000fU,                                 // fence
+        EncodeI(524, 0, 0b010, 31, 0b0000011),       // lw t6, 524(zero)
+        EncodeI(2, 10, 0b001, 6, 0b0010011),         // slli t1, a0, 2
+        EncodeS(768, 31, 6, 0b010, 0b0100011),       // sw t6, 768(t1)
+        0x00100073U                                  // ebreak
+    };
+    auto memory = std::vector<u32_t>(4096, 0);
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+
+    for (u64_t quantum : { (u64_t)1, (u64_t)64, ~(u64_t)0 }) {
+        Sim::SmpSystem smp(memory.data(), std::size(memory) * sizeof(u32_t), HARTS);
+        for (u32_t i = 0; i < HARTS; ++i) {
+            SetMode(smp.Hart(i), mode);
+        }
+        smp.quantum = quantum;
+        smp.Run(1024);
+
+        [[maybe_unused]] u32_t const *shared = smp.Memory();
+        assert(shared[512 / 4] == HARTS * ITERATIONS);
+        assert(shared[516 / 4] == HARTS * ITERATIONS);
+        assert(shared[520 / 4] == 0);
+        assert(shared[532 / 4] == 0x04030201);
+        for (u32_t i = 0; i < HARTS; ++i) {
+            assert(smp.Hart(i).cpu.shutdown);
+            assert(smp.Hart(i).cpu.huModule.exceptionPC == 1024 + 4 * 32);
+            assert(shared[768 / 4 + i] == 0x5a5);
+        }
+        assert(quantum != 1 || smp.rounds > ITERATIONS);
+    }
+
+    // A budget stops every hart, the spinning ones included.
+    Sim::SmpSystem smp(memory.data(), std::size(memory) * sizeof(u32_t), HARTS);
+    for (u32_t i = 0; i < HARTS; ++i) {
+        SetMode(smp.Hart(i), mode);
+    }
+    smp.quantum = 16;
+    smp.Run(1024, 200);
+    for (u32_t i = 0; i < HARTS; ++i) {
+        assert(!smp.Hart(i).cpu.shutdown && smp.Hart(i).cpu.cycles >= 200);
+    }
+    assert(smp.Memory()[512 / 4] < HARTS * ITERATIONS);
+}
+
+// A faulting load or store in a block traps once and leaves the registers
+// of the instructions after it alone. Compiled blocks take the trap
+// themselves instead of handing the access back to the interpreter, which
+// would decode and perform it again.
+void Test24(Sim::ExecMode mode)
+{
+    u32_t const faults[] = {
+        EncodeI(257, 0, 0b010, 6, 0b0000011), // lw t1, 257(zero)
+        EncodeS(258, 5, 0, 0b010, 0b0100011), // sw t0, 258(zero)
+    };
+    for (u32_t fault : faults) {
+        auto memory = std::vector<u32_t>(4096, 0);
+        u32_t const code[] = {
+            EncodeI(7, 0, 0b000, 5, 0b0010011), // addi t0, zero, 7
+            fault,
+            EncodeI(1, 0, 0b000, 7, 0b0010011), // addi t2, zero, 1
+            0x00100073U                         // ebreak
+        };
+        std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+
+        auto env = Sim::CPUEnv(std::vector<u32_t>(memory));
+        SetMode(env, mode);
+        env.Execute(1024);
+
+        auto const &cpu = env.cpu;
+        [[maybe_unused]] u32_t const *gpr = cpu.decodeStage.regfile.gpr;
+        assert(cpu.shutdown && cpu.huModule.trapCount == 1);
+        assert(cpu.huModule.exceptionType == Sim::HUExceptionType::UNALIGNED_ADDR);
+        assert(cpu.huModule.exceptionPC == 1024 + 4);
+        assert(gpr[5] == 7 && gpr[6] == 0 && gpr[7] == 0 && cpu.mmu.Peek(256) == 0);
+
+        if (mode == Sim::ExecMode::JIT) {
+            auto block = Sim::CPUEnv(std::move(memory));
+            SetMode(block, Sim::ExecMode::BLOCK);
+            block.Execute(1024);
+            assert(cpu.jit.compiledBlocks > 0 && cpu.decodeCache.hits == block.cpu.decodeCache.hits);
+        }
+    }
+}
+
+// A loop decodes each word once.
+void Test25(Sim::ExecMode mode)
+{
+    auto memory = std::vector<u32_t>(4096, 0);
+    u32_t const code[] = {
+        EncodeI(0, 0, 0b000, 10, 0b0010011),   // li a0, 0
+        EncodeI(100, 0, 0b000, 11, 0b0010011), // li a1, 100
+        EncodeI(1, 10, 0b000, 10, 0b0010011),  // addi a0, a0, 1 (loop)
+        EncodeB(-4, 11, 10, 0b100, 0b1100011), // blt a0, a1, loop
+        0x00100073U                            // ebreak
+    };
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+    auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
+        std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
+
+    env.Execute(1024);
+    assert(env.cpu.huModule.exceptionPC == 1024 + 4 * 4);
+    assert(env.cpu.decodeStage.regfile.gpr[10] == 100);
+    assert(env.cpu.decodeCache.misses <= std::size(code) + Sim::CPUEnv::TVEC_HANDLER_SIZE / sizeof(u32_t));
+}
+
+// A loop over two blocks goes from one to the other through their links.
+void Test26(Sim::ExecMode mode)
+{
+    auto memory = std::vector<u32_t>(4096, 0);
+    u32_t const code[] = {
+        EncodeI(0, 0, 0b000, 10, 0b0010011),   // li a0, 0
+        EncodeI(100, 0, 0b000, 11, 0b0010011), // li a1, 100
+        EncodeI(1, 10, 0b000, 10, 0b0010011),  // addi a0, a0, 1 (loop)
+        EncodeJ(4, 0, 0b1101111),              // j next
+        EncodeB(-8, 11, 10, 0b100, 0b1100011), // blt a0, a1, loop (next)
+        0x00100073U                            // ebreak
+    };
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+    auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
+        std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
+
+    env.Execute(1024);
+    assert(env.cpu.huModule.exceptionPC == 1024 + 4 * 5);
+    assert(env.cpu.decodeStage.regfile.gpr[10] == 100);
+    // Both links are followed from their second use on.
+    if (mode == Sim::ExecMode::BLOCK) {
+        assert(env.cpu.blockCache.chainHits >= 2 * 98);
+    }
+}
+
+// Loads and stores to one word miss the TLB at most once for each.
+void Test27(Sim::ExecMode mode)
+{
+    auto memory = std::vector<u32_t>(4096, 0);
+    u32_t const code[] = {
+        EncodeI(0, 0, 0b000, 10, 0b0010011),    // li a0, 0
+        EncodeI(100, 0, 0b000, 11, 0b0010011),  // li a1, 100
+        EncodeI(256, 0, 0b010, 12, 0b0000011),  // lw a2, 256(zero) (loop)
+        EncodeI(3, 12, 0b000, 12, 0b0010011),   // addi a2, a2, 3
+        EncodeS(256, 12, 0, 0b010, 0b0100011),  // sw a2, 256(zero)
+        EncodeI(1, 10, 0b000, 10, 0b0010011),   // addi a0, a0, 1
+        EncodeB(-16, 11, 10, 0b100, 0b1100011), // blt a0, a1, loop
+        0x00100073U                             // ebreak
+    };
+    std::memcpy(memory.data() + 1024 / sizeof(u32_t), code, sizeof(code));
+    auto env = Sim::CPUEnv(memory.data(), std::size(memory) * sizeof(u32_t),
+        std::size(memory) * sizeof(u32_t) - Sim::CPUEnv::TVEC_HANDLER_SIZE);
+    SetMode(env, mode);
+
+    env.Execute(1024);
+    assert(env.cpu.huModule.exceptionPC == 1024 + 4 * 7);
+    assert(env.cpu.mmu.Peek(256) == 300);
+    assert(env.cpu.mmu.tlb.hits >= 2 * 100 && env.cpu.mmu.tlb.misses <= 2);
+}
+
 int main()
 {
-    Test0();
-    Test1();
-    Test2();
-    Test3();
-    Test4();
+    Test0(Sim::ExecMode::PIPELINE);
+    Test0(Sim::ExecMode::FUNCTIONAL);
+    Test0(Sim::ExecMode::BLOCK);
+    Test0(Sim::ExecMode::JIT);
+    Test1(Sim::ExecMode::PIPELINE);
+    Test1(Sim::ExecMode::FUNCTIONAL);
+    Test1(Sim::ExecMode::BLOCK);
+    Test1(Sim::ExecMode::JIT);
+    Test2(Sim::ExecMode::PIPELINE);
+    Test2(Sim::ExecMode::FUNCTIONAL);
+    Test2(Sim::ExecMode::BLOCK);
+    Test2(Sim::ExecMode::JIT);
+    Test3(Sim::ExecMode::PIPELINE);
+    Test3(Sim::ExecMode::FUNCTIONAL);
+    Test3(Sim::ExecMode::BLOCK);
+    Test3(Sim::ExecMode::JIT);
+    Test4(Sim::ExecMode::PIPELINE);
+    Test4(Sim::ExecMode::FUNCTIONAL);
+    Test4(Sim::ExecMode::BLOCK);
+    Test4(Sim::ExecMode::JIT);
+    Test5(Sim::ExecMode::PIPELINE);
+    Test5(Sim::ExecMode::FUNCTIONAL);
+    Test5(Sim::ExecMode::BLOCK);
+    Test5(Sim::ExecMode::JIT);
+    Test6();
+    Test7(Sim::ExecMode::PIPELINE);
+    Test7(Sim::ExecMode::FUNCTIONAL);
+    Test7(Sim::ExecMode::BLOCK);
+    Test7(Sim::ExecMode::JIT);
+    Test8(Sim::ExecMode::PIPELINE);
+    Test8(Sim::ExecMode::FUNCTIONAL);
+    Test8(Sim::ExecMode::BLOCK);
+    Test8(Sim::ExecMode::JIT);
+    Test9(Sim::ExecMode::PIPELINE);
+    Test9(Sim::ExecMode::FUNCTIONAL);
+    Test9(Sim::ExecMode::BLOCK);
+    Test9(Sim::ExecMode::JIT);
+    Test10(Sim::ExecMode::PIPELINE);
+    Test10(Sim::ExecMode::FUNCTIONAL);
+    Test10(Sim::ExecMode::BLOCK);
+    Test10(Sim::ExecMode::JIT);
+    Test11(Sim::MMUBackend::FLAT);
+    Test11(Sim::MMUBackend::PAGED);
+    Test12(Sim::ExecMode::PIPELINE);
+    Test12(Sim::ExecMode::FUNCTIONAL);
+    Test12(Sim::ExecMode::BLOCK);
+    Test12(Sim::ExecMode::JIT);
+    Test13();
+    Test14(Sim::ExecMode::PIPELINE);
+    Test14(Sim::ExecMode::FUNCTIONAL);
+    Test14(Sim::ExecMode::BLOCK);
+    Test14(Sim::ExecMode::JIT);
+    Test15(Sim::ExecMode::PIPELINE);
+    Test15(Sim::ExecMode::FUNCTIONAL);
+    Test15(Sim::ExecMode::BLOCK);
+    Test15(Sim::ExecMode::JIT);
+    Test16<Sim::PERF_COUNTERS>();
+    Test17(Sim::ExecMode::PIPELINE);
+    Test17(Sim::ExecMode::FUNCTIONAL);
+    Test17(Sim::ExecMode::BLOCK);
+    Test17(Sim::ExecMode::JIT);
+    Test18();
+    Test19(Sim::ExecMode::PIPELINE);
+    Test19(Sim::ExecMode::FUNCTIONAL);
+    Test19(Sim::ExecMode::BLOCK);
+    Test19(Sim::ExecMode::JIT);
+    Test20();
+    Test21();
+    Test22();
+    Test23(Sim::ExecMode::PIPELINE);
+    Test23(Sim::ExecMode::FUNCTIONAL);
+    Test23(Sim::ExecMode::BLOCK);
+    Test23(Sim::ExecMode::JIT);
+    Test24(Sim::ExecMode::PIPELINE);
+    Test24(Sim::ExecMode::FUNCTIONAL);
+    Test24(Sim::ExecMode::BLOCK);
+    Test24(Sim::ExecMode::JIT);
+    Test25(Sim::ExecMode::PIPELINE);
+    Test25(Sim::ExecMode::FUNCTIONAL);
+    Test25(Sim::ExecMode::BLOCK);
+    Test25(Sim::ExecMode::JIT);
+    Test26(Sim::ExecMode::PIPELINE);
+    Test26(Sim::ExecMode::FUNCTIONAL);
+    Test26(Sim::ExecMode::BLOCK);
+    Test26(Sim::ExecMode::JIT);
+    Test27(Sim::ExecMode::PIPELINE);
+    Test27(Sim::ExecMode::FUNCTIONAL);
+    Test27(Sim::ExecMode::BLOCK);
+    Test27(Sim::ExecMode::JIT);
 
     return 0;
 }
@@ -0,0 +1,71 @@
+#include "paged_memory.h"
+
+#include <utility>
+
+namespace Sim {
+
+PagedMemory::PagedMemory(PagedMemory const &other)
+{
+    *this = other;
+}
+
+PagedMemory &PagedMemory::operator=(PagedMemory const &other)
+{
+    if (this == &other) {
+        return *this;
+    }
+    for (u32_t i = 0; i < L1_SIZE; ++i) {
+        tables[i] = other.tables[i] ? std::make_unique<Table>(*other.tables[i]) : nullptr;
+    }
+    allocatedPages = other.allocatedPages;
+    return *this;
+}
+
+PagedMemory::Page &PagedMemory::WritablePage(u32_t a)
+{
+    auto &page = Slot(a);
+    if (page == ZeroPage()) {
+        page = std::make_shared<Page>();
+        ++allocatedPages;
+    } else if (page.use_count() > 1) {
+        page = std::make_shared<Page>(*page);
+    }
+    return *page;
+}
+
+void PagedMemory::MapShared(u32_t a, std::shared_ptr<Page> page)
+{
+    auto &slot = Slot(a);
+    if (slot == ZeroPage()) {
+        ++allocatedPages;
+    }
+    slot = std::move(page);
+}
+
+void PagedMemory::CopyPage(u32_t a, PagedMemory const &from)
+{
+    auto const &table = from.tables[a >> (PAGE_SHIFT + L2_SHIFT)];
+    auto const &page = table ? (*table)[(a >> PAGE_SHIFT) & (L2_SIZE - 1)] : ZeroPage();
+    auto &slot = Slot(a);
+
+    allocatedPages += (page != ZeroPage()) - (slot != ZeroPage());
+    slot = page;
+}
+
+std::shared_ptr<PagedMemory::Page> &PagedMemory::Slot(u32_t a)
+{
+    auto &table = tables[a >> (PAGE_SHIFT + L2_SHIFT)];
+    if (!table) {
+        table = std::make_unique<Table>();
+        table->fill(ZeroPage());
+    }
+    return (*table)[(a >> PAGE_SHIFT) & (L2_SIZE - 1)];
+}
+
+std::shared_ptr<PagedMemory::Page> const &PagedMemory::ZeroPage()
+{
+    static std::shared_ptr<Page> const zeroPage = std::make_shared<Page>();
+    return zeroPage;
+}
+
+} // namespace Sim
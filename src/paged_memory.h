@@ -0,0 +1,97 @@
+#ifndef SIM_PAGED_MEMORY_H
+#define SIM_PAGED_MEMORY_H
+
+#include <types.h>
+#include <array>
+#include <memory>
+
+namespace Sim {
+
+// Sparse 32-bit guest address space: a two-level table of 4 KiB pages.
+// Untouched pages alias a shared zero page and get a private copy on the
+// first write, as do pages shared with another PagedMemory after a copy.
+struct PagedMemory final {
+public:
+    static constexpr u32_t PAGE_SHIFT = 12;
+    static constexpr u32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+    static constexpr u32_t PAGE_WORDS = PAGE_SIZE / sizeof(u32_t);
+    static constexpr u32_t L2_SHIFT = 10;
+    static constexpr u32_t L2_SIZE = 1 << L2_SHIFT;
+    static constexpr u32_t L1_SIZE = 1 << (32 - PAGE_SHIFT - L2_SHIFT);
+
+    struct Page final {
+        u32_t words[PAGE_WORDS] = {};
+    };
+
+    PagedMemory() = default;
+    PagedMemory(PagedMemory const &other);
+    PagedMemory &operator=(PagedMemory const &other);
+    PagedMemory(PagedMemory &&other) = default;
+    PagedMemory &operator=(PagedMemory &&other) = default;
+
+    u32_t Read(u32_t a) const
+    {
+        auto const &table = tables[a >> (PAGE_SHIFT + L2_SHIFT)];
+        if (!table) {
+            return 0;
+        }
+        return (*table)[(a >> PAGE_SHIFT) & (L2_SIZE - 1)]->words[(a % PAGE_SIZE) / sizeof(u32_t)];
+    }
+
+    void Write(u32_t a, u32_t data)
+    {
+        WritablePage(a).words[(a % PAGE_SIZE) / sizeof(u32_t)] = data;
+    }
+
+    Page &WritablePage(u32_t a);
+
+    // Install a page owned elsewhere (e.g. by a file mapping) at a. It is
+    // copied on the first write unless this is its only reference, so it must
+    // be writable memory. Host TLBs caching a must be flushed.
+    void MapShared(u32_t a, std::shared_ptr<Page> page);
+
+    // Current page backing a, possibly the shared zero page; must not be
+    // written through.
+    Page *PageAt(u32_t a) const
+    {
+        auto const &table = tables[a >> (PAGE_SHIFT + L2_SHIFT)];
+        return table ? (*table)[(a >> PAGE_SHIFT) & (L2_SIZE - 1)].get() : ZeroPage().get();
+    }
+
+    // Make the page at a the same (shared) page as in `from`.
+    void CopyPage(u32_t a, PagedMemory const &from);
+
+    // Calls f(address, page) for every page that is not the zero page.
+    template<typename F>
+    void ForEachPage(F &&f) const
+    {
+        for (u32_t i = 0; i < L1_SIZE; ++i) {
+            if (!tables[i]) {
+                continue;
+            }
+            for (u32_t j = 0; j < L2_SIZE; ++j) {
+                if ((*tables[i])[j] != ZeroPage()) {
+                    f((i << (PAGE_SHIFT + L2_SHIFT)) | (j << PAGE_SHIFT), *(*tables[i])[j]);
+                }
+            }
+        }
+    }
+
+    u32_t AllocatedPages() const
+    {
+        return allocatedPages;
+    }
+
+private:
+    using Table = std::array<std::shared_ptr<Page>, L2_SIZE>;
+
+    std::array<std::unique_ptr<Table>, L1_SIZE> tables = {};
+    u32_t allocatedPages = 0;
+
+    std::shared_ptr<Page> &Slot(u32_t a);
+    static std::shared_ptr<Page> const &ZeroPage();
+};
+
+} // namespace Sim
+
+#endif // SIM_PAGED_MEMORY_H
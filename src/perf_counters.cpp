@@ -0,0 +1,48 @@
+#include "perf_counters.h"
+#include "cpu.h"
+
+#include <cinttypes>
+#include <type_traits>
+
+namespace Sim {
+
+static_assert((u32_t)HURS::BP_WB + 1 == PerfCounters<true>::HURS_COUNT);
+static_assert((u32_t)HUExceptionType::INT + 1 == PerfCounters<true>::EXCEPTION_COUNT);
+static_assert(std::is_empty_v<PerfCounters<false>> && std::is_empty_v<PerfCounters<false>::Tag>);
+
+void PerfCounters<true>::Print(std::FILE *out) const
+{
+    static char const *const rsNames[HURS_COUNT] = { "reg", "bp-mem", "bp-wb" };
+    static char const *const exceptionNames[EXCEPTION_COUNT] = {
+        "none", "bad-opcode", "unaligned", "mmu-miss", "int"
+    };
+
+    u64_t const n = Retired();
+    double const percent = cycles ? 100.0 / cycles : 0;
+
+    std::fprintf(out, "cycles %" PRIu64 " retired %" PRIu64 " cpi %.3f\n", cycles, n,
+        n ? (double)cycles / n : 0.0);
+    // A load-use stall costs one bubble, a taken branch or jump two.
+    std::fprintf(out, "load-use stalls %" PRIu64 " (%.1f%% of cycles)\n", loadUseStalls,
+        loadUseStalls * percent);
+    std::fprintf(out, "flushes %" PRIu64 " (%.1f%% of cycles)\n", flushes, 2 * flushes * percent);
+
+    std::fprintf(out, "forwarding");
+    for (u32_t i = 0; i < HURS_COUNT; ++i) {
+        std::fprintf(out, " %s %" PRIu64, rsNames[i], forwards[i]);
+    }
+    std::fprintf(out, "\nexceptions");
+    for (u32_t i = 1; i < EXCEPTION_COUNT; ++i) {
+        std::fprintf(out, " %s %" PRIu64, exceptionNames[i], exceptions[i]);
+    }
+    std::fprintf(out, "\n");
+
+    for (u32_t i = 0; i < ENTRY_COUNT; ++i) {
+        if (retired[i]) {
+            std::fprintf(out, "  %-8s %12" PRIu64 " %5.1f%%\n", isaDescription[i].asmStr, retired[i],
+                100.0 * retired[i] / n);
+        }
+    }
+}
+
+} // namespace Sim
@@ -0,0 +1,122 @@
+#ifndef SIM_PERF_COUNTERS_H
+#define SIM_PERF_COUNTERS_H
+
+#include <types.h>
+#include <isa.h>
+#include <cstdio>
+
+namespace Sim {
+
+enum class HURS : u8_t;
+enum class HUExceptionType : u8_t;
+
+#ifdef SIM_PERF_COUNTERS
+inline constexpr bool PERF_COUNTERS = true;
+#else
+inline constexpr bool PERF_COUNTERS = false;
+#endif
+
+// Event counters filled in by every execution engine. Only the pipeline has
+// stalls, flushes and forwarding; the functional engines count one cycle per
+// instruction. Retirement is counted when an instruction leaves the memory
+// stage without raising, or completes in the functional engines.
+// PerfCounters<false> is empty and all of its hooks are no-ops, so disabled
+// counters cost nothing; CPU uses PerfCounters<PERF_COUNTERS>, set with the
+// SIM_PERF_COUNTERS CMake option.
+template<bool enabled>
+struct PerfCounters;
+
+template<>
+struct PerfCounters<false> final {
+public:
+    // Travels with an instruction through the pipeline latches.
+    struct Tag final {
+    public:
+        Tag() = default;
+        explicit Tag(ISAEntry) {}
+    };
+
+    void Cycle(u64_t = 1) {}
+    void Retire(ISAEntry) {}
+    void Retire(Tag) {}
+    void LoadUseStall() {}
+    void Flush() {}
+    void Forward(HURS) {}
+    void Exception(HUExceptionType) {}
+    void Reset() {}
+    void Print(std::FILE *) const {}
+};
+
+template<>
+struct PerfCounters<true> final {
+public:
+    static constexpr u32_t ENTRY_COUNT = (u32_t)ISAEntry::UNKNOWN + 1;
+    static constexpr u32_t HURS_COUNT = 3;
+    static constexpr u32_t EXCEPTION_COUNT = 5;
+
+    struct Tag final {
+    public:
+        Tag() = default;
+        explicit Tag(ISAEntry entry) : entry(entry) {}
+
+        ISAEntry entry = ISAEntry::UNKNOWN;
+    };
+
+    u64_t cycles = 0;
+    u64_t retired[ENTRY_COUNT] = {};
+    u64_t loadUseStalls = 0;
+    u64_t flushes = 0;
+    u64_t forwards[HURS_COUNT] = {};
+    u64_t exceptions[EXCEPTION_COUNT] = {};
+
+    void Cycle(u64_t n = 1)
+    {
+        cycles += n;
+    }
+    void Retire(ISAEntry entry)
+    {
+        ++retired[(u32_t)entry];
+    }
+    void Retire(Tag tag)
+    {
+        ++retired[(u32_t)tag.entry];
+    }
+    void LoadUseStall()
+    {
+        ++loadUseStalls;
+    }
+    void Flush()
+    {
+        ++flushes;
+    }
+    void Forward(HURS rs)
+    {
+        ++forwards[(u32_t)rs];
+    }
+    void Exception(HUExceptionType type)
+    {
+        ++exceptions[(u32_t)type];
+    }
+    void Reset()
+    {
+        *this = {};
+    }
+
+    u64_t Retired() const
+    {
+        u64_t n = 0;
+        for (u64_t count : retired) {
+            n += count;
+        }
+        return n;
+    }
+
+    // CPI and the cycles lost to each hazard, then the instruction mix.
+    void Print(std::FILE *out) const;
+};
+
+using Perf = PerfCounters<PERF_COUNTERS>;
+
+} // namespace Sim
+
+#endif // SIM_PERF_COUNTERS_H
@@ -0,0 +1,151 @@
+#include "profiler.h"
+#include "cpu.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+namespace Sim {
+
+void Profiler::Attach(CPU &cpu)
+{
+    cpu.profiler = this;
+    nextSample = cpu.cycles;
+}
+
+void Profiler::Detach(CPU &cpu)
+{
+    cpu.profiler = nullptr;
+}
+
+void Profiler::Retire(u32_t pc, u32_t raw, u64_t cycles)
+{
+    if (!started) {
+        started = true;
+        root = FunctionOf(pc);
+    }
+
+    if (pending == Edge::CALL) {
+        stack.push_back({ pc, pendingReturnPc });
+        ++calls;
+    } else if (pending == Edge::RETURN) {
+        // Unwind to the frame that returns here; a return with no matching
+        // frame (say, from the root) leaves the stack alone.
+        for (u32_t i = std::size(stack); i-- > 0;) {
+            if (stack[i].returnPc == pc) {
+                stack.resize(i);
+                ++returns;
+                break;
+            }
+        }
+    }
+    pending = Edge::NONE;
+
+    if (cycles >= nextSample) {
+        // Stay on the period's grid: restarting from a sample that was late
+        // because nothing retired locks onto one phase of a loop.
+        nextSample += ((cycles - nextSample) / period + 1) * period;
+        ++samples;
+        ++pcSamples[pc];
+
+        std::vector<u32_t> frames = { root };
+        for (auto const &frame : stack) {
+            frames.push_back(frame.entry);
+        }
+        ++stackSamples[frames];
+    }
+
+    Instruction const inst = { .raw = raw };
+    u32_t const opcode = inst.raw & 0x7f;
+    if ((opcode == (u32_t)Opcode::JAL || opcode == (u32_t)Opcode::JALR) && inst.rType.rd == 1) {
+        pending = Edge::CALL;
+        pendingReturnPc = pc + sizeof(u32_t);
+    } else if (opcode == (u32_t)Opcode::JALR && inst.rType.rd == 0 && inst.rType.rs1 == 1) {
+        pending = Edge::RETURN;
+    }
+}
+
+u64_t Profiler::SamplesAt(u32_t pc) const
+{
+    auto it = pcSamples.find(pc);
+    return it != pcSamples.end() ? it->second : 0;
+}
+
+u32_t Profiler::FunctionOf(u32_t pc) const
+{
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), pc,
+        [](u32_t a, ElfSymbol const &symbol) { return a < symbol.addr; });
+    if (it == symbols.begin()) {
+        return pc;
+    }
+    --it;
+    return (!it->size || pc - it->addr < it->size) ? it->addr : pc;
+}
+
+std::string Profiler::Symbolize(u32_t pc) const
+{
+    char buf[32] = {};
+    u32_t function = FunctionOf(pc);
+    auto it = std::lower_bound(symbols.begin(), symbols.end(), function,
+        [](ElfSymbol const &symbol, u32_t a) { return symbol.addr < a; });
+
+    if (it == symbols.end() || it->addr != function) {
+        std::snprintf(buf, sizeof(buf), "0x%08x", pc);
+        return buf;
+    }
+    if (pc == function) {
+        return it->name;
+    }
+    std::snprintf(buf, sizeof(buf), "+0x%x", pc - function);
+    return it->name + buf;
+}
+
+std::string Profiler::FlatProfile(u32_t topPcs) const
+{
+    std::map<u32_t, u64_t> functions = {};
+    for (auto const &[frames, count] : stackSamples) {
+        functions[frames.back()] += count;
+    }
+
+    auto byCount = [](auto const &a, auto const &b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    };
+    std::vector<std::pair<u32_t, u64_t>> rows(functions.begin(), functions.end());
+    std::sort(rows.begin(), rows.end(), byCount);
+
+    std::string out = {};
+    char line[160] = {};
+    std::snprintf(line, sizeof(line), "%" PRIu64 " samples, %" PRIu64 " calls, %" PRIu64 " returns\n",
+        samples, calls, returns);
+    out += line;
+    for (auto const &[function, count] : rows) {
+        std::snprintf(line, sizeof(line), "%6.2f%% %10" PRIu64 "  %s\n", 100.0 * count / samples, count,
+            Symbolize(function).c_str());
+        out += line;
+    }
+
+    rows.assign(pcSamples.begin(), pcSamples.end());
+    std::sort(rows.begin(), rows.end(), byCount);
+    rows.resize(std::min<u64_t>(std::size(rows), topPcs));
+    out += "hottest pcs\n";
+    for (auto const &[pc, count] : rows) {
+        std::snprintf(line, sizeof(line), "%6.2f%% %10" PRIu64 "  0x%08x %s\n", 100.0 * count / samples, count, pc,
+            Symbolize(pc).c_str());
+        out += line;
+    }
+    return out;
+}
+
+std::string Profiler::FoldedStacks() const
+{
+    std::string out = {};
+    for (auto const &[frames, count] : stackSamples) {
+        for (u32_t i = 0; i < std::size(frames); ++i) {
+            out += (i ? ";" : "") + Symbolize(frames[i]);
+        }
+        out += " " + std::to_string(count) + "\n";
+    }
+    return out;
+}
+
+} // namespace Sim
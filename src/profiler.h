@@ -0,0 +1,72 @@
+#ifndef SIM_PROFILER_H
+#define SIM_PROFILER_H
+
+#include <types.h>
+#include <elf_loader.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Sim {
+
+struct CPU;
+
+// Sampling guest profiler. Once attached, every engine reports each retired
+// instruction with its word and the cycle it retired in (native JIT blocks on
+// exit), and every `period` cycles the retiring pc is sampled together with a
+// shadow call stack. Calls are
+// jal/jalr with rd == ra, returns are jalr zero, 0(ra); the profiler only
+// reads guest state, so attaching it does not change timing or results.
+struct Profiler final {
+public:
+    u32_t period = 1000;
+    // Used to name functions in the reports; addresses are printed otherwise.
+    std::vector<ElfSymbol> symbols = {};
+
+    u64_t samples = 0;
+    u64_t calls = 0;
+    u64_t returns = 0;
+
+    void Attach(CPU &cpu);
+    void Detach(CPU &cpu);
+    void Retire(u32_t pc, u32_t raw, u64_t cycles);
+
+    // Samples taken as the instruction at pc retired.
+    u64_t SamplesAt(u32_t pc) const;
+
+    // Samples per function, most frequent first, then the hottest pcs.
+    std::string FlatProfile(u32_t topPcs = 20) const;
+    // One "outer;inner count" line per distinct stack, for flamegraph.pl.
+    std::string FoldedStacks() const;
+
+    std::string Symbolize(u32_t pc) const;
+
+private:
+    struct Frame final {
+        u32_t entry = 0;
+        u32_t returnPc = 0;
+    };
+
+    enum class Edge : u8_t {
+        NONE, CALL, RETURN,
+    };
+
+    u64_t nextSample = 0;
+    bool started = false;
+    u32_t root = 0;
+    std::vector<Frame> stack = {};
+    // Set by a retired call or return and resolved by the next retirement,
+    // whose pc is the jump target.
+    Edge pending = Edge::NONE;
+    u32_t pendingReturnPc = 0;
+
+    std::unordered_map<u32_t, u64_t> pcSamples = {};
+    std::map<std::vector<u32_t>, u64_t> stackSamples = {};
+
+    u32_t FunctionOf(u32_t pc) const;
+};
+
+} // namespace Sim
+
+#endif // SIM_PROFILER_H
@@ -0,0 +1,90 @@
+#include "scheduler.h"
+
+#include <algorithm>
+
+namespace Sim {
+
+void HostCall::Complete(u32_t value)
+{
+    result = value;
+    scheduler->Complete(handle);
+}
+
+void Scheduler::CallAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    CPU &cpu = call.env->cpu;
+    cpu.ReturnFromTrap(cpu.huModule.exceptionPC + sizeof(u32_t));
+
+    u32_t const *gpr = cpu.decodeStage.regfile.gpr;
+    call.number = gpr[17];
+    std::copy(gpr + 10, gpr + 16, call.args);
+    call.scheduler = &scheduler;
+    call.handle = handle;
+    scheduler.handler(call);
+}
+
+u32_t Scheduler::CallAwaiter::await_resume()
+{
+    call.env->cpu.decodeStage.regfile.gpr[10] = call.result;
+    return call.result;
+}
+
+bool Scheduler::IsHostCall(CPUEnv const &env)
+{
+    u32_t constexpr ECALL = 0x00000073;
+
+    auto const &hu = env.cpu.huModule;
+    return hu.exceptionType == HUExceptionType::INT && env.cpu.mmu.Peek(hu.exceptionPC) == ECALL;
+}
+
+GuestTask Scheduler::Guest(CPUEnv &env, u64_t slice)
+{
+    for (;;) {
+        StopReason reason = co_await Slice(env, slice);
+        if (reason == StopReason::SHUTDOWN) {
+            co_return;
+        }
+        if (reason == StopReason::EXCEPTION && IsHostCall(env)) {
+            co_await Call(env);
+        }
+    }
+}
+
+void Scheduler::Spawn(GuestTask task)
+{
+    auto handle = task.handle;
+    tasks.emplace(handle.address(), std::move(task));
+    ready.push_back(handle);
+}
+
+void Scheduler::Run()
+{
+    while (!tasks.empty()) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            if (ready.empty()) {
+                wake.wait(guard, [this] { return !completed.empty(); });
+            }
+            ready.insert(ready.end(), completed.begin(), completed.end());
+            completed.clear();
+        }
+
+        auto handle = ready.front();
+        ready.pop_front();
+        handle.resume();
+        if (handle.done()) {
+            tasks.erase(handle.address());
+        }
+    }
+}
+
+void Scheduler::Complete(std::coroutine_handle<> handle)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        completed.push_back(handle);
+    }
+    wake.notify_one();
+}
+
+} // namespace Sim
@@ -0,0 +1,166 @@
+#ifndef SIM_SCHEDULER_H
+#define SIM_SCHEDULER_H
+
+#include <types.h>
+#include <cpu_env.h>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Sim {
+
+struct Scheduler;
+
+// Coroutine running one guest; created suspended and owned by the Scheduler
+// once spawned.
+struct GuestTask final {
+public:
+    struct promise_type final {
+    public:
+        GuestTask get_return_object()
+        {
+            return GuestTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    GuestTask(GuestTask &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    GuestTask &operator=(GuestTask &&other) noexcept
+    {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    ~GuestTask()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+private:
+    friend struct Scheduler;
+
+    explicit GuestTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle = nullptr;
+};
+
+// ECALL forwarded to the host: a7 selects the service, a0..a5 are the
+// arguments and result is written back to a0. The handler may complete it
+// right away or later from any thread; until then the guest is parked and
+// not scheduled.
+struct HostCall final {
+public:
+    u32_t number = 0;
+    u32_t args[6] = {};
+    u32_t result = 0;
+    CPUEnv *env = nullptr;
+
+    void Complete(u32_t value);
+
+private:
+    friend struct Scheduler;
+
+    Scheduler *scheduler = nullptr;
+    std::coroutine_handle<> handle = nullptr;
+};
+
+using HostHandler = std::function<void(HostCall &call)>;
+
+// Single-threaded cooperative scheduler multiplexing guest coroutines
+// round-robin. A guest yields at every co_await Slice() and sleeps on
+// co_await Call() until its host call completes; Run() blocks the thread
+// while every remaining guest is waiting on the host.
+struct Scheduler final {
+public:
+    explicit Scheduler(HostHandler handler) : handler(std::move(handler)) {}
+
+    struct SliceAwaiter final {
+    public:
+        Scheduler &scheduler;
+        CPUEnv &env;
+        u64_t cycles = 0;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            scheduler.ready.push_back(handle);
+        }
+        StopReason await_resume()
+        {
+            return env.Resume(cycles);
+        }
+    };
+
+    struct CallAwaiter final {
+    public:
+        Scheduler &scheduler;
+        HostCall call = {};
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> handle);
+        u32_t await_resume();
+    };
+
+    // Yield, then run env for up to cycles cycles.
+    SliceAwaiter Slice(CPUEnv &env, u64_t cycles)
+    {
+        return { *this, env, cycles };
+    }
+
+    // Service the ECALL env just trapped on and continue after it.
+    CallAwaiter Call(CPUEnv &env)
+    {
+        CallAwaiter awaiter = { *this };
+        awaiter.call.env = &env;
+        return awaiter;
+    }
+
+    static bool IsHostCall(CPUEnv const &env);
+
+    // Runs env in slices, forwarding ECALLs, until the guest shuts down.
+    GuestTask Guest(CPUEnv &env, u64_t slice);
+
+    void Spawn(GuestTask task);
+    void Run();
+
+private:
+    friend struct HostCall;
+
+    HostHandler handler = {};
+    std::unordered_map<void *, GuestTask> tasks = {};
+    std::deque<std::coroutine_handle<>> ready = {};
+
+    std::mutex lock = {};
+    std::condition_variable wake = {};
+    std::vector<std::coroutine_handle<>> completed = {};
+
+    void Complete(std::coroutine_handle<> handle);
+};
+
+} // namespace Sim
+
+#endif // SIM_SCHEDULER_H
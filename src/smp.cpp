@@ -0,0 +1,66 @@
+#include "smp.h"
+
+#include <algorithm>
+#include <barrier>
+#include <cassert>
+#include <cstring>
+#include <thread>
+
+namespace Sim {
+
+SmpSystem::SmpSystem(void const *image, u32_t memSize, u32_t count, ExecMode mode)
+{
+    assert(image && memSize && (memSize % sizeof(u32_t) == 0) && "Invalid memory");
+    assert(count && "No harts");
+
+    memory.resize(memSize / sizeof(u32_t));
+    std::memcpy(memory.data(), image, memSize);
+    MemorySpan const shared = { memory.data(), (u32_t)std::size(memory) };
+    for (u32_t i = 0; i < count; ++i) {
+        auto &hart = *harts.emplace_back(std::make_unique<HartState>(shared));
+        hart.env.mode = mode;
+        hart.atomics.Attach(hart.env.cpu.mmu);
+    }
+}
+
+void SmpSystem::Run(u32_t pc, u64_t maxCycles)
+{
+    assert(quantum && "Quantum must not be zero");
+
+    rounds = 0;
+    for (u32_t i = 0; i < Harts(); ++i) {
+        CPU &cpu = harts[i]->env.cpu;
+        cpu.fetchStage.state.read.pc = pc;
+        cpu.decodeStage.regfile.gpr[10] = i;
+    }
+
+    std::barrier sync(Harts(), [this]() noexcept { ++rounds; });
+    auto work = [this, maxCycles, &sync](u32_t i) {
+        CPUEnv &env = harts[i]->env;
+        CPU &cpu = env.cpu;
+        while (!cpu.shutdown && cpu.cycles < maxCycles) {
+            u64_t const end = cpu.cycles + std::min(quantum, maxCycles - cpu.cycles);
+            // Traps return early; the handler runs in the same quantum.
+            while (!cpu.shutdown && cpu.cycles < end) {
+                env.Resume(end - cpu.cycles);
+            }
+            if (cpu.shutdown || cpu.cycles >= maxCycles) {
+                break;
+            }
+            sync.arrive_and_wait();
+        }
+        cpu.hostCalls.Flush(cpu);
+        sync.arrive_and_drop();
+    };
+
+    std::vector<std::thread> threads = {};
+    for (u32_t i = 1; i < Harts(); ++i) {
+        threads.emplace_back(work, i);
+    }
+    work(0);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+} // namespace Sim
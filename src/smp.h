@@ -0,0 +1,69 @@
+#ifndef SIM_SMP_H
+#define SIM_SMP_H
+
+#include <types.h>
+#include <cpu_env.h>
+#include <devices.h>
+#include <memory>
+#include <vector>
+
+namespace Sim {
+
+// Several harts sharing one flat guest memory, each running on its own host
+// thread in its CPUEnv's mode. Loads and stores go straight to the shared
+// words through each hart's TLB without taking locks; harts order them with
+// FENCE and update shared words through their own AtomicUnit. Harts run
+// `quantum` cycles at a time and then wait at a barrier for the others, which
+// bounds how far apart their cycle counts (and Timers) drift. Within a quantum
+// they interleave as the host schedules them, so runs are not deterministic.
+//
+// Decode and block caches are per hart, so harts must not modify code another
+// hart runs.
+struct SmpSystem final {
+public:
+    u64_t quantum = 10000;
+    // Barrier phases completed by the last Run().
+    u64_t rounds = 0;
+
+    // The image of memSize bytes is copied into the shared memory.
+    SmpSystem(void const *image, u32_t memSize, u32_t harts, ExecMode mode = ExecMode::FUNCTIONAL);
+
+    u32_t Harts() const
+    {
+        return std::size(harts);
+    }
+
+    CPUEnv &Hart(u32_t i)
+    {
+        return harts[i]->env;
+    }
+
+    AtomicUnit &Atomics(u32_t i)
+    {
+        return harts[i]->atomics;
+    }
+
+    u32_t *Memory()
+    {
+        return memory.data();
+    }
+
+    // Runs every hart from pc, with its index in a0, until all have shut down
+    // or each has run maxCycles cycles.
+    void Run(u32_t pc, u64_t maxCycles = ~(u64_t)0);
+
+private:
+    struct HartState final {
+        CPUEnv env;
+        AtomicUnit atomics = {};
+
+        explicit HartState(MemorySpan memory) : env(memory) {}
+    };
+
+    std::vector<u32_t> memory = {};
+    std::vector<std::unique_ptr<HartState>> harts = {};
+};
+
+} // namespace Sim
+
+#endif // SIM_SMP_H
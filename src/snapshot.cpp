@@ -0,0 +1,305 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+namespace Sim {
+
+namespace {
+
+constexpr u32_t PAGE_SIZE = PagedMemory::PAGE_SIZE;
+constexpr char MAGIC[8] = { 'R', 'V', '3', '2', 'S', 'N', 'A', 'P' };
+constexpr u32_t VERSION = 1;
+
+struct FileHeader final {
+    char magic[8] = {};
+    u32_t version = 0;
+    u32_t stateSize = 0;
+    u64_t memSize = 0;
+    u64_t pagesOffset = 0;
+    u32_t pageCount = 0;
+    u8_t backend = 0;
+};
+
+u64_t NextId()
+{
+    static std::atomic<u64_t> next = 1;
+    return next++;
+}
+
+u32_t *FlatData(MMU &mmu)
+{
+    return mmu.borrowed ? mmu.borrowed : mmu.memory.data();
+}
+
+// The state comes from the file byte for byte; a bool holding anything but 0
+// or 1 is not one.
+bool IsBool(bool const &b)
+{
+    u8_t byte = 0;
+    std::memcpy(&byte, &b, sizeof(byte));
+    return byte <= 1;
+}
+
+bool IsRegister(u8_t a)
+{
+    return a < 32;
+}
+
+bool IsValid(CUExecParams const &p)
+{
+    return p.iType <= InstructionType::UNKNOWN_TYPE && p.aluSrc1 <= CUALUSrc::UNKNOWN &&
+        p.aluSrc2 <= CUALUSrc::UNKNOWN && p.aluOp <= CUALUOp::UNKNOWN && p.cmpOp <= CUCmpOp::UNKNOWN &&
+        p.memOp <= CUMemOp::UNKNOWN && p.resSrc <= CUResSrc::UNKNOWN && IsBool(p.regWrite) &&
+        IsBool(p.isJump) && IsBool(p.isJumpReg) && IsBool(p.isBranch) && IsBool(p.memWrite) &&
+        IsBool(p.memSignExt) && IsBool(p.isOpcodeOk) && IsBool(p.intpt) && IsBool(p.isECall) &&
+        IsBool(p.isFence);
+}
+
+// Tags are empty without performance counters.
+template<typename Tag>
+bool IsValidTag(Tag const &tag)
+{
+    if constexpr (requires { tag.entry; }) {
+        return tag.entry <= ISAEntry::UNKNOWN;
+    }
+    return true;
+}
+
+bool IsValid(FetchStage::State const &)
+{
+    return true;
+}
+
+bool IsValid(DecodeStage::State const &s)
+{
+    return IsBool(s.v);
+}
+
+bool IsValid(ExecuteStage::State const &s)
+{
+    return IsValid(s.execParams) && IsRegister(s.rs1a) && IsRegister(s.rs2a) && IsRegister(s.rda) &&
+        IsBool(s.v) && IsValidTag(s.tag);
+}
+
+bool IsValid(MemoryStage::State const &s)
+{
+    return IsValid(s.execParams) && IsRegister(s.regAddr) && IsBool(s.v) && IsValidTag(s.tag);
+}
+
+bool IsValid(WritebackStage::State const &s)
+{
+    return IsBool(s.regWrite) && IsRegister(s.regAddr);
+}
+
+template<typename StateType>
+bool IsValid(TickState<StateType> const &state)
+{
+    return IsValid(state.read) && IsValid(state.write);
+}
+
+} // namespace
+
+void CPUSnapshot::Take(CPU &cpu)
+{
+    state = { cpu.huModule, cpu.fetchStage, cpu.decodeStage, cpu.executeStage, cpu.memoryStage,
+        cpu.writebackStage, cpu.shutdown, cpu.tvec };
+    backend = cpu.mmu.backend;
+    memSize = cpu.mmu.Size();
+
+    if (backend == MMUBackend::FLAT) {
+        memory = {};
+        u32_t const *words = FlatData(cpu.mmu);
+        for (u64_t a = 0; a < memSize; a += PAGE_SIZE) {
+            u64_t size = std::min<u64_t>(PAGE_SIZE, memSize - a);
+            u32_t const *src = words + a / sizeof(u32_t);
+            if (std::any_of(src, src + size / sizeof(u32_t), [](u32_t w) { return w != 0; })) {
+                std::memcpy(memory.WritablePage(a).words, src, size);
+            }
+        }
+    } else {
+        memory = cpu.mmu.paged;
+    }
+
+    id = NextId();
+    cpu.mmu.TrackDirty(id);
+}
+
+SnapshotStatus CPUSnapshot::Restore(CPU &cpu) const
+{
+    if (backend == MMUBackend::FLAT && cpu.mmu.borrowed &&
+        cpu.mmu.borrowedWords * (u64_t)sizeof(u32_t) != memSize) {
+        return SnapshotStatus::SIZE_MISMATCH;
+    }
+
+    cpu.huModule = state.huModule;
+    cpu.fetchStage = state.fetchStage;
+    cpu.decodeStage = state.decodeStage;
+    cpu.executeStage = state.executeStage;
+    cpu.memoryStage = state.memoryStage;
+    cpu.writebackStage = state.writebackStage;
+    cpu.shutdown = state.shutdown;
+    cpu.tvec = state.tvec;
+
+    RestoreMemory(cpu);
+    cpu.mmu.TrackDirty(id);
+    return SnapshotStatus::OK;
+}
+
+void CPUSnapshot::RestoreMemory(CPU &cpu) const
+{
+    MMU &mmu = cpu.mmu;
+
+    if (mmu.trackDirty && mmu.dirtyBase == id && mmu.backend == backend && mmu.Size() == memSize) {
+        for (u32_t page : mmu.dirtyPages) {
+            u32_t a = page * PAGE_SIZE;
+            if (backend == MMUBackend::FLAT) {
+                std::memcpy(FlatData(mmu) + a / sizeof(u32_t), memory.PageAt(a)->words,
+                    std::min<u64_t>(PAGE_SIZE, memSize - a));
+            } else {
+                mmu.paged.CopyPage(a, memory);
+            }
+            for (u32_t i = 0; i < PAGE_SIZE; i += sizeof(u32_t)) {
+                cpu.decodeCache.Invalidate(a + i);
+                cpu.blockCache.Invalidate(a + i);
+            }
+        }
+        return;
+    }
+
+    mmu.backend = backend;
+    if (backend == MMUBackend::FLAT) {
+        if (mmu.borrowed) {
+            std::fill(mmu.borrowed, mmu.borrowed + mmu.borrowedWords, 0);
+        } else {
+            mmu.memory.assign(memSize / sizeof(u32_t), 0);
+        }
+        u32_t *words = FlatData(mmu);
+        memory.ForEachPage([&](u32_t a, PagedMemory::Page const &page) {
+            std::memcpy(words + a / sizeof(u32_t), page.words, std::min<u64_t>(PAGE_SIZE, memSize - a));
+        });
+    } else {
+        mmu.paged = memory;
+        mmu.pagedSize = memSize;
+    }
+    cpu.decodeCache.Flush();
+    cpu.blockCache.Flush();
+}
+
+SnapshotStatus CPUSnapshot::Save(char const *path) const
+{
+    static_assert(std::is_trivially_copyable_v<State>);
+
+    std::vector<u32_t> index = {};
+    memory.ForEachPage([&index](u32_t a, PagedMemory::Page const &) { index.push_back(a); });
+
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.stateSize = sizeof(State);
+    header.memSize = memSize;
+    header.pageCount = std::size(index);
+    header.backend = (u8_t)backend;
+    u64_t indexEnd = sizeof(FileHeader) + sizeof(State) + std::size(index) * sizeof(u32_t);
+    header.pagesOffset = (indexEnd + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+    std::FILE *file = std::fopen(path, "wb");
+    if (!file) {
+        return SnapshotStatus::OPEN_FAILED;
+    }
+
+    std::vector<u8_t> padding(header.pagesOffset - indexEnd, 0);
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(&state, sizeof(state), 1, file) == 1 &&
+        std::fwrite(index.data(), sizeof(u32_t), std::size(index), file) == std::size(index) &&
+        std::fwrite(padding.data(), 1, std::size(padding), file) == std::size(padding);
+    memory.ForEachPage([&](u32_t, PagedMemory::Page const &page) {
+        ok = ok && std::fwrite(page.words, PAGE_SIZE, 1, file) == 1;
+    });
+
+    ok = (std::fclose(file) == 0) && ok;
+    return ok ? SnapshotStatus::OK : SnapshotStatus::IO_ERROR;
+}
+
+SnapshotStatus CPUSnapshot::Load(char const *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return SnapshotStatus::OPEN_FAILED;
+    }
+
+    struct stat st = {};
+    if (fstat(fd, &st) || (u64_t)st.st_size < sizeof(FileHeader) + sizeof(State)) {
+        close(fd);
+        return SnapshotStatus::BAD_FORMAT;
+    }
+
+    // Private and writable so that pages can be handed to guests as-is.
+    u64_t size = st.st_size;
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return SnapshotStatus::IO_ERROR;
+    }
+    auto file = std::shared_ptr<u8_t>((u8_t *)p, [size](u8_t *q) { munmap(q, size); });
+
+    FileHeader header = {};
+    std::memcpy(&header, file.get(), sizeof(header));
+    u64_t indexEnd = sizeof(FileHeader) + sizeof(State) + (u64_t)header.pageCount * sizeof(u32_t);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION ||
+        header.stateSize != sizeof(State) || header.backend > (u8_t)MMUBackend::PAGED ||
+        header.pagesOffset % PAGE_SIZE || header.pagesOffset < indexEnd ||
+        header.pagesOffset + (u64_t)header.pageCount * PAGE_SIZE > size) {
+        return SnapshotStatus::BAD_FORMAT;
+    }
+    // Restore copies every page into memSize bytes of memory unchecked.
+    if (!header.memSize || header.memSize % sizeof(u32_t) || header.memSize > (u64_t)1 << 32) {
+        return SnapshotStatus::BAD_FORMAT;
+    }
+    u8_t const *index = file.get() + sizeof(FileHeader) + sizeof(State);
+    std::vector<u32_t> pages(header.pageCount);
+    std::memcpy(pages.data(), index, std::size(pages) * sizeof(u32_t));
+    for (u32_t a : pages) {
+        if (a % PAGE_SIZE || a >= header.memSize) {
+            return SnapshotStatus::BAD_FORMAT;
+        }
+    }
+
+    // The latches index the register file and drive switches over their
+    // enums, so they are range checked like the memory.
+    State loaded = {};
+    std::memcpy(&loaded, file.get() + sizeof(FileHeader), sizeof(State));
+    HUModule const &hu = loaded.huModule;
+    if (hu.exceptionExecStage > HUExcecutionStage::WRITEBACK || hu.exceptionType > HUExceptionType::INT ||
+        !IsValid(loaded.fetchStage.state) || !IsValid(loaded.decodeStage.state) ||
+        !IsValid(loaded.executeStage.state) || !IsBool(loaded.executeStage.pcR) ||
+        !IsValid(loaded.memoryStage.state) || !IsBool(loaded.memoryStage.delayedWrite.active) ||
+        !IsValid(loaded.writebackStage.state) || !IsBool(loaded.shutdown)) {
+        return SnapshotStatus::BAD_FORMAT;
+    }
+
+    state = loaded;
+    backend = (MMUBackend)header.backend;
+    memSize = header.memSize;
+    memory = {};
+
+    for (u32_t i = 0; i < header.pageCount; ++i) {
+        u32_t const a = pages[i];
+        auto *page = (PagedMemory::Page *)(file.get() + header.pagesOffset + (u64_t)i * PAGE_SIZE);
+        memory.MapShared(a, std::shared_ptr<PagedMemory::Page>(file, page));
+    }
+
+    id = NextId();
+    return SnapshotStatus::OK;
+}
+
+} // namespace Sim
@@ -0,0 +1,58 @@
+#ifndef SIM_SNAPSHOT_H
+#define SIM_SNAPSHOT_H
+
+#include <types.h>
+#include <cpu.h>
+#include <paged_memory.h>
+
+namespace Sim {
+
+enum class SnapshotStatus : u8_t {
+    OK,
+    OPEN_FAILED, IO_ERROR, BAD_FORMAT,
+    // The CPU borrows a FLAT memory of a different size than the snapshot's.
+    SIZE_MISMATCH,
+};
+
+// Copy of the CPU's pipeline latches, register file, HU state and memory.
+// Memory is held as copy-on-write pages: taking a snapshot of a PAGED MMU
+// shares its pages, and restoring into the CPU the snapshot was taken from (or
+// last restored into) only reverts the pages dirtied since. Code caches, the
+// JIT and performance counters are not part of the snapshot.
+//
+// The file format is a header, the raw CPU state and a page index, followed by
+// page-aligned page data that Load() maps privately instead of reading. It is
+// only meant to be read back by the same build.
+struct CPUSnapshot final {
+public:
+    void Take(CPU &cpu);
+    // Leaves the CPU untouched unless it returns OK.
+    SnapshotStatus Restore(CPU &cpu) const;
+
+    SnapshotStatus Save(char const *path) const;
+    SnapshotStatus Load(char const *path);
+
+private:
+    struct State final {
+        HUModule huModule = {};
+        FetchStage fetchStage = {};
+        DecodeStage decodeStage = {};
+        ExecuteStage executeStage = {};
+        MemoryStage memoryStage = {};
+        WritebackStage writebackStage = {};
+        bool shutdown = true;
+        u32_t tvec = 0;
+    };
+
+    State state = {};
+    MMUBackend backend = MMUBackend::FLAT;
+    u64_t memSize = 0;
+    PagedMemory memory = {};
+    u64_t id = 0;
+
+    void RestoreMemory(CPU &cpu) const;
+};
+
+} // namespace Sim
+
+#endif // SIM_SNAPSHOT_H
@@ -5,8 +5,22 @@ namespace Sim {
 
 struct CPU;
 
-struct TickModule {
-    virtual void Tick(CPU &cpu) = 0;
+// Stages provide a non-virtual `void Tick(CPU &cpu)`; they are composed
+// statically through Pipeline.
+struct TickModule {};
+
+// Compile-time ordered set of stages, given as pointers to CPU members. A
+// cycle is one inlined call per stage, in the listed order. Stage types are
+// those of the members rather than parameters of their own: stages, the
+// interpreter, the JIT and the MMU all share the one concrete CPU, and reach
+// each other's latches through its named members.
+template<auto... Stages>
+struct Pipeline final {
+    template<typename CPUType>
+    static void Tick(CPUType &cpu)
+    {
+        ((cpu.*Stages).Tick(cpu), ...);
+    }
 };
 
 template<typename StateType>
@@ -0,0 +1,88 @@
+#ifndef SIM_TLB_H
+#define SIM_TLB_H
+
+#include <types.h>
+
+namespace Sim {
+
+// Direct-mapped software TLB caching the host address of 4 KiB guest pages.
+// Entries are owned by MMU: anything that moves or shares guest memory
+// behind its back (resizing the flat buffer, copying a PagedMemory, switching
+// backends) must Flush(). Copies start out empty so that they never alias
+// the source's memory.
+struct TLB final {
+public:
+    static constexpr u32_t SIZE = 64;
+    static constexpr u32_t PAGE_SHIFT = 12;
+    static constexpr u32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+
+    enum Permission : u8_t {
+        NONE = 0, READ = 1, WRITE = 2,
+    };
+
+    struct Entry final {
+        u32_t vpn = 0;
+        u8_t perm = NONE;
+        u32_t *host = nullptr;
+        // Device registers on the page that stores must not bypass.
+        u32_t ioBase = 0;
+        u32_t ioSize = 0;
+    };
+
+    u64_t hits = 0;
+    u64_t misses = 0;
+
+    TLB() = default;
+    TLB(TLB const &) {}
+    TLB &operator=(TLB const &)
+    {
+        Flush();
+        return *this;
+    }
+
+    // Host word for a, or nullptr when the page is not mapped with perm or a
+    // is a store to the page's I/O window.
+    u32_t *Lookup(u32_t a, u8_t perm)
+    {
+        Entry const &entry = entries[Index(a)];
+        if (entry.vpn == (a >> PAGE_SHIFT) && (entry.perm & perm) &&
+            (perm != WRITE || a - entry.ioBase >= entry.ioSize)) {
+            ++hits;
+            return entry.host + (a % PAGE_SIZE) / sizeof(u32_t);
+        }
+        ++misses;
+        return nullptr;
+    }
+
+    void Fill(u32_t a, u32_t *page, u8_t perm, u32_t ioBase = 0, u32_t ioSize = 0)
+    {
+        entries[Index(a)] = { a >> PAGE_SHIFT, perm, page, ioBase, ioSize };
+    }
+
+    void Invalidate(u32_t a)
+    {
+        Entry &entry = entries[Index(a)];
+        if (entry.vpn == (a >> PAGE_SHIFT)) {
+            entry.perm = NONE;
+        }
+    }
+
+    void Flush()
+    {
+        for (auto &entry : entries) {
+            entry.perm = NONE;
+        }
+    }
+
+private:
+    Entry entries[SIZE] = {};
+
+    static u32_t Index(u32_t a)
+    {
+        return (a >> PAGE_SHIFT) & (SIZE - 1);
+    }
+};
+
+} // namespace Sim
+
+#endif // SIM_TLB_H
@@ -0,0 +1,540 @@
+#include "trace.h"
+#include "cpu.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Sim {
+
+namespace {
+
+constexpr char MAGIC[8] = { 'R', 'V', '3', '2', 'T', 'R', 'C', 'E' };
+constexpr u32_t VERSION = 3;
+
+struct FileHeader final {
+    char magic[8] = {};
+    u32_t version = 0;
+    u32_t level = 0;
+};
+
+struct ChunkHeader final {
+    u32_t size = 0;
+    u32_t count = 0;
+    u64_t first = 0;
+};
+
+enum Flags : u8_t {
+    PC_JUMP = 1 << 0,
+    INST = 1 << 1,
+    RD = 1 << 2,
+    LOAD = 1 << 3,
+    STORE = 1 << 4,
+    // Bytes of the rd value, less one.
+    RD_LENGTH_SHIFT = 5,
+};
+
+// Shifts of the pc delta, address delta and data lengths in the second byte,
+// and of the pc delta and count lengths in the first byte of a run.
+enum Lengths : u8_t {
+    PC_LENGTH_SHIFT = 0,
+    ADDR_LENGTH_SHIFT = 2,
+    DATA_LENGTH_SHIFT = 4,
+    COUNT_LENGTH_SHIFT = 2,
+};
+
+// Bytes needed for v, less one.
+u32_t LengthCode(u32_t v)
+{
+    return (31 - __builtin_clz(v | 1)) / 8;
+}
+
+// Writes all four bytes of v so that the store does not depend on its length.
+u8_t *Put(u8_t *out, u32_t v, u32_t code)
+{
+    std::memcpy(out, &v, sizeof(v));
+    return out + code + 1;
+}
+
+bool Get(u8_t const *&p, u8_t const *end, u32_t code, u32_t *v)
+{
+    u32_t const size = code + 1;
+    if ((u64_t)(end - p) < size) {
+        return false;
+    }
+    *v = 0;
+    std::memcpy(v, p, size);
+    p += size;
+    return true;
+}
+
+u32_t ZigZag(u32_t delta)
+{
+    return (delta << 1) ^ (u32_t)((i32_t)delta >> 31);
+}
+
+u32_t UnZigZag(u32_t v)
+{
+    return (v >> 1) ^ (u32_t)-(i32_t)(v & 1);
+}
+
+TraceRecord Unpack(TraceWriter::Slot const &slot)
+{
+    TraceRecord record = { .pc = slot.pcAccess & ~3u, .inst = slot.inst,
+        .access = (TraceAccess)(slot.pcAccess & 3) };
+    if (record.access == TraceAccess::NONE) {
+        record.rd = slot.addrRd;
+        record.rdValue = record.rd ? slot.value : 0;
+        return record;
+    }
+    if (record.access == TraceAccess::LOAD) {
+        Instruction const inst = { .raw = slot.inst };
+        record.rd = inst.rType.rd;
+        record.rdValue = record.rd ? slot.value : 0;
+    }
+    record.addr = slot.addrRd;
+    record.data = slot.value;
+    return record;
+}
+
+} // namespace
+
+void TraceCodec::Reset()
+{
+    pc = 0;
+    addr = 0;
+    std::fill(std::begin(insts), std::end(insts), 0);
+}
+
+u8_t *TraceCodec::Encode(TraceRecord const &record, u8_t *out)
+{
+    // The lengths byte is only written if a field needs it.
+    bool const wide = record.pc != pc + 4 || record.access != TraceAccess::NONE;
+    u8_t *const start = out;
+    u32_t flags = 0;
+    u32_t lengths = 0;
+    out += 1 + wide;
+
+    if (record.pc != pc + 4) {
+        u32_t const delta = ZigZag(record.pc - (pc + 4));
+        u32_t const code = LengthCode(delta);
+        flags |= PC_JUMP;
+        lengths |= code << PC_LENGTH_SHIFT;
+        out = Put(out, delta, code);
+    }
+    if (u32_t &inst = insts[(record.pc >> 2) % INST_SLOTS]; record.inst != inst) {
+        flags |= INST;
+        out = Put(out, record.inst, 3);
+        inst = record.inst;
+    }
+    if (record.rd) {
+        u32_t const code = LengthCode(record.rdValue);
+        flags |= RD | code << RD_LENGTH_SHIFT;
+        *out++ = record.rd;
+        out = Put(out, record.rdValue, code);
+    }
+    if (record.access != TraceAccess::NONE) {
+        u32_t const delta = ZigZag(record.addr - addr);
+        u32_t const addrCode = LengthCode(delta);
+        u32_t const dataCode = LengthCode(record.data);
+        flags |= record.access == TraceAccess::LOAD ? LOAD : STORE;
+        lengths |= addrCode << ADDR_LENGTH_SHIFT | dataCode << DATA_LENGTH_SHIFT;
+        out = Put(out, delta, addrCode);
+        out = Put(out, record.data, dataCode);
+        addr = record.addr;
+    }
+    pc = record.pc;
+
+    start[0] = flags;
+    if (wide) {
+        start[1] = lengths;
+    }
+    return out;
+}
+
+bool TraceCodec::Decode(u8_t const *&p, u8_t const *end, TraceRecord *record)
+{
+    if (p >= end) {
+        return false;
+    }
+    u8_t const flags = *p++;
+    u8_t lengths = 0;
+    if (flags & (PC_JUMP | LOAD | STORE)) {
+        if (p >= end) {
+            return false;
+        }
+        lengths = *p++;
+    }
+    TraceRecord r = {};
+
+    r.pc = pc + 4;
+    if (u32_t delta = 0; flags & PC_JUMP) {
+        if (!Get(p, end, (lengths >> PC_LENGTH_SHIFT) & 3, &delta)) {
+            return false;
+        }
+        r.pc += UnZigZag(delta);
+    }
+
+    u32_t &inst = insts[(r.pc >> 2) % INST_SLOTS];
+    if ((flags & INST) && !Get(p, end, 3, &inst)) {
+        return false;
+    }
+    r.inst = inst;
+
+    if (flags & RD) {
+        if (p >= end) {
+            return false;
+        }
+        r.rd = *p++;
+        if (!Get(p, end, (flags >> RD_LENGTH_SHIFT) & 3, &r.rdValue)) {
+            return false;
+        }
+    }
+
+    if (flags & (LOAD | STORE)) {
+        u32_t delta = 0;
+        if (!Get(p, end, (lengths >> ADDR_LENGTH_SHIFT) & 3, &delta) ||
+            !Get(p, end, (lengths >> DATA_LENGTH_SHIFT) & 3, &r.data)) {
+            return false;
+        }
+        r.access = (flags & LOAD) ? TraceAccess::LOAD : TraceAccess::STORE;
+        r.addr = addr + UnZigZag(delta);
+        addr = r.addr;
+    }
+
+    pc = r.pc;
+    *record = r;
+    return true;
+}
+
+u8_t *TraceCodec::EncodeRun(u32_t runPc, u32_t count, u8_t *out)
+{
+    u32_t const delta = ZigZag(runPc - pc);
+    u32_t const pcCode = LengthCode(delta);
+    u32_t const countCode = LengthCode(count - 1);
+    *out++ = pcCode << PC_LENGTH_SHIFT | countCode << COUNT_LENGTH_SHIFT;
+    out = Put(out, delta, pcCode);
+    out = Put(out, count - 1, countCode);
+    pc = runPc + count * sizeof(u32_t);
+    return out;
+}
+
+bool TraceCodec::DecodeRun(u8_t const *&p, u8_t const *end, u32_t *runPc, u32_t *count)
+{
+    if (p >= end) {
+        return false;
+    }
+    u8_t const lengths = *p++;
+    u32_t delta = 0;
+    if (!Get(p, end, (lengths >> PC_LENGTH_SHIFT) & 3, &delta) ||
+        !Get(p, end, (lengths >> COUNT_LENGTH_SHIFT) & 3, count)) {
+        return false;
+    }
+    *runPc = pc + UnZigZag(delta);
+    *count += 1;
+    pc = *runPc + *count * sizeof(u32_t);
+    return true;
+}
+
+TraceWriter::~TraceWriter()
+{
+    Close();
+}
+
+TraceStatus TraceWriter::Open(char const *path, TraceLevel level)
+{
+    Close();
+
+    file = std::fopen(path, "wb");
+    if (!file) {
+        return TraceStatus::OPEN_FAILED;
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.level = (u32_t)level;
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::fclose(file);
+        file = nullptr;
+        return TraceStatus::IO_ERROR;
+    }
+
+    this->level = level;
+    u32_t const count = std::clamp(std::thread::hardware_concurrency(), 2u, MAX_WRITERS + 1) - 1;
+    records = 0;
+    runPc = 0;
+    runCount = 0;
+    chunks.resize(2 * count);
+    for (auto &chunk : chunks) {
+        chunk = {};
+        chunk.slots = std::make_unique_for_overwrite<Slot[]>(CHUNK_RECORDS);
+    }
+    submitted = 0;
+    taken = 0;
+    written = 0;
+    cursor = Active().slots.get();
+    end = cursor + CHUNK_RECORDS;
+    stop = false;
+    failed = false;
+    for (u32_t i = 0; i < count; ++i) {
+        writers.emplace_back([this] { Write(); });
+    }
+    return TraceStatus::OK;
+}
+
+TraceStatus TraceWriter::Close()
+{
+    if (!file) {
+        return TraceStatus::OK;
+    }
+
+    EndRun();
+    if (cursor != Active().slots.get()) {
+        Submit();
+    }
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (auto &writer : writers) {
+        writer.join();
+    }
+    writers.clear();
+
+    records = Records();
+    bool ok = !failed && !std::fclose(file);
+    file = nullptr;
+    cursor = &scratch;
+    end = &scratch + 1;
+    return ok ? TraceStatus::OK : TraceStatus::IO_ERROR;
+}
+
+void TraceWriter::Attach(CPU &cpu)
+{
+    (level == TraceLevel::FULL ? cpu.tracer : cpu.flowTracer) = this;
+}
+
+void TraceWriter::Detach(CPU &cpu)
+{
+    (level == TraceLevel::FULL ? cpu.tracer : cpu.flowTracer) = nullptr;
+}
+
+u64_t TraceWriter::Records() const
+{
+    if (!file) {
+        return records;
+    }
+    Chunk const &chunk = chunks[submitted % std::size(chunks)];
+    if (level == TraceLevel::FULL) {
+        return chunk.first + (cursor - chunk.slots.get());
+    }
+    return chunk.first + chunk.count + runCount;
+}
+
+// Hands the active chunk to the writers, then starts a new chunk in the next
+// one of the ring once it has been written out. Without a file, the record in
+// the scratch area is dropped instead.
+void TraceWriter::Submit()
+{
+    if (!file) {
+        cursor = &scratch;
+        return;
+    }
+
+    Chunk &chunk = Active();
+    chunk.used = cursor - chunk.slots.get();
+    if (level == TraceLevel::FULL) {
+        chunk.count = chunk.used;
+    }
+    {
+        std::unique_lock lock(mutex);
+        ++submitted;
+        cv.notify_all();
+        cv.wait(lock, [this] { return written + std::size(chunks) > submitted; });
+    }
+
+    Active().first = chunk.first + chunk.count;
+    Active().count = 0;
+    cursor = Active().slots.get();
+    end = cursor + CHUNK_RECORDS;
+}
+
+// Takes the oldest chunk no other writer has, and writes it out once the ones
+// before it are.
+void TraceWriter::Write()
+{
+    auto codec = std::make_unique<TraceCodec>();
+    auto bytes = std::make_unique_for_overwrite<u8_t[]>(CHUNK_RECORDS * TraceCodec::MAX_RECORD_SIZE);
+
+    std::unique_lock lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return taken < submitted || stop; });
+        if (taken == submitted) {
+            return;
+        }
+
+        u64_t const sequence = taken++;
+        Chunk const &chunk = chunks[sequence % std::size(chunks)];
+        lock.unlock();
+        codec->Reset();
+        u8_t *end = bytes.get();
+        for (u32_t i = 0; i < chunk.used; ++i) {
+            Slot const &slot = chunk.slots[i];
+            end = level == TraceLevel::FULL ? codec->Encode(Unpack(slot), end) :
+                codec->EncodeRun(slot.pcAccess, slot.value, end);
+        }
+        ChunkHeader header = { (u32_t)(end - bytes.get()), chunk.count, chunk.first };
+        lock.lock();
+
+        cv.wait(lock, [this, sequence] { return written == sequence; });
+        lock.unlock();
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+            std::fwrite(bytes.get(), 1, header.size, file) == header.size;
+        lock.lock();
+
+        failed |= !ok;
+        ++written;
+        cv.notify_all();
+    }
+}
+
+TraceReader::~TraceReader()
+{
+    if (file) {
+        std::fclose(file);
+    }
+}
+
+TraceStatus TraceReader::Open(char const *path)
+{
+    if (file) {
+        std::fclose(file);
+    }
+    chunks.clear();
+    bytes.clear();
+    cursor = nullptr;
+    left = 0;
+    position = 0;
+
+    file = std::fopen(path, "rb");
+    if (!file) {
+        return TraceStatus::OPEN_FAILED;
+    }
+
+    FileHeader header = {};
+    if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+        std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION ||
+        header.level > (u32_t)TraceLevel::FLOW) {
+        return TraceStatus::BAD_FORMAT;
+    }
+    level = (TraceLevel)header.level;
+
+    // A chunk cut short by a crash ends the trace.
+    u64_t offset = sizeof(header);
+    for (ChunkHeader chunk = {}; std::fread(&chunk, sizeof(chunk), 1, file) == 1;) {
+        u64_t first = chunks.empty() ? 0 : chunks.back().first + chunks.back().count;
+        if (chunk.first != first || !chunk.count || std::fseek(file, chunk.size, SEEK_CUR)) {
+            return TraceStatus::BAD_FORMAT;
+        }
+        offset += sizeof(chunk);
+        chunks.push_back({ offset, chunk.first, chunk.count, chunk.size });
+        offset += chunk.size;
+    }
+    if (!chunks.empty()) {
+        std::fseek(file, 0, SEEK_END);
+        if ((u64_t)std::ftell(file) < offset) {
+            chunks.pop_back();
+        }
+    }
+
+    chunk = 0;
+    return LoadChunk(0) || chunks.empty() ? TraceStatus::OK : TraceStatus::IO_ERROR;
+}
+
+bool TraceReader::Seek(u64_t index)
+{
+    if (index >= Count()) {
+        return false;
+    }
+
+    auto it = std::upper_bound(chunks.begin(), chunks.end(), index,
+        [](u64_t i, ChunkIndex const &c) { return i < c.first; });
+    u32_t i = it - chunks.begin() - 1;
+    if (i != chunk || position > index || !cursor) {
+        if (!LoadChunk(i)) {
+            return false;
+        }
+    }
+
+    TraceRecord skipped = {};
+    while (position < index) {
+        // FLOW runs are skipped whole where they end before the target.
+        if (level == TraceLevel::FLOW && runLeft && left) {
+            u32_t const n = std::min<u64_t>({ runLeft, left, index - position });
+            runPc += n * sizeof(u32_t);
+            runLeft -= n;
+            left -= n;
+            position += n;
+            continue;
+        }
+        if (!Next(&skipped)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TraceReader::Next(TraceRecord *record)
+{
+    if (!left) {
+        if (chunk + 1 >= std::size(chunks) || !LoadChunk(chunk + 1)) {
+            return false;
+        }
+    }
+    if (level == TraceLevel::FLOW) {
+        if (!runLeft && !codec.DecodeRun(cursor, bytes.data() + std::size(bytes), &runPc, &runLeft)) {
+            left = 0;
+            return false;
+        }
+        *record = { .pc = runPc };
+        runPc += sizeof(u32_t);
+        --runLeft;
+    } else if (!codec.Decode(cursor, bytes.data() + std::size(bytes), record)) {
+        left = 0;
+        return false;
+    }
+    --left;
+    ++position;
+    return true;
+}
+
+u64_t TraceReader::Count() const
+{
+    return chunks.empty() ? 0 : chunks.back().first + chunks.back().count;
+}
+
+bool TraceReader::LoadChunk(u32_t i)
+{
+    cursor = nullptr;
+    left = 0;
+    if (i >= std::size(chunks)) {
+        return false;
+    }
+
+    ChunkIndex const &c = chunks[i];
+    bytes.resize(c.size);
+    if (std::fseek(file, c.offset, SEEK_SET) || std::fread(bytes.data(), 1, c.size, file) != c.size) {
+        return false;
+    }
+
+    chunk = i;
+    cursor = bytes.data();
+    left = c.count;
+    runLeft = 0;
+    position = c.first;
+    codec.Reset();
+    return true;
+}
+
+} // namespace Sim
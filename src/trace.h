@@ -0,0 +1,292 @@
+#ifndef SIM_TRACE_H
+#define SIM_TRACE_H
+
+#include <types.h>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Sim {
+
+struct CPU;
+
+enum class TraceStatus : u8_t {
+    OK,
+    OPEN_FAILED, IO_ERROR, BAD_FORMAT,
+};
+
+enum class TraceAccess : u8_t {
+    NONE, LOAD, STORE,
+};
+
+// FULL records every retired instruction with its results. FLOW records only
+// the pcs, as runs of instructions retired one after the other, and leaves JIT
+// blocks native; its records read back with just the pc set.
+enum class TraceLevel : u8_t {
+    FULL, FLOW,
+};
+
+// One retired instruction. rd is 0 if no register was written; data is the
+// value loaded (before it is written to rd) or stored.
+struct TraceRecord final {
+public:
+    u32_t pc = 0;
+    u32_t inst = 0;
+    u8_t rd = 0;
+    TraceAccess access = TraceAccess::NONE;
+    u32_t rdValue = 0;
+    u32_t addr = 0;
+    u32_t data = 0;
+
+    bool operator==(TraceRecord const &) const = default;
+};
+
+// Delta-coding state shared by the writer and the reader. It is reset at the
+// start of every chunk, so that chunks are encoded and decoded independently.
+struct TraceCodec final {
+public:
+    static constexpr u32_t INST_SLOTS = 1024;
+    // Flags, field lengths, pc delta, instruction word, rd and value, address
+    // delta and data.
+    static constexpr u32_t MAX_RECORD_SIZE = 1 + 1 + 4 + 4 + 1 + 4 + 4 + 4;
+
+    void Reset();
+    // Writes at most MAX_RECORD_SIZE bytes and returns the new end; bytes
+    // past the end, up to MAX_RECORD_SIZE, may be clobbered.
+    u8_t *Encode(TraceRecord const &record, u8_t *out);
+    // Returns false on a truncated or malformed record.
+    bool Decode(u8_t const *&p, u8_t const *end, TraceRecord *record);
+
+    // FLOW records: a lengths byte, the zigzag delta of pc from the end of the
+    // previous run, and count - 1.
+    u8_t *EncodeRun(u32_t runPc, u32_t count, u8_t *out);
+    bool DecodeRun(u8_t const *&p, u8_t const *end, u32_t *runPc, u32_t *count);
+
+private:
+    u32_t pc = 0;
+    u32_t addr = 0;
+    // Last instruction word seen at each pc slot; loops repeat it for free.
+    u32_t insts[INST_SLOTS] = {};
+};
+
+// Streams the retired instructions of an attached CPU to a file. The
+// simulator only packs records into a ring of chunk buffers; full chunks are
+// taken by a pool of writer threads, which encode one chunk each and write
+// them out in order while the simulator fills the next. The simulator only
+// waits if the writers fall the whole ring behind.
+//
+// The file is a header followed by chunks of up to CHUNK_RECORDS records,
+// each prefixed with its byte size, record count and the index of its first
+// record. A record is a flags byte followed by the fields that cannot be
+// predicted: a zigzag pc delta for anything but pc + 4, the raw instruction
+// word if it changed since this pc last retired, rd and its value, and a
+// zigzag address delta and the data for memory accesses. Values are stored in
+// as few little-endian bytes as they need, the count going into the flags
+// byte for rd and into a second byte for the others, so that encoding takes
+// no loops.
+//
+// At TraceLevel::FLOW, a slot holds a run instead and the chunk's record
+// count is that of the instructions in its runs. Runs are cut at MAX_RUN
+// instructions, so that a chunk counts fewer than 2^32.
+//
+// Records arriving before Open() or after Close() are dropped. While attached
+// at TraceLevel::FULL, JIT blocks are run by the interpreter so that every
+// instruction is seen. Attach() after Open(), which picks the level.
+struct TraceWriter final {
+public:
+    static constexpr u32_t CHUNK_RECORDS = 1 << 16;
+    // Used on hosts with cores to spare.
+    static constexpr u32_t MAX_WRITERS = 4;
+    static constexpr u32_t MAX_RUN = 1 << 15;
+
+    TraceWriter() = default;
+    TraceWriter(TraceWriter const &) = delete;
+    TraceWriter &operator=(TraceWriter const &) = delete;
+    ~TraceWriter();
+
+    TraceStatus Open(char const *path, TraceLevel level = TraceLevel::FULL);
+    // Writes out the last chunk; IO_ERROR if any write failed.
+    TraceStatus Close();
+
+    void Attach(CPU &cpu);
+    void Detach(CPU &cpu);
+
+    // A record as kept in a chunk until it is encoded: an instruction writes
+    // rd or accesses memory, never both except for loads, whose rd is in the
+    // instruction word. Retired pcs are word aligned, leaving the low bits for
+    // the access.
+    struct Slot final {
+    public:
+        u32_t pcAccess = 0;
+        // rdValue, or the data of a memory access.
+        u32_t value = 0;
+        u32_t inst = 0;
+        // rd, or the address of a memory access.
+        u32_t addrRd = 0;
+    };
+
+    static void Pack(Slot &slot, TraceRecord const &record)
+    {
+        bool const memory = record.access != TraceAccess::NONE;
+        slot.pcAccess = record.pc | (u32_t)record.access;
+        slot.value = memory ? record.data : record.rdValue;
+        slot.inst = record.inst;
+        slot.addrRd = memory ? record.addr : record.rd;
+    }
+
+    void Record(TraceRecord const &record)
+    {
+        Pack(*cursor, record);
+        if (++cursor == end) {
+            Submit();
+        }
+    }
+
+    // Room for the next n records in one chunk, for callers that retire up to
+    // n instructions in a row: they Pack() into the slots and hand back the
+    // end of what they wrote to Commit(), and must not Record() meanwhile.
+    // nullptr while closed.
+    Slot *Reserve(u32_t n)
+    {
+        if ((u32_t)(end - cursor) < n) {
+            Submit();
+        }
+        return file ? cursor : nullptr;
+    }
+
+    void Commit(Slot *next)
+    {
+        cursor = next;
+        if (cursor == end) {
+            Submit();
+        }
+    }
+
+    // FLOW: `count` instructions retired one after the other from pc.
+    void Flow(u32_t pc, u32_t count)
+    {
+        if (pc != runPc + runCount * sizeof(u32_t) || runCount >= MAX_RUN) {
+            EndRun();
+            runPc = pc;
+        }
+        runCount += count;
+    }
+
+    // Records written since the last Open().
+    u64_t Records() const;
+
+private:
+    struct Chunk final {
+        std::unique_ptr<Slot[]> slots = {};
+        u64_t first = 0;
+        // Instructions, and the slots they take; FLOW counts them as runs
+        // end.
+        u32_t count = 0;
+        u32_t used = 0;
+    };
+
+    TraceLevel level = TraceLevel::FULL;
+
+    // Used as a ring, the active chunk being chunks[submitted % size].
+    std::vector<Chunk> chunks = {};
+    // Next free slot and end of the active chunk; while closed, a one slot
+    // scratch area that Submit() drops.
+    Slot scratch = {};
+    Slot *cursor = &scratch;
+    Slot *end = &scratch + 1;
+    u64_t records = 0;
+    // The FLOW run not yet in a slot.
+    u32_t runPc = 0;
+    u32_t runCount = 0;
+
+    std::FILE *file = nullptr;
+    std::vector<std::thread> writers = {};
+    std::mutex mutex = {};
+    std::condition_variable cv = {};
+    // Chunks handed to the writers, taken by one of them, and written out.
+    u64_t submitted = 0;
+    u64_t taken = 0;
+    u64_t written = 0;
+    bool stop = false;
+    bool failed = false;
+
+    Chunk &Active()
+    {
+        return chunks[submitted % std::size(chunks)];
+    }
+
+    void EndRun()
+    {
+        if (runCount) {
+            *cursor = { .pcAccess = runPc, .value = runCount };
+            if (file) {
+                Active().count += runCount;
+            }
+            runCount = 0;
+            if (++cursor == end) {
+                Submit();
+            }
+        }
+    }
+
+    void Submit();
+    void Write();
+};
+
+// Reads a trace back. Open() indexes the chunk headers, so Seek() only
+// decodes the records between the start of a chunk and the target.
+struct TraceReader final {
+public:
+    TraceReader() = default;
+    TraceReader(TraceReader const &) = delete;
+    TraceReader &operator=(TraceReader const &) = delete;
+    ~TraceReader();
+
+    TraceStatus Open(char const *path);
+
+    TraceLevel Level() const
+    {
+        return level;
+    }
+
+    // Positions the reader so that Next() returns the instruction retired
+    // `index`-th; false if the trace is shorter.
+    bool Seek(u64_t index);
+    bool Next(TraceRecord *record);
+
+    u64_t Count() const;
+    u64_t Position() const
+    {
+        return position;
+    }
+
+private:
+    struct ChunkIndex final {
+        u64_t offset = 0;
+        u64_t first = 0;
+        u32_t count = 0;
+        u32_t size = 0;
+    };
+
+    std::FILE *file = nullptr;
+    TraceLevel level = TraceLevel::FULL;
+    std::vector<ChunkIndex> chunks = {};
+    u32_t chunk = 0;
+    std::vector<u8_t> bytes = {};
+    u8_t const *cursor = nullptr;
+    u32_t left = 0;
+    u64_t position = 0;
+    // What is left of the FLOW run being read.
+    u32_t runPc = 0;
+    u32_t runLeft = 0;
+    TraceCodec codec = {};
+
+    bool LoadChunk(u32_t i);
+};
+
+} // namespace Sim
+
+#endif // SIM_TRACE_H
@@ -0,0 +1,70 @@
+#include "trace.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Prints a binary execution trace written by TraceWriter, one retired
+// instruction per line:
+//   huawei-riscv-rv32i-trace FILE [--seek N] [--count N]
+// A FLOW trace only has the pc of each.
+// --seek starts at the N-th retired instruction (0-based) without decoding
+// the chunks before it.
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc % 2) {
+        std::fprintf(stderr, "usage: %s FILE [--seek N] [--count N]\n", argv[0]);
+        return 2;
+    }
+
+    u64_t seek = 0;
+    u64_t count = ~(u64_t)0;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--seek")) {
+            seek = std::strtoull(argv[i + 1], nullptr, 0);
+        } else if (!std::strcmp(argv[i], "--count")) {
+            count = std::strtoull(argv[i + 1], nullptr, 0);
+        } else {
+            std::fprintf(stderr, "usage: %s FILE [--seek N] [--count N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Sim::TraceReader reader = {};
+    switch (reader.Open(argv[1])) {
+        case Sim::TraceStatus::OK:
+            break;
+        case Sim::TraceStatus::OPEN_FAILED:
+            std::fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[1]);
+            return 1;
+        default:
+            std::fprintf(stderr, "%s: %s is not a trace\n", argv[0], argv[1]);
+            return 1;
+    }
+
+    if (seek && !reader.Seek(seek)) {
+        std::fprintf(stderr, "%s: trace has only %" PRIu64 " instructions\n", argv[0], reader.Count());
+        return 1;
+    }
+
+    Sim::TraceRecord record = {};
+    for (u64_t n = 0; n < count && reader.Next(&record); ++n) {
+        if (reader.Level() == Sim::TraceLevel::FLOW) {
+            std::printf("%10" PRIu64 "  %08x\n", reader.Position() - 1, record.pc);
+            continue;
+        }
+        std::printf("%10" PRIu64 "  %08x  %08x", reader.Position() - 1, record.pc, record.inst);
+        if (record.rd) {
+            std::printf("  x%-2u = %08x", record.rd, record.rdValue);
+        }
+        if (record.access == Sim::TraceAccess::LOAD) {
+            std::printf("  load [%08x] = %08x", record.addr, record.data);
+        } else if (record.access == Sim::TraceAccess::STORE) {
+            std::printf("  store [%08x] = %08x", record.addr, record.data);
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -13,6 +13,9 @@ using u16_t = std::uint16_t;
 using i32_t = std::int32_t;
 using u32_t = std::uint32_t;
 
+using i64_t = std::int64_t;
+using u64_t = std::uint64_t;
+
 namespace Sim {
 
 enum class InstructionType : u8_t {
@@ -103,7 +106,7 @@ union Immediate {
         u32_t inst30_25 : 6;
         u32_t inst20 : 1;
         u32_t inst19_12 : 8;
-        u32_t inst31 : 11;
+        u32_t inst31 : 12;
     } jType;
 };
 static_assert(sizeof(Immediate) == sizeof(u32_t));
@@ -155,6 +158,9 @@ struct CUExecParams final {
     bool isOpcodeOk = true;
 
     bool intpt = false;
+    bool isECall = false;
+    // Orders this hart's memory accesses against other harts'.
+    bool isFence = false;
 };
 
 } // namespace Sim